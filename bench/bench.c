@@ -0,0 +1,456 @@
+/*
+ * Micro benchmarks for the text processing modules.
+ *
+ * Each benchmark is run until it took at least the minimum run time and one
+ * JSON object per benchmark is printed on stdout with the number of
+ * nanoseconds, bytes of input and allocations per operation. All inputs are
+ * generated with a fixed seed so results are comparable between runs and
+ * releases.
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+
+#include <err.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../compat/compat.h"
+
+/*
+ * Count allocations done by the modules under test by wrapping the allocation
+ * functions they use. All system headers are included above so the defines
+ * below only affect the included module sources.
+ */
+static size_t nallocs;
+
+static void *
+bench_malloc(size_t size)
+{
+	nallocs++;
+	return malloc(size);
+}
+
+static void *
+bench_calloc(size_t nmemb, size_t size)
+{
+	nallocs++;
+	return calloc(nmemb, size);
+}
+
+static void *
+bench_realloc(void *ptr, size_t size)
+{
+	nallocs++;
+	return realloc(ptr, size);
+}
+
+static void *
+bench_reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+	nallocs++;
+	return reallocarray(ptr, nmemb, size);
+}
+
+static char *
+bench_strndup(const char *s, size_t n)
+{
+	nallocs++;
+	return strndup(s, n);
+}
+
+#define malloc bench_malloc
+#define calloc bench_calloc
+#define realloc bench_realloc
+#define reallocarray bench_reallocarray
+#define strndup bench_strndup
+
+#include "../jsonify.c"
+#include "../parse_path.c"
+#include "../prefix_match.c"
+#include "../shorten.c"
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef reallocarray
+#undef strndup
+
+#define NSLISTSIZE 100000
+#define BIGDOCSIZE (1024 * 1024)
+#define MAXVALUESIZE (512 * 1024)	/* upper bound of genvalue(.., 4) */
+
+static long long mintime = 500000000;	/* minimum run time in ns */
+
+static uint32_t seed = 1;
+
+/* inputs shared by the benchmarks */
+static char *selector, *bigdoc, *bigdocstrict;
+static size_t bigdocstrictsize;
+static const char **nslist, **nsmatches, **mbnames;
+static struct pmindex nsindex;
+static char *dst;
+static size_t dstsize;
+
+/*
+ * Deterministic pseudo random number generator so generated inputs are the
+ * same on every run.
+ */
+static uint32_t
+rnd(uint32_t max)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) & 0x7fff) % max;
+}
+
+static long long
+now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(1, "clock_gettime");
+
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Append a relaxed JSON value of at most "depth" levels to "dst".
+ *
+ * Returns the number of bytes written.
+ */
+static size_t
+genvalue(char *dst, size_t dstsize, int depth)
+{
+	size_t n;
+	int i, nkeys;
+
+	if (dstsize < 256)
+		return 0;
+
+	switch (depth > 0 ? rnd(6) : rnd(3)) {
+	case 0:
+		return snprintf(dst, dstsize, "%u", rnd(100000));
+	case 1:
+		return snprintf(dst, dstsize, "\"str%u with some text\"",
+		    rnd(1000));
+	case 2:
+		return snprintf(dst, dstsize, "%s", rnd(2) ? "true" : "null");
+	case 3:
+		n = snprintf(dst, dstsize, "[");
+		nkeys = 1 + rnd(8);
+		for (i = 0; i < nkeys; i++) {
+			if (i > 0)
+				n += snprintf(dst + n, dstsize - n, ", ");
+			n += genvalue(dst + n, dstsize - n, depth - 1);
+		}
+		return n + snprintf(dst + n, dstsize - n, "]");
+	default:
+		n = snprintf(dst, dstsize, "{ ");
+		nkeys = 1 + rnd(8);
+		for (i = 0; i < nkeys; i++) {
+			if (i > 0)
+				n += snprintf(dst + n, dstsize - n, ", ");
+			n += snprintf(dst + n, dstsize - n, "key%u: ",
+			    rnd(50));
+			n += genvalue(dst + n, dstsize - n, depth - 1);
+		}
+		return n + snprintf(dst + n, dstsize - n, " }");
+	}
+}
+
+static void
+setup(void)
+{
+	static const char *mb[] = { "£", "ह", "€", "한", "𐍈", "＄", "a" };
+	char name[128];
+	size_t i, j, n;
+	const char *c;
+
+	selector = "{ name: 'bob', age: { $gt: 21 }, tags: { $in: [1, 2] } }";
+
+	/* a 1 MB document with nested objects and arrays */
+	if ((bigdoc = malloc(BIGDOCSIZE + MAXVALUESIZE)) == NULL)
+		err(1, "malloc");
+
+	n = snprintf(bigdoc, BIGDOCSIZE, "{ _id: 1");
+	while (n < BIGDOCSIZE) {
+		n += snprintf(bigdoc + n, 32, ", f%zu: ", n);
+		n += genvalue(bigdoc + n, MAXVALUESIZE - 32, 4);
+	}
+	snprintf(bigdoc + n, 32, " }");
+
+	if (relaxed_to_strict_alloc(&bigdocstrict, &bigdocstrictsize, bigdoc,
+	    strlen(bigdoc), 1) == -1)
+		errx(1, "could not create strict document");
+
+	/* a namespace list with a few long shared prefixes */
+	if ((nslist = calloc(NSLISTSIZE + 1, sizeof(*nslist))) == NULL)
+		err(1, "calloc");
+
+	for (i = 0; i < NSLISTSIZE; i++) {
+		snprintf(name, sizeof(name), "tenant_%u_%s_%06zu", rnd(20),
+		    rnd(2) ? "orders" : "events", i);
+		if ((nslist[i] = strdup(name)) == NULL)
+			err(1, "strdup");
+	}
+
+	if (prefix_match(&nsmatches, nslist, "tenant_1_") == -1)
+		err(1, "prefix_match");
+
+	if (pmindex_build(&nsindex, nslist) == -1)
+		err(1, "pmindex_build");
+
+	/* names of multibyte characters */
+	if ((mbnames = calloc(1000 + 1, sizeof(*mbnames))) == NULL)
+		err(1, "calloc");
+
+	for (i = 0; i < 1000; i++) {
+		/* a shared prefix of 8 characters and a random suffix */
+		for (j = 0, n = 0; j < 16; j++) {
+			c = j < 8 ? mb[j % 4] : mb[rnd(7)];
+			n += snprintf(name + n, sizeof(name) - n, "%s", c);
+		}
+		if ((mbnames[i] = strdup(name)) == NULL)
+			err(1, "strdup");
+	}
+}
+
+static int
+b_relaxed_to_strict_selector(void)
+{
+	return relaxed_to_strict_alloc(&dst, &dstsize, selector,
+	    strlen(selector), 1) == -1;
+}
+
+static int
+b_relaxed_to_strict_1mb(void)
+{
+	return relaxed_to_strict_alloc(&dst, &dstsize, bigdoc, strlen(bigdoc),
+	    1) == -1;
+}
+
+static int
+b_human_readable_1mb(void)
+{
+	return human_readable_alloc(&dst, &dstsize, bigdocstrict,
+	    strlen(bigdocstrict)) == -1;
+}
+
+static int
+b_prefix_match_100k(void)
+{
+	const char **matches;
+
+	if (prefix_match(&matches, nslist, "tenant_1_") == -1)
+		return 1;
+
+	free(matches);
+	return 0;
+}
+
+static int
+b_pmindex_range_100k(void)
+{
+	size_t first;
+
+	return pmindex_range(&nsindex, "tenant_1_", &first) == 0;
+}
+
+static int
+b_pmindex_lcp(void)
+{
+	size_t first, n;
+
+	n = pmindex_range(&nsindex, "tenant_1_", &first);
+	return pmindex_lcp(&nsindex, first, n) == -1;
+}
+
+static int
+b_common_prefix_matches(void)
+{
+	return common_prefix(nsmatches) == -1;
+}
+
+static int
+b_common_prefix_multibyte(void)
+{
+	return common_prefix(mbnames) == -1;
+}
+
+static int
+b_shorten_comps_multibyte(void)
+{
+	char c1[128], c2[128];
+
+	strlcpy(c1, mbnames[0], sizeof(c1));
+	strlcpy(c2, mbnames[1], sizeof(c2));
+
+	return shorten_comps(c1, c2, 16) == (size_t)-1;
+}
+
+static int
+b_resolvepath(void)
+{
+	char p[PATH_MAX] = "/somedb/somecoll";
+
+	return resolvepath(p, sizeof(p), "../other/./x//y/../../raboof/qux",
+	    NULL) == (size_t)-1;
+}
+
+struct bench {
+	const char *name;
+	const char *input;
+	int (*fn)(void);
+	size_t *bytes;	/* input size, if any */
+};
+
+static size_t selectorsize, bigdocsize, bigdocstrictlen, nslistbytes;
+static size_t nsmatchesbytes, mbnamesbytes, mbpairbytes, pathbytes;
+
+static struct bench benches[] = {
+	{ "relaxed_to_strict", "selector", b_relaxed_to_strict_selector,
+	    &selectorsize },
+	{ "relaxed_to_strict", "nested_1mb", b_relaxed_to_strict_1mb,
+	    &bigdocsize },
+	{ "human_readable", "nested_1mb", b_human_readable_1mb,
+	    &bigdocstrictlen },
+	{ "prefix_match", "namespaces_100k", b_prefix_match_100k,
+	    &nslistbytes },
+	{ "pmindex_range", "namespaces_100k", b_pmindex_range_100k,
+	    &nslistbytes },
+	{ "pmindex_lcp", "namespaces_100k", b_pmindex_lcp, &nslistbytes },
+	{ "common_prefix", "namespace_matches", b_common_prefix_matches,
+	    &nsmatchesbytes },
+	{ "common_prefix", "multibyte_1k", b_common_prefix_multibyte,
+	    &mbnamesbytes },
+	{ "shorten_comps", "multibyte", b_shorten_comps_multibyte,
+	    &mbpairbytes },
+	{ "resolvepath", "relative", b_resolvepath, &pathbytes },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static size_t
+avbytes(const char **av)
+{
+	size_t i, n;
+
+	for (i = 0, n = 0; av[i] != NULL; i++)
+		n += strlen(av[i]);
+
+	return n;
+}
+
+/*
+ * Run "b" with an increasing number of iterations until it took at least
+ * mintime and print the results.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+run(const struct bench *b)
+{
+	long long start, elapsed;
+	size_t i, iters, allocs;
+	double nsop;
+
+	/* warm up any buffers that are reused between calls */
+	if (b->fn() != 0)
+		return -1;
+
+	for (iters = 1;; iters *= 2) {
+		nallocs = 0;
+		start = now();
+		for (i = 0; i < iters; i++)
+			if (b->fn() != 0)
+				return -1;
+		elapsed = now() - start;
+		allocs = nallocs;
+
+		if (elapsed >= mintime || iters > SIZE_MAX / 2)
+			break;
+	}
+
+	nsop = (double)elapsed / iters;
+
+	printf("{\"bench\":\"%s\",\"input\":\"%s\",\"iterations\":%zu,"
+	    "\"ns_op\":%.1f,\"bytes_op\":%zu,\"mb_s\":%.2f,"
+	    "\"allocs_op\":%.2f}\n", b->name, b->input, iters, nsop,
+	    *b->bytes, *b->bytes / nsop * 1e9 / (1024 * 1024),
+	    (double)allocs / iters);
+
+	return 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: benchmark [-t msec] [name ...]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	char *ep;
+	int c, i, j, failed;
+
+	if (setlocale(LC_CTYPE, "") == NULL || MB_CUR_MAX == 1)
+		errx(1, "make sure your locale supports UTF-8, try: "
+		    "LC_CTYPE=C.UTF-8; export LC_CTYPE");
+
+	while ((c = getopt(argc, argv, "t:")) != -1) {
+		switch (c) {
+		case 't':
+			mintime = strtoll(optarg, &ep, 10);
+			if (*ep != '\0' || mintime <= 0 ||
+			    mintime > LLONG_MAX / 1000000)
+				errx(1, "invalid minimum run time: %s", optarg);
+			mintime *= 1000000;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	setup();
+
+	selectorsize = strlen(selector);
+	bigdocsize = strlen(bigdoc);
+	bigdocstrictlen = strlen(bigdocstrict);
+	nslistbytes = avbytes(nslist);
+	nsmatchesbytes = avbytes(nsmatches);
+	mbnamesbytes = avbytes(mbnames);
+	mbpairbytes = strlen(mbnames[0]) + strlen(mbnames[1]);
+	pathbytes = strlen("/somedb/somecoll") +
+	    strlen("../other/./x//y/../../raboof/qux");
+
+	failed = 0;
+	for (i = 0; benches[i].name != NULL; i++) {
+		if (argc > 0) {
+			for (j = 0; j < argc; j++)
+				if (strcmp(argv[j], benches[i].name) == 0)
+					break;
+			if (j == argc)
+				continue;
+		}
+
+		if (run(&benches[i]) == -1) {
+			warnx("%s %s failed", benches[i].name,
+			    benches[i].input);
+			failed++;
+		}
+	}
+
+	return failed;
+}
@@ -0,0 +1,473 @@
+/*
+ * Differential fuzzing harness for the JSON, path and prefix engines.
+ *
+ * Every input is run through a reference engine and each alternative engine
+ * that must produce byte-identical results. Any divergence is reported on
+ * stderr followed by abort(3), so libFuzzer and AFL record it as a crash.
+ *
+ * The first byte of an input selects the target:
+ *   j  relaxed_to_strict
+ *   h  human_readable
+ *   s  relaxed_to_strict on a stream of objects
+ *   p  resolvepath, the rest of the input is "cwd\npath"
+ *   m  pmindex, the rest of the input is "prefix\nname\nname..."
+ *
+ * Build with -DLIBFUZZER for libFuzzer, otherwise a main(3) is included that
+ * runs each file given as an argument, or stdin, which works with AFL.
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../jsonify.c"
+#include "../parse_path.c"
+#include "../prefix_match.c"
+
+#define REFSIZE (1024 * 1024)	/* output buffer of the reference engines */
+
+static char refout[REFSIZE];
+
+/*
+ * A JSON engine converts "src" into a growable, null terminated *dst and
+ * returns the number of bytes parsed or -1 on failure, like
+ * relaxed_to_strict_alloc.
+ */
+struct jsonengine {
+	const char *name;
+	int (*fn)(char **dst, size_t *dstsize, const char *src, size_t srclen,
+	    int maxobjects);
+	size_t initsize;	/* initial size of *dst, 0 means NULL */
+};
+
+/*
+ * A path engine resolves "n" relative to the absolute path "c" like
+ * resolvepath.
+ */
+struct pathengine {
+	const char *name;
+	size_t (*fn)(char *c, size_t csize, const char *n, int *comps);
+};
+
+static int
+strict_alloc(char **dst, size_t *dstsize, const char *src, size_t srclen,
+    int maxobjects)
+{
+	return relaxed_to_strict_alloc(dst, dstsize, src, srclen, maxobjects);
+}
+
+static int
+hr_alloc(char **dst, size_t *dstsize, const char *src, size_t srclen,
+    int maxobjects)
+{
+	(void)maxobjects;
+	return human_readable_alloc(dst, dstsize, src, srclen);
+}
+
+/*
+ * Feed src to a jsonstream in small chunks and convert each object on its own.
+ * Returns -2 if src does not consist of objects only, because the reference
+ * does not unwrap a top-level array and jsmn accepts any value as a root.
+ */
+static int
+stream_strict(char **dst, size_t *dstsize, const char *src, size_t srclen,
+    int maxobjects)
+{
+	struct jsonstream js;
+	const char *obj;
+	char *objout;
+	size_t objlen, objoutsize, dstlen, fed, chunk, len;
+	int r, n, nobj;
+
+	(void)maxobjects;
+
+	if (src[strspn(src, " \t\r\n")] == '[')
+		return -2;
+
+	jsonstream_init(&js);
+
+	if ((*dst = realloc(*dst, 1)) == NULL)
+		err(1, "realloc");
+	(*dst)[0] = '\0';
+	*dstsize = 1;
+
+	objout = NULL;
+	objoutsize = 0;
+	dstlen = 0;
+	fed = 0;
+	n = 0;
+	r = 0;
+	nobj = 0;
+
+	/* vary chunk boundaries with the input */
+	chunk = srclen % 7 + 1;
+
+	while (fed < srclen && r != -1) {
+		len = srclen - fed < chunk ? srclen - fed : chunk;
+		if (jsonstream_feed(&js, src + fed, len) == -1)
+			err(1, "jsonstream_feed");
+		fed += len;
+
+		while ((r = jsonstream_next(&js, &obj, &objlen)) == 1) {
+			if (relaxed_to_strict_alloc(&objout, &objoutsize, obj,
+			    objlen, 1) != (int)objlen + 1) {
+				r = -1;
+				break;
+			}
+
+			len = strlen(objout);
+			if ((*dst = realloc(*dst, dstlen + len + 1)) == NULL)
+				err(1, "realloc");
+			memcpy(*dst + dstlen, objout, len + 1);
+			dstlen += len;
+			*dstsize = dstlen + 1;
+
+			/* offset in src of the end of the object */
+			n = fed - (js.buflen - js.pos) + 1;
+			nobj++;
+		}
+	}
+
+	if (r == -1)
+		n = -2;
+	else if (jsonstream_pending(&js))
+		n = -1;
+
+	/* jsmn must not see more roots than there are objects */
+	if (n >= 0 && relaxed_to_strict_alloc(&objout, &objoutsize, src, srclen,
+	    nobj) != relaxed_to_strict_alloc(&objout, &objoutsize, src, srclen,
+	    -1))
+		n = -2;
+
+	free(objout);
+	jsonstream_free(&js);
+
+	return n;
+}
+
+/*
+ * Resolve a relative path by making it absolute first, which takes a
+ * different route through resolvepath than relative paths do.
+ */
+static size_t
+path_absolute(char *c, size_t csize, const char *n, int *comps)
+{
+	char *p;
+	size_t r, plen;
+
+	if (n[0] == '/' || c[0] != '/')
+		return resolvepath(c, csize, n, comps);
+
+	plen = strlen(c) + 1 + strlen(n) + 1;
+	if ((p = malloc(plen)) == NULL)
+		err(1, "malloc");
+	snprintf(p, plen, "%s/%s", c, n);
+
+	r = resolvepath(c, csize, p, comps);
+	free(p);
+
+	return r;
+}
+
+/*
+ * Resolve with "c" and "n" pointing to the same buffer.
+ */
+static size_t
+path_inplace(char *c, size_t csize, const char *n, int *comps)
+{
+	char *cp;
+	size_t r;
+
+	if (n[0] != '/')
+		return resolvepath(c, csize, n, comps);
+
+	if ((cp = strdup(n)) == NULL)
+		err(1, "strdup");
+
+	if (strlen(cp) >= csize) {
+		free(cp);
+		return resolvepath(c, csize, n, comps);
+	}
+
+	memcpy(c, cp, strlen(cp) + 1);
+	r = resolvepath(c, csize, c, comps);
+	free(cp);
+
+	return r;
+}
+
+static const struct jsonengine strictengines[] = {
+	{ "relaxed_to_strict_alloc", strict_alloc, 0 },
+	{ "relaxed_to_strict_alloc/1", strict_alloc, 1 },
+	{ NULL, NULL, 0 }
+};
+
+static const struct jsonengine hrengines[] = {
+	{ "human_readable_alloc", hr_alloc, 0 },
+	{ "human_readable_alloc/1", hr_alloc, 1 },
+	{ NULL, NULL, 0 }
+};
+
+static const struct jsonengine streamengines[] = {
+	{ "jsonstream", stream_strict, 0 },
+	{ NULL, NULL, 0 }
+};
+
+static const struct pathengine pathengines[] = {
+	{ "resolvepath/absolute", path_absolute },
+	{ "resolvepath/inplace", path_inplace },
+	{ NULL, NULL }
+};
+
+static void
+diverged(const char *engine, const char *src, size_t srclen, const char *exp,
+    int expr, const char *got, int gotr)
+{
+	fprintf(stderr, "DIVERGENCE: %s\ninput: \"%.*s\"\n"
+	    "reference: %d \"%s\"\n%s: %d \"%s\"\n", engine, (int)srclen, src,
+	    expr, exp, engine, gotr, got);
+	abort();
+}
+
+static void
+difjson(const struct jsonengine *engines, int maxobjects, const char *src,
+    size_t srclen, int (*ref)(char *, size_t, const char *, size_t, int))
+{
+	const struct jsonengine *e;
+	char *dst;
+	size_t dstsize;
+	int expr, r;
+
+	expr = ref(refout, sizeof(refout), src, srclen, maxobjects);
+
+	for (e = engines; e->name != NULL; e++) {
+		dstsize = e->initsize;
+		dst = NULL;
+		if (dstsize > 0 && (dst = malloc(dstsize)) == NULL)
+			err(1, "malloc");
+
+		r = e->fn(&dst, &dstsize, src, srclen, maxobjects);
+
+		/*
+		 * Nothing to compare if the engine does not apply or if both
+		 * failed. The reference fails if its output does not fit.
+		 */
+		if (r == -2 || (r == -1 && expr == -1) || (expr == -1 &&
+		    dst != NULL && strlen(dst) >= sizeof(refout) - 1)) {
+			free(dst);
+			continue;
+		}
+
+		if (r != expr || dst == NULL || strcmp(dst, refout) != 0)
+			diverged(e->name, src, srclen, refout, expr,
+			    dst ? dst : "(null)", r);
+
+		free(dst);
+	}
+}
+
+static int
+hr_ref(char *dst, size_t dstsize, const char *src, size_t srclen,
+    int maxobjects)
+{
+	(void)maxobjects;
+	return human_readable(dst, dstsize, src, srclen);
+}
+
+static void
+difpath(const char *src, size_t srclen)
+{
+	const struct pathengine *e;
+	char c[PATH_MAX], exp[PATH_MAX], *n;
+	const char *nl;
+	size_t clen, expr, r;
+	int expcomps, comps;
+
+	if ((nl = memchr(src, '\n', srclen)) == NULL)
+		return;
+
+	clen = nl - src;
+	if (clen >= sizeof(c))
+		return;
+
+	if ((n = strndup(nl + 1, srclen - clen - 1)) == NULL)
+		err(1, "strndup");
+
+	memcpy(exp, src, clen);
+	exp[clen] = '\0';
+	expr = resolvepath(exp, sizeof(exp), n, &expcomps);
+
+	for (e = pathengines; e->name != NULL; e++) {
+		memcpy(c, src, clen);
+		c[clen] = '\0';
+		comps = 0;
+
+		r = e->fn(c, sizeof(c), n, &comps);
+
+		/* results are only defined on success */
+		if (r == (size_t)-1 && expr == (size_t)-1)
+			continue;
+
+		if (r != expr || (r < sizeof(c) && (comps != expcomps ||
+		    strcmp(c, exp) != 0)))
+			diverged(e->name, src, srclen, exp, (int)expr, c,
+			    (int)r);
+	}
+
+	free(n);
+}
+
+/*
+ * Compare the range and common prefix of a pmindex query with prefix_match and
+ * common_prefix on the unsorted list.
+ */
+static void
+difprefix(const char *src, size_t srclen)
+{
+	struct pmindex idx;
+	const char **names, **matches;
+	char *s, *prefix, *p;
+	size_t i, n, nnames, first;
+	int expr, r;
+
+	if ((s = strndup(src, srclen)) == NULL)
+		err(1, "strndup");
+
+	nnames = 0;
+	for (p = s; *p != '\0'; p++)
+		if (*p == '\n')
+			nnames++;
+
+	if ((names = calloc(nnames + 1, sizeof(*names))) == NULL)
+		err(1, "calloc");
+
+	/* split on newlines, the first line is the prefix */
+	prefix = s;
+	for (i = 0, p = s; (p = strchr(p, '\n')) != NULL; i++) {
+		*p++ = '\0';
+		names[i] = p;
+	}
+
+	if (prefix_match(&matches, names, prefix) == -1)
+		err(1, "prefix_match");
+	if (pmindex_build(&idx, names) == -1)
+		err(1, "pmindex_build");
+
+	for (n = 0; matches[n] != NULL; n++)
+		;
+	qsort(matches, n, sizeof(*matches), cmpstr);
+
+	if (pmindex_range(&idx, prefix, &first) != n)
+		diverged("pmindex_range", src, srclen, "", (int)n, "",
+		    (int)pmindex_range(&idx, prefix, &first));
+
+	for (i = 0; i < n; i++)
+		if (strcmp(idx.v[first + i], matches[i]) != 0)
+			diverged("pmindex_range", src, srclen, matches[i], 0,
+			    idx.v[first + i], 0);
+
+	expr = common_prefix(matches);
+	r = pmindex_lcp(&idx, first, n);
+	if (r != expr)
+		diverged("pmindex_lcp", src, srclen, "", expr, "", r);
+
+	pmindex_free(&idx);
+	free(matches);
+	free(names);
+	free(s);
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	char *src;
+	size_t srclen;
+
+	if (size < 1)
+		return 0;
+
+	/* the engines stop at a null byte, like jsmn does */
+	if ((src = strndup((const char *)data + 1, size - 1)) == NULL)
+		err(1, "strndup");
+	srclen = strlen(src);
+
+	switch (data[0]) {
+	case 'j':
+		difjson(strictengines, -1, src, srclen, relaxed_to_strict);
+		difjson(strictengines, 1, src, srclen, relaxed_to_strict);
+		break;
+	case 'h':
+		difjson(hrengines, 0, src, srclen, hr_ref);
+		break;
+	case 's':
+		difjson(streamengines, -1, src, srclen, relaxed_to_strict);
+		break;
+	case 'p':
+		difpath(src, srclen);
+		break;
+	case 'm':
+		difprefix(src, srclen);
+		break;
+	}
+
+	free(src);
+
+	return 0;
+}
+
+#ifndef LIBFUZZER
+/*
+ * Run one input read from "fp".
+ */
+static void
+runfile(FILE *fp, const char *name)
+{
+	uint8_t *buf;
+	size_t n, bufsize;
+
+	bufsize = 0;
+	buf = NULL;
+	n = 0;
+	do {
+		if (n == bufsize) {
+			bufsize = bufsize ? 2 * bufsize : 4096;
+			if ((buf = realloc(buf, bufsize)) == NULL)
+				err(1, "realloc");
+		}
+		n += fread(buf + n, 1, bufsize - n, fp);
+	} while (!feof(fp) && !ferror(fp));
+
+	if (ferror(fp))
+		err(1, "%s", name);
+
+	LLVMFuzzerTestOneInput(buf, n);
+	free(buf);
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *fp;
+	int i;
+
+	if (argc < 2) {
+		runfile(stdin, "stdin");
+		return 0;
+	}
+
+	for (i = 1; i < argc; i++) {
+		if ((fp = fopen(argv[i], "r")) == NULL)
+			err(1, "%s", argv[i]);
+		runfile(fp, argv[i]);
+		fclose(fp);
+	}
+
+	return 0;
+}
+#endif
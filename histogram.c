@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2026 Tim Kuijsten
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "histogram.h"
+
+/*
+ * Return the bucket of "v". Values below HISTSUB have their own bucket, larger
+ * values are divided into HISTSUB / 2 buckets per power of two.
+ */
+static int
+bucket(uint64_t v)
+{
+	int e;
+
+	if (v < HISTSUB)
+		return v;
+
+	/* e is the number of low bits that are dropped */
+	for (e = 1; (v >> e) >= HISTSUB; e++)
+		;
+
+	return HISTSUB + (e - 1) * (HISTSUB / 2) + (v >> e) - HISTSUB / 2;
+}
+
+/*
+ * Return the highest value that is counted in bucket "b".
+ */
+static uint64_t
+bucketmax(int b)
+{
+	uint64_t m;
+	int e;
+
+	if (b < HISTSUB)
+		return b;
+
+	e = (b - HISTSUB) / (HISTSUB / 2) + 1;
+	m = (b - HISTSUB) % (HISTSUB / 2) + HISTSUB / 2;
+
+	return ((m + 1) << e) - 1;
+}
+
+void
+histogram_init(struct histogram *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void
+histogram_add(struct histogram *h, uint64_t v)
+{
+	h->counts[bucket(v)]++;
+
+	if (h->n == 0 || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+
+	h->n++;
+	h->sum += v;
+}
+
+/*
+ * Add all values of "src" to "dst".
+ */
+void
+histogram_merge(struct histogram *dst, const struct histogram *src)
+{
+	int i;
+
+	if (src->n == 0)
+		return;
+
+	for (i = 0; i < HISTBUCKETS; i++)
+		dst->counts[i] += src->counts[i];
+
+	if (dst->n == 0 || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+
+	dst->n += src->n;
+	dst->sum += src->sum;
+}
+
+/*
+ * Return the value below which "p" percent of all values fall. The result is
+ * the highest value of the bucket, but never more than the maximum recorded
+ * value. Returns 0 if the histogram is empty.
+ */
+uint64_t
+histogram_percentile(const struct histogram *h, double p)
+{
+	uint64_t rank, seen, v;
+	int i;
+
+	if (h->n == 0)
+		return 0;
+
+	if (p <= 0)
+		return h->min;
+
+	rank = (uint64_t)(p / 100 * h->n + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > h->n)
+		rank = h->n;
+
+	seen = 0;
+	for (i = 0; i < HISTBUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen >= rank)
+			break;
+	}
+
+	v = bucketmax(i);
+	if (v > h->max)
+		v = h->max;
+	if (v < h->min)
+		v = h->min;
+
+	return v;
+}
+
+uint64_t
+histogram_mean(const struct histogram *h)
+{
+	if (h->n == 0)
+		return 0;
+
+	return h->sum / h->n;
+}
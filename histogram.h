@@ -0,0 +1,45 @@
+/**
+ * Copyright (c) 2026 Tim Kuijsten
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HISTSUBBITS 6	/* 64 linear sub-buckets per power of two */
+#define HISTSUB (1 << HISTSUBBITS)
+#define HISTBUCKETS (HISTSUB + (64 - HISTSUBBITS) * (HISTSUB / 2))
+
+/*
+ * Log-linear histogram of unsigned values, like HdrHistogram with two
+ * significant decimal digits. Any value can be recorded and is counted in a
+ * bucket that is at most 1/32 (~3%) of the value wide.
+ */
+struct histogram {
+	uint64_t counts[HISTBUCKETS];
+	uint64_t n;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+};
+
+void histogram_init(struct histogram *h);
+void histogram_add(struct histogram *h, uint64_t v);
+void histogram_merge(struct histogram *dst, const struct histogram *src);
+uint64_t histogram_percentile(const struct histogram *h, double p);
+uint64_t histogram_mean(const struct histogram *h);
+
+#endif
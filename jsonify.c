@@ -18,22 +18,36 @@
 #define _XOPEN_SOURCE 700
 #endif
 
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "jsmn.h"
+#include "jsonify.h"
 
-#define TOKENS 100000
-#define MAXSTACK 10000
+#define MINTOKENS 256	/* initial number of tokens */
+#define KEEPTOKENS 4096	/* keep at most this many tokens between calls */
+#define MINSTACK 64	/* initial stack size */
+#define KEEPSTACK 4096	/* keep at most this stack size between calls */
 
-static int sp = 0;
-static int stack[MAXSTACK];
-static char closesym[MAXSTACK];
+/*
+ * Token buffer, grown on demand and reused between calls. All conversion state
+ * is per thread so that threads can convert at the same time.
+ */
+static _Thread_local jsmntok_t *tokens;
+static _Thread_local size_t ntokens;
 
-static char *out;
-static size_t outsize;
-static size_t outidx = 0;
+static _Thread_local int sp = 0;
+static _Thread_local int *stack;
+static _Thread_local char *closesym;	/* room for stacksize + 1 symbols */
+static _Thread_local size_t stacksize;
+
+static _Thread_local char *out;
+static _Thread_local size_t outsize;
+static _Thread_local size_t outidx = 0;
+static _Thread_local int outgrow;	/* whether out may be realloc(3)ed */
 
 /*
  * Pop item from the stack.
@@ -48,6 +62,35 @@ pop()
 	return stack[--sp];
 }
 
+/*
+ * Double the size of the stack.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+growstack(void)
+{
+	size_t n;
+	int *p;
+	char *cp;
+
+	n = stacksize ? 2 * stacksize : MINSTACK;
+	if (n > INT_MAX || n > SIZE_MAX / sizeof(*stack))
+		return -1;
+
+	if ((p = realloc(stack, n * sizeof(*stack))) == NULL)
+		return -1;
+	stack = p;
+
+	if ((cp = realloc(closesym, n + 1)) == NULL)
+		return -1;
+	closesym = cp;
+
+	stacksize = n;
+
+	return 0;
+}
+
 /*
  * Push new item on the stack, all ints except -1 can be pushed.
  */
@@ -60,7 +103,7 @@ push(int val)
 		abort();
 	}
 
-	if (sp == MAXSTACK) {
+	if ((size_t)sp == stacksize && growstack() == -1) {
 		fprintf(stderr, "can not push %d, stack full\n", val);
 		abort();
 	}
@@ -71,14 +114,105 @@ push(int val)
 static int
 addout(char *src, size_t size)
 {
-	if (outidx + size >= outsize)
-		return -1;
+	size_t n;
+	char *p;
+
+	if (outidx + size >= outsize) {
+		if (!outgrow)
+			return -1;
+
+		for (n = outsize; outidx + size >= n; n *= 2)
+			if (n > SIZE_MAX / 2)
+				return -1;
+
+		if ((p = realloc(out, n)) == NULL)
+			return -1;
+
+		out = p;
+		outsize = n;
+	}
 	memcpy(out + outidx, src, size);
 	outidx += size;
 	out[outidx] = '\0';
 	return 0;
 }
 
+/*
+ * Tokenize src into the shared token buffer, growing it as needed.
+ *
+ * Returns the number of tokens on success or a negative jsmnerr on failure.
+ */
+static int
+tokenize(const char *src, size_t srcsize)
+{
+	jsmn_parser parser;
+	jsmntok_t *p;
+	size_t n;
+	int r;
+
+	jsmn_init(&parser);
+
+	for (;;) {
+		if (ntokens > 0) {
+			r = jsmn_parse(&parser, src, srcsize, tokens, ntokens);
+			if (r != JSMN_ERROR_NOMEM)
+				return r;
+		}
+
+		/* the parser resumes where it ran out of tokens */
+		n = ntokens ? 2 * ntokens : MINTOKENS;
+		if (n > UINT_MAX || n > SIZE_MAX / sizeof(*tokens))
+			return JSMN_ERROR_NOMEM;
+
+		if ((p = realloc(tokens, n * sizeof(*tokens))) == NULL)
+			return JSMN_ERROR_NOMEM;
+
+		tokens = p;
+		ntokens = n;
+	}
+}
+
+/*
+ * Release the token buffer and stack if they grew big while converting one
+ * large document so that memory use is small between calls.
+ */
+static void
+shrink(void)
+{
+	if (ntokens > KEEPTOKENS) {
+		free(tokens);
+		tokens = NULL;
+		ntokens = 0;
+	}
+
+	if (stacksize > KEEPSTACK) {
+		free(stack);
+		stack = NULL;
+		free(closesym);
+		closesym = NULL;
+		stacksize = 0;
+	}
+}
+
+/*
+ * Release the token buffer and stack of the calling thread. Call before a
+ * thread that converted documents exits.
+ */
+void
+jsonify_free(void)
+{
+	free(tokens);
+	tokens = NULL;
+	ntokens = 0;
+
+	free(stack);
+	stack = NULL;
+	free(closesym);
+	closesym = NULL;
+	stacksize = 0;
+	sp = 0;
+}
+
 /*
  * Run iterator on each token in tokens.
  *
@@ -304,6 +438,56 @@ strict_writer(jsmntok_t * tok, char *key, int depth, int ndepth, char *closesym)
 	return 0;
 }
 
+/*
+ * Write the keys of objects and the nesting of objects and arrays but leave out
+ * all values, so that queries that only differ in their values have the same
+ * shape. Arrays of values become empty, root values become a "?" and roots are
+ * separated by a space.
+ */
+static int
+shape_writer(jsmntok_t * tok, char *key, int depth, int ndepth, char *closesym)
+{
+	char last;
+
+	(void)ndepth;
+
+	if (depth == 0 && outidx > 0)
+		addout(" ", 1);
+
+	last = outidx > 0 ? out[outidx - 1] : ' ';
+
+	switch (tok->type) {
+	case JSMN_OBJECT:
+	case JSMN_ARRAY:
+		if (last == '}' || last == ']')
+			addout(",", 1);
+		else if (last != ' ' && last != '{' && last != '[')
+			addout(":", 1);	/* the value of a key */
+
+		addout(tok->type == JSMN_OBJECT ? "{" : "[", 1);
+		break;
+	case JSMN_UNDEFINED:
+	case JSMN_STRING:
+	case JSMN_PRIMITIVE:
+		if (tok->size) {/* this is a key */
+			if (last != '{')
+				addout(",", 1);
+			addout(key, strlen(key));
+		} else if (depth == 0) {
+			addout("?", 1);
+		}
+		break;
+	default:
+		fprintf(stderr, "unknown json token type: %d\n", tok->type);
+		abort();
+	}
+
+	if (addout(closesym, strlen(closesym)) < 0)
+		return -1;
+
+	return 0;
+}
+
 /*
 static void
 print_tokens(const char *src, jsmntok_t *tokens, int nrtokens)
@@ -323,46 +507,96 @@ print_tokens(const char *src, jsmntok_t *tokens, int nrtokens)
 */
 
 /*
- * Create an indented representation of src with keys unescaped.
+ * Convert src by running writer on each token. If grow is set, *dst is a
+ * buffer of *dstsize bytes allocated by malloc(3) (or NULL) that is grown as
+ * needed.
  *
  * Returns the number of bytes parsed in src on success, or -1 on error.
- * On success, if dstsize > 0 a null byte is always written.
+ * On success, if *dstsize > 0 a null byte is always written.
  */
-int
-human_readable(char *dst, size_t dstsize, const char *src, size_t srcsize)
+static int
+convert(char **dst, size_t *dstsize, int grow, const char *src,
+    size_t srcsize, int maxroots,
+    int (*writer)(jsmntok_t *, char *, int, int, char *))
 {
-	jsmntok_t tokens[TOKENS];
-	jsmn_parser parser;
-	ssize_t nrtokens;
-	int r;
+	int nrtokens, r;
 
-	jsmn_init(&parser);
-	nrtokens = jsmn_parse(&parser, src, srcsize, tokens, TOKENS);
+	sp = 0;
+	if (stacksize == 0 && growstack() == -1)
+		return -1;
+
+	if (grow && *dstsize < 1) {
+		free(*dst);
+		if ((*dst = malloc(srcsize + 1)) == NULL) {
+			*dstsize = 0;
+			return -1;
+		}
+		*dstsize = srcsize + 1;
+	}
 
-	if (nrtokens < 0)
+	nrtokens = tokenize(src, srcsize);
+
+	if (nrtokens < 0) {
+		shrink();
 		return -1;
+	}
 
 	if (nrtokens == 0) {
-		if (dstsize > 0)
-			dst[0] = '\0';
+		if (*dstsize > 0)
+			(*dst)[0] = '\0';
 
 		return 0;
 	}
 
-	if (dstsize < 1)
+	if (*dstsize < 1)
 		return -1;
 
-	out = dst;
-	outsize = dstsize;
+	out = *dst;
+	outsize = *dstsize;
 	out[0] = '\0';
 	outidx = 0;
+	outgrow = grow;
 
-	r = iterate(src, tokens, nrtokens, 0, human_readable_writer);
-	if (r == -1)
-		return -1;
+	r = iterate(src, tokens, nrtokens, maxroots, writer);
+
+	/* out might be moved by addout */
+	*dst = out;
+	*dstsize = outsize;
+	out = NULL;
 
 	// return end of last processed root object token
-	return tokens[r].end + 1;
+	if (r != -1)
+		r = tokens[r].end + 1;
+
+	shrink();
+
+	return r;
+}
+
+/*
+ * Create an indented representation of src with keys unescaped.
+ *
+ * Returns the number of bytes parsed in src on success, or -1 on error.
+ * On success, if dstsize > 0 a null byte is always written.
+ */
+int
+human_readable(char *dst, size_t dstsize, const char *src, size_t srcsize)
+{
+	return convert(&dst, &dstsize, 0, src, srcsize, 0,
+	    human_readable_writer);
+}
+
+/*
+ * Like human_readable, but *dst is a buffer of *dstsize bytes allocated by
+ * malloc(3) that is grown as needed, similar to getline(3). *dst may be NULL if
+ * *dstsize is 0. The caller must free(3) *dst.
+ */
+int
+human_readable_alloc(char **dst, size_t *dstsize, const char *src,
+    size_t srcsize)
+{
+	return convert(dst, dstsize, 1, src, srcsize, 0,
+	    human_readable_writer);
 }
 
 /*
@@ -375,36 +609,210 @@ int
 relaxed_to_strict(char *dst, size_t dstsize, const char *src, size_t srcsize,
     int maxobjects)
 {
-	jsmntok_t tokens[TOKENS];
-	jsmn_parser parser;
-	ssize_t nrtokens;
-	int r;
+	return convert(&dst, &dstsize, 0, src, srcsize, maxobjects,
+	    strict_writer);
+}
 
-	jsmn_init(&parser);
-	nrtokens = jsmn_parse(&parser, src, srcsize, tokens, TOKENS);
+/*
+ * Like relaxed_to_strict, but *dst is a buffer of *dstsize bytes allocated by
+ * malloc(3) that is grown as needed, similar to getline(3). *dst may be NULL if
+ * *dstsize is 0. The caller must free(3) *dst.
+ */
+int
+relaxed_to_strict_alloc(char **dst, size_t *dstsize, const char *src,
+    size_t srcsize, int maxobjects)
+{
+	return convert(dst, dstsize, 1, src, srcsize, maxobjects,
+	    strict_writer);
+}
 
-	if (nrtokens < 0)
-		return -1;
+/*
+ * Write the shape of all relaxed JSON values in src into *dst, which is a
+ * buffer of *dstsize bytes allocated by malloc(3) that is grown as needed, like
+ * relaxed_to_strict_alloc. See shape_writer for the format. The caller must
+ * free(3) *dst.
+ *
+ * Returns the number of bytes parsed in src on success, or -1 on error.
+ */
+int
+query_shape_alloc(char **dst, size_t *dstsize, const char *src,
+    size_t srcsize)
+{
+	return convert(dst, dstsize, 1, src, srcsize, 0, shape_writer);
+}
 
-	if (nrtokens == 0) {
-		if (dstsize > 0)
-			dst[0] = '\0';
+/*
+ * Initialize a stream of JSON objects. Release with jsonstream_free.
+ */
+void
+jsonstream_init(struct jsonstream *js)
+{
+	memset(js, 0, sizeof(*js));
+}
 
-		return 0;
+/*
+ * Append "srclen" bytes of "src" to the stream. Any bytes that are consumed by
+ * jsonstream_next are discarded first so the buffer never holds more than the
+ * current partial object plus "src".
+ *
+ * Return 0 on success, -1 on failure with errno set.
+ */
+int
+jsonstream_feed(struct jsonstream *js, const char *src, size_t srclen)
+{
+	size_t need;
+	char *p;
+
+	if (js->start > 0) {
+		memmove(js->buf, js->buf + js->start, js->buflen - js->start);
+		js->buflen -= js->start;
+		js->pos -= js->start;
+		js->start = 0;
 	}
 
-	if (dstsize < 1)
-		return -1;
+	need = js->buflen + srclen;
+	if (need > js->bufsize) {
+		if (need < 2 * js->bufsize)
+			need = 2 * js->bufsize;
 
-	out = dst;
-	outsize = dstsize;
-	out[0] = '\0';
-	outidx = 0;
+		if ((p = realloc(js->buf, need)) == NULL)
+			return -1;
 
-	r = iterate(src, tokens, nrtokens, maxobjects, strict_writer);
-	if (r == -1)
-		return -1;
+		js->buf = p;
+		js->bufsize = need;
+	}
 
-	// return end of last processed root object token
-	return tokens[r].end + 1;
+	memcpy(js->buf + js->buflen, src, srclen);
+	js->buflen += srclen;
+
+	return 0;
+}
+
+/*
+ * Scan the stream for the next complete top-level object. Objects may be
+ * separated by white space, or be elements of a top-level array which is
+ * unwrapped. Like jsmn, only double quotes delimit strings and unquoted
+ * primitives may contain quotes and brackets.
+ *
+ * On success "obj" points to the first byte of the object and "objlen" is set
+ * to its length. "obj" is valid until the next call to jsonstream_feed.
+ *
+ * Return 1 if an object is found, 0 if more bytes are needed (the equivalent of
+ * JSMN_ERROR_PART) or -1 if the stream contains something else than an object
+ * or array. After an error the rest of the current line is discarded.
+ */
+int
+jsonstream_next(struct jsonstream *js, const char **obj, size_t *objlen)
+{
+	char c;
+
+	for (; js->pos < js->buflen; js->pos++) {
+		c = js->buf[js->pos];
+
+		if (js->skip) {
+			if (c == '\n')
+				js->skip = 0;
+			js->start = js->pos + 1;
+			continue;
+		}
+
+		if (js->depth == 0) {
+			js->start = js->pos + 1;
+
+			switch (c) {
+			case ' ': case '\t': case '\r': case '\n':
+				continue;
+			case '[':
+				if (js->inarr)
+					break;
+				js->inarr = 1;
+				continue;
+			case ',':
+				if (!js->inarr)
+					break;
+				continue;
+			case ']':
+				if (!js->inarr)
+					break;
+				js->inarr = 0;
+				continue;
+			case '{':
+				js->start = js->pos;
+				js->depth = 1;
+				continue;
+			}
+
+			js->inarr = 0;
+			js->skip = 1;
+			js->pos++;
+			if (c == '\n')
+				js->skip = 0;
+			return -1;
+		}
+
+		if (js->instr) {
+			if (js->esc)
+				js->esc = 0;
+			else if (c == '\\')
+				js->esc = 1;
+			else if (c == '"')
+				js->instr = 0;
+			continue;
+		}
+
+		/* like jsmn, a primitive may contain quotes and brackets */
+		if (js->inprim) {
+			switch (c) {
+			case ' ': case '\t': case '\r': case '\n':
+			case ',': case ':': case ']': case '}':
+				js->inprim = 0;
+				break;
+			default:
+				continue;
+			}
+		}
+
+		switch (c) {
+		case ' ': case '\t': case '\r': case '\n':
+		case ',': case ':':
+			break;
+		case '"':
+			js->instr = 1;
+			break;
+		case '{': case '[':
+			js->depth++;
+			break;
+		case '}': case ']':
+			js->depth--;
+			if (js->depth > 0)
+				break;
+
+			*obj = js->buf + js->start;
+			*objlen = js->pos + 1 - js->start;
+			js->pos++;
+			js->start = js->pos;
+			return 1;
+		default:
+			js->inprim = 1;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Return 1 if the stream is inside an object or top-level array, 0 otherwise.
+ */
+int
+jsonstream_pending(const struct jsonstream *js)
+{
+	return js->depth > 0 || js->inarr;
+}
+
+void
+jsonstream_free(struct jsonstream *js)
+{
+	free(js->buf);
+	jsonstream_init(js);
 }
@@ -19,9 +19,41 @@
 
 #include <sys/types.h>
 
+/*
+ * Incremental splitter for a stream of relaxed JSON objects, optionally
+ * wrapped in a top-level array. See jsonstream_next().
+ */
+struct jsonstream {
+	char *buf;	/* unconsumed input */
+	size_t bufsize;	/* allocated size of buf */
+	size_t buflen;	/* number of bytes in buf */
+	size_t start;	/* start of the current object in buf */
+	size_t pos;	/* next byte in buf to scan */
+	int depth;	/* nesting level inside the current object */
+	int instr;	/* inside a double quoted string */
+	int esc;	/* previous byte was a backslash inside a string */
+	int inprim;	/* inside an unquoted primitive */
+	int inarr;	/* inside a top-level array */
+	int skip;	/* discard input up to the next newline */
+};
+
 int human_readable(char *dst, size_t dstsize, const char *src, size_t srcsize);
+int human_readable_alloc(char **dst, size_t *dstsize, const char *src,
+    size_t srcsize);
 
 int relaxed_to_strict(char *dst, size_t dstsize, const char *src,
     size_t srcsize, int maxobjects);
+int relaxed_to_strict_alloc(char **dst, size_t *dstsize, const char *src,
+    size_t srcsize, int maxobjects);
+
+int query_shape_alloc(char **dst, size_t *dstsize, const char *src,
+    size_t srcsize);
+void jsonify_free(void);
+
+void jsonstream_init(struct jsonstream *js);
+int jsonstream_feed(struct jsonstream *js, const char *src, size_t srclen);
+int jsonstream_next(struct jsonstream *js, const char **obj, size_t *objlen);
+int jsonstream_pending(const struct jsonstream *js);
+void jsonstream_free(struct jsonstream *js);
 
 #endif
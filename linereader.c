@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) 2026 Tim Kuijsten
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "linereader.h"
+
+#define LRBLOCK (64 * 1024)	/* minimum number of bytes to read at once */
+
+void
+linereader_init(struct linereader *lr, int fd)
+{
+	memset(lr, 0, sizeof(*lr));
+	lr->fd = fd;
+}
+
+/*
+ * Move the unread data to the start of the buffer and make sure there is room
+ * for at least LRBLOCK more bytes and a terminating null.
+ *
+ * Return 0 on success, -1 on failure with errno set.
+ */
+static int
+makeroom(struct linereader *lr)
+{
+	char *buf;
+	size_t size;
+
+	if (lr->start > 0) {
+		memmove(lr->buf, lr->buf + lr->start, lr->end - lr->start);
+		lr->end -= lr->start;
+		lr->scanned -= lr->start;
+		lr->start = 0;
+	}
+
+	if (lr->size - lr->end > LRBLOCK)
+		return 0;
+
+	size = lr->size > 0 ? lr->size * 2 : 2 * LRBLOCK;
+	if ((buf = realloc(lr->buf, size)) == NULL)
+		return -1;
+
+	lr->buf = buf;
+	lr->size = size;
+
+	return 0;
+}
+
+/*
+ * Set *line to the next line without the trailing newline. The line is null
+ * terminated and may be modified by the caller, but it is only valid until the
+ * next call. A last line without a newline is returned as well.
+ *
+ * Return the length of the line, -1 at the end of the input or -2 on a read
+ * error with errno set.
+ */
+ssize_t
+linereader_next(struct linereader *lr, char **line)
+{
+	char *nl;
+	ssize_t n;
+	size_t len;
+
+	for (;;) {
+		nl = NULL;
+		if (lr->scanned < lr->end)
+			nl = memchr(lr->buf + lr->scanned, '\n',
+			    lr->end - lr->scanned);
+		if (nl != NULL || (lr->eof && lr->start < lr->end)) {
+			/* a last line without newline, makeroom kept a byte */
+			if (nl == NULL)
+				nl = lr->buf + lr->end;
+			*nl = '\0';
+
+			*line = lr->buf + lr->start;
+			len = nl - *line;
+
+			lr->start = lr->scanned = nl - lr->buf + 1;
+			if (lr->start > lr->end)
+				lr->start = lr->scanned = lr->end;
+
+			return len;
+		}
+
+		if (lr->eof)
+			return -1;
+
+		lr->scanned = lr->end;
+
+		if (makeroom(lr) == -1)
+			return -2;
+
+		n = read(lr->fd, lr->buf + lr->end, lr->size - lr->end - 1);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			return -2;
+
+		if (n == 0)
+			lr->eof = 1;
+
+		lr->end += n;
+	}
+}
+
+/*
+ * Return whether linereader_next can return without reading more input.
+ */
+int
+linereader_ready(const struct linereader *lr)
+{
+	if (lr->eof)
+		return 1;
+
+	return lr->scanned < lr->end &&
+	    memchr(lr->buf + lr->scanned, '\n', lr->end - lr->scanned) != NULL;
+}
+
+/*
+ * Release the buffer. The reader can be reused after linereader_init.
+ */
+void
+linereader_free(struct linereader *lr)
+{
+	free(lr->buf);
+	lr->buf = NULL;
+	lr->size = 0;
+}
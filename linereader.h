@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2026 Tim Kuijsten
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LINEREADER_H
+#define LINEREADER_H
+
+#include <sys/types.h>
+
+/*
+ * Reads lines from a file descriptor in large blocks and splits them in place,
+ * so that a line costs a memchr(3) instead of a read(2) or a copy.
+ */
+struct linereader {
+	int fd;
+	char *buf;
+	size_t size;		/* allocated */
+	size_t start;		/* start of the next line */
+	size_t scanned;		/* no newline before this offset */
+	size_t end;		/* end of the data read so far */
+	int eof;
+};
+
+void linereader_init(struct linereader *lr, int fd);
+ssize_t linereader_next(struct linereader *lr, char **line);
+int linereader_ready(const struct linereader *lr);
+void linereader_free(struct linereader *lr);
+
+#endif
@@ -0,0 +1,1785 @@
+/*
+ * Minimal stand-in for mongod that speaks enough of the wire protocol to run
+ * mongovi end-to-end without a database server.
+ *
+ * Every namespace holds a number of synthetic documents that are generated on
+ * the fly, followed by any documents that are inserted. Query filters and
+ * pipelines are ignored and match every document, with the exception of a
+ * $group stage which returns the number of documents like count. Writes are
+ * acknowledged: inserts are kept in memory, deletes empty the collection and
+ * updates only report the number of matched documents.
+ *
+ * Handshakes are answered both as OP_QUERY and as OP_MSG, all other commands
+ * as OP_MSG.
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OP_REPLY	1
+#define OP_QUERY	2004
+#define OP_MSG		2013
+
+#define MSG_CHECKSUM	(1 << 0)
+#define MSG_MORETOCOME	(1 << 1)
+
+#define MAXMSGSIZE	48000000	/* maxMessageSizeBytes */
+#define MAXBSONSIZE	(16 * 1024 * 1024)	/* maxBsonObjectSize */
+#define MAXBATCHBYTES	(16 * 1024 * 1024)	/* cap on each batch */
+#define FIRSTBATCH	101	/* default number of documents in a first batch */
+#define MAXSEQ		4	/* document sequences per OP_MSG */
+#define MAXNAME		128
+
+#define BSON_DOUBLE	0x01
+#define BSON_STRING	0x02
+#define BSON_DOC	0x03
+#define BSON_ARRAY	0x04
+#define BSON_BINARY	0x05
+#define BSON_UNDEF	0x06
+#define BSON_OID	0x07
+#define BSON_BOOL	0x08
+#define BSON_DATE	0x09
+#define BSON_NULL	0x0a
+#define BSON_REGEX	0x0b
+#define BSON_DBPTR	0x0c
+#define BSON_CODE	0x0d
+#define BSON_SYMBOL	0x0e
+#define BSON_CODEWS	0x0f
+#define BSON_INT32	0x10
+#define BSON_TS		0x11
+#define BSON_INT64	0x12
+#define BSON_DEC128	0x13
+#define BSON_MAXKEY	0x7f
+#define BSON_MINKEY	0xff
+
+/* growable output buffer */
+struct buf {
+	uint8_t *p;
+	size_t len;
+	size_t size;
+};
+
+/* one element of a BSON document */
+struct elem {
+	const char *key;
+	int type;
+	const uint8_t *val;
+	size_t vlen;
+};
+
+/* document sequence of an OP_MSG, kind 1 section */
+struct seq {
+	const char *id;
+	const uint8_t *docs;
+	size_t len;
+};
+
+/* decoded command */
+struct msg {
+	const uint8_t *body;
+	struct seq seq[MAXSEQ];
+	int nseq;
+	const char *cmd;	/* name of the command, the first key */
+	char db[MAXNAME];
+	char coll[MAXNAME];	/* value of the first key if it is a string */
+};
+
+struct coll {
+	char db[MAXNAME];
+	char name[MAXNAME];
+	int64_t nsynth;		/* number of synthetic documents */
+	struct buf docs;	/* inserted documents */
+	size_t *offs;		/* offset of each inserted document in docs */
+	size_t noffs;
+	size_t offssize;
+};
+
+struct cursor {
+	int64_t id;
+	char db[MAXNAME];
+	char coll[MAXNAME];
+	int64_t pos;
+	int64_t end;
+	int agg;		/* single document $group result */
+};
+
+enum gen { GEN_SMALL, GEN_MIXED, GEN_WIDE };
+
+static const char *genname[] = { "small", "mixed", "wide" };
+
+/* options */
+static long latency;	/* microseconds added to every reply */
+static long batchsize;	/* documents per batch, 0 means server default */
+static long docsize;	/* minimum size of generated documents */
+static enum gen gen = GEN_MIXED;
+static int verbose;
+
+static pthread_mutex_t storelock = PTHREAD_MUTEX_INITIALIZER;
+static struct coll *colls;
+static size_t ncolls;
+static struct cursor *cursors;
+static size_t ncursors;
+static int64_t nextcursor = 1;
+static int nextconn = 1;
+
+/* per command statistics, reported on exit */
+static const char *statnames[] = {
+	"hello", "find", "getMore", "insert", "update", "delete", "aggregate",
+	"count", "listDatabases", "listCollections", "other"
+};
+static unsigned long stats[sizeof(statnames) / sizeof(statnames[0])];
+static unsigned long long statdocs;
+
+static volatile sig_atomic_t stop;
+
+static void
+bufgrow(struct buf *b, size_t n)
+{
+	size_t need;
+
+	if (b->len + n <= b->size)
+		return;
+
+	need = b->size ? b->size : 1024;
+	while (need < b->len + n)
+		need *= 2;
+
+	if ((b->p = realloc(b->p, need)) == NULL)
+		err(1, "realloc");
+	b->size = need;
+}
+
+static void
+bufadd(struct buf *b, const void *src, size_t n)
+{
+	bufgrow(b, n);
+	memcpy(b->p + b->len, src, n);
+	b->len += n;
+}
+
+static void
+put32(uint8_t *dst, uint32_t v)
+{
+	dst[0] = v;
+	dst[1] = v >> 8;
+	dst[2] = v >> 16;
+	dst[3] = v >> 24;
+}
+
+static uint32_t
+get32(const uint8_t *src)
+{
+	return (uint32_t)src[0] | (uint32_t)src[1] << 8 |
+	    (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static uint64_t
+get64(const uint8_t *src)
+{
+	return (uint64_t)get32(src) | (uint64_t)get32(src + 4) << 32;
+}
+
+static void
+add32(struct buf *b, uint32_t v)
+{
+	bufgrow(b, 4);
+	put32(b->p + b->len, v);
+	b->len += 4;
+}
+
+static void
+add64(struct buf *b, uint64_t v)
+{
+	add32(b, v);
+	add32(b, v >> 32);
+}
+
+/*
+ * Start a document, return the offset to pass to docend.
+ */
+static size_t
+docbegin(struct buf *b)
+{
+	size_t off;
+
+	off = b->len;
+	add32(b, 0);
+	return off;
+}
+
+static void
+docend(struct buf *b, size_t off)
+{
+	bufadd(b, "", 1);
+	put32(b->p + off, b->len - off);
+}
+
+static void
+addkey(struct buf *b, int type, const char *key)
+{
+	uint8_t t;
+
+	t = type;
+	bufadd(b, &t, 1);
+	bufadd(b, key, strlen(key) + 1);
+}
+
+/*
+ * Start a sub-document or array, return the offset to pass to docend.
+ */
+static size_t
+addsub(struct buf *b, int type, const char *key)
+{
+	addkey(b, type, key);
+	return docbegin(b);
+}
+
+static void
+addint32(struct buf *b, const char *key, int32_t v)
+{
+	addkey(b, BSON_INT32, key);
+	add32(b, v);
+}
+
+static void
+addint64(struct buf *b, const char *key, int64_t v)
+{
+	addkey(b, BSON_INT64, key);
+	add64(b, v);
+}
+
+static void
+adddouble(struct buf *b, const char *key, double v)
+{
+	uint64_t u;
+
+	memcpy(&u, &v, sizeof(u));
+	addkey(b, BSON_DOUBLE, key);
+	add64(b, u);
+}
+
+static void
+addbool(struct buf *b, const char *key, int v)
+{
+	uint8_t t;
+
+	t = !!v;
+	addkey(b, BSON_BOOL, key);
+	bufadd(b, &t, 1);
+}
+
+static void
+adddate(struct buf *b, const char *key, int64_t msec)
+{
+	addkey(b, BSON_DATE, key);
+	add64(b, msec);
+}
+
+static void
+addstrn(struct buf *b, const char *key, const char *s, size_t n)
+{
+	addkey(b, BSON_STRING, key);
+	add32(b, n + 1);
+	bufadd(b, s, n);
+	bufadd(b, "", 1);
+}
+
+static void
+addstr(struct buf *b, const char *key, const char *s)
+{
+	addstrn(b, key, s, strlen(s));
+}
+
+static void
+addoid(struct buf *b, const char *key, int64_t i)
+{
+	uint8_t oid[12] = { 0x5f, 0x00, 0x00, 0x00 };
+	int j;
+
+	/*
+	 * Fixed timestamp so documents are the same in every run, followed by
+	 * i in big endian so ids sort like the documents.
+	 */
+	for (j = 0; j < 8; j++)
+		oid[4 + j] = (uint64_t)i >> (56 - 8 * j);
+
+	addkey(b, BSON_OID, key);
+	bufadd(b, oid, sizeof(oid));
+}
+
+static int
+now_ms(int64_t *ms)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_REALTIME, &ts) == -1)
+		return -1;
+
+	*ms = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	return 0;
+}
+
+/*
+ * Read the next element of the document "doc" at *off. Return 1 if an element
+ * is read, 0 at the end of the document and -1 if the document is invalid.
+ */
+static int
+nextelem(const uint8_t *doc, size_t *off, struct elem *e)
+{
+	size_t doclen, n, klen;
+	const uint8_t *p;
+
+	doclen = get32(doc);
+	if (doclen < 5 || *off >= doclen)
+		return -1;
+
+	if (*off == 0)
+		*off = 4;
+
+	if (doc[*off] == 0)
+		return 0;
+
+	e->type = doc[*off];
+	e->key = (const char *)doc + *off + 1;
+	klen = strnlen(e->key, doclen - *off - 1);
+	if (*off + 1 + klen >= doclen)
+		return -1;
+
+	p = doc + *off + 1 + klen + 1;
+	n = doclen - (p - doc);
+
+	switch (e->type) {
+	case BSON_DOUBLE: case BSON_DATE: case BSON_TS: case BSON_INT64:
+		e->vlen = 8;
+		break;
+	case BSON_STRING: case BSON_CODE: case BSON_SYMBOL:
+		if (n < 4)
+			return -1;
+		e->vlen = 4 + get32(p);
+		break;
+	case BSON_DOC: case BSON_ARRAY: case BSON_CODEWS:
+		if (n < 4)
+			return -1;
+		e->vlen = get32(p);
+		break;
+	case BSON_BINARY:
+		if (n < 4)
+			return -1;
+		e->vlen = 5 + get32(p);
+		break;
+	case BSON_UNDEF: case BSON_NULL: case BSON_MAXKEY: case BSON_MINKEY:
+		e->vlen = 0;
+		break;
+	case BSON_OID:
+		e->vlen = 12;
+		break;
+	case BSON_BOOL:
+		e->vlen = 1;
+		break;
+	case BSON_REGEX:
+		e->vlen = strnlen((const char *)p, n) + 1;
+		if (e->vlen < n)
+			e->vlen += strnlen((const char *)p + e->vlen,
+			    n - e->vlen) + 1;
+		break;
+	case BSON_DBPTR:
+		if (n < 4)
+			return -1;
+		e->vlen = 4 + get32(p) + 12;
+		break;
+	case BSON_INT32:
+		e->vlen = 4;
+		break;
+	case BSON_DEC128:
+		e->vlen = 16;
+		break;
+	default:
+		return -1;
+	}
+
+	if (e->vlen > n)
+		return -1;
+
+	e->val = p;
+	*off = p - doc + e->vlen;
+
+	return 1;
+}
+
+/*
+ * Find "key" in "doc". Return 1 if found, 0 if not.
+ */
+static int
+findelem(const uint8_t *doc, const char *key, struct elem *e)
+{
+	size_t off;
+
+	off = 0;
+	while (nextelem(doc, &off, e) == 1)
+		if (strcmp(e->key, key) == 0)
+			return 1;
+
+	return 0;
+}
+
+static int64_t
+elemint(const struct elem *e)
+{
+	double d;
+	uint64_t u;
+
+	switch (e->type) {
+	case BSON_INT32:
+		return (int32_t)get32(e->val);
+	case BSON_INT64:
+		return (int64_t)get64(e->val);
+	case BSON_DOUBLE:
+		u = get64(e->val);
+		memcpy(&d, &u, sizeof(d));
+		return d;
+	case BSON_BOOL:
+		return e->val[0];
+	}
+
+	return 0;
+}
+
+/*
+ * Return the value of the numeric or boolean field "key" in "doc" or "def" if
+ * it does not exist.
+ */
+static int64_t
+getint(const uint8_t *doc, const char *key, int64_t def)
+{
+	struct elem e;
+
+	if (doc == NULL || !findelem(doc, key, &e))
+		return def;
+
+	return elemint(&e);
+}
+
+/*
+ * Return the sub-document or array "key" in "doc" or NULL.
+ */
+static const uint8_t *
+getdoc(const uint8_t *doc, const char *key)
+{
+	struct elem e;
+
+	if (doc == NULL || !findelem(doc, key, &e))
+		return NULL;
+
+	if (e.type != BSON_DOC && e.type != BSON_ARRAY)
+		return NULL;
+
+	return e.val;
+}
+
+/*
+ * Call "cb" for each document in array "key" of the command body, or in the
+ * document sequence with identifier "key". Return the number of documents.
+ */
+static int64_t
+eachdoc(const struct msg *m, const char *key,
+    void (*cb)(const uint8_t *, void *), void *arg)
+{
+	const uint8_t *arr, *p;
+	struct elem e;
+	size_t off;
+	int64_t n;
+	int i;
+
+	n = 0;
+	if ((arr = getdoc(m->body, key)) != NULL) {
+		off = 0;
+		while (nextelem(arr, &off, &e) == 1) {
+			if (e.type != BSON_DOC)
+				continue;
+			if (cb)
+				cb(e.val, arg);
+			n++;
+		}
+	}
+
+	for (i = 0; i < m->nseq; i++) {
+		if (strcmp(m->seq[i].id, key) != 0)
+			continue;
+
+		for (p = m->seq[i].docs; p + 5 <= m->seq[i].docs +
+		    m->seq[i].len && get32(p) >= 5; p += get32(p)) {
+			if (cb)
+				cb(p, arg);
+			n++;
+		}
+	}
+
+	return n;
+}
+
+/*
+ * Generate synthetic document number "i" of a collection.
+ */
+static void
+gendoc(struct buf *b, const struct coll *c, int64_t i)
+{
+	static const char *cities[] = {
+		"Amsterdam", "Berlin", "Cairo", "Delhi", "Lima", "Oslo", "Seoul"
+	};
+	static const char *words[] = {
+		"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf"
+	};
+	char key[16], str[MAXNAME + 32];
+	size_t off, sub, start, pad;
+	int j;
+
+	start = b->len;
+	off = docbegin(b);
+
+	addoid(b, "_id", i);
+	addint64(b, "i", i);
+	snprintf(str, sizeof(str), "%s %lld", c->name, (long long)i);
+	addstr(b, "name", str);
+
+	switch (gen) {
+	case GEN_SMALL:
+		break;
+	case GEN_MIXED:
+		adddouble(b, "score", (i * 7919 % 10007) / 100.0);
+		addbool(b, "active", i % 3 != 0);
+		adddate(b, "created", 1600000000000LL + i * 60000);
+		sub = addsub(b, BSON_ARRAY, "tags");
+		for (j = 0; j < 3; j++) {
+			snprintf(key, sizeof(key), "%d", j);
+			addstr(b, key, words[(i + j) % 7]);
+		}
+		docend(b, sub);
+		sub = addsub(b, BSON_DOC, "address");
+		snprintf(str, sizeof(str), "%lld Main Street", (long long)i);
+		addstr(b, "street", str);
+		addstr(b, "city", cities[i % 7]);
+		addint32(b, "zip", 10000 + i % 90000);
+		docend(b, sub);
+		break;
+	case GEN_WIDE:
+		for (j = 0; j < 50; j++) {
+			snprintf(key, sizeof(key), "f%d", j);
+			if (j % 2)
+				addint32(b, key, i * j);
+			else
+				addstr(b, key, words[(i + j) % 7]);
+		}
+		break;
+	}
+
+	/* pad up to docsize, taking the key and overhead into account */
+	if ((size_t)docsize > b->len - start + 11) {
+		pad = docsize - (b->len - start) - 11;
+		addkey(b, BSON_STRING, "pad");
+		add32(b, pad + 1);
+		bufgrow(b, pad + 1);
+		memset(b->p + b->len, 'x', pad);
+		b->len += pad;
+		bufadd(b, "", 1);
+	}
+
+	docend(b, off);
+}
+
+/*
+ * Return the collection "db"."name", create it if "create" is set. Must be
+ * called with storelock held.
+ */
+static struct coll *
+getcoll(const char *db, const char *name, int create)
+{
+	struct coll *c;
+	size_t i;
+
+	for (i = 0; i < ncolls; i++)
+		if (strcmp(colls[i].db, db) == 0 &&
+		    strcmp(colls[i].name, name) == 0)
+			return &colls[i];
+
+	if (!create)
+		return NULL;
+
+	if ((c = realloc(colls, (ncolls + 1) * sizeof(*colls))) == NULL)
+		err(1, "realloc");
+	colls = c;
+
+	c = &colls[ncolls++];
+	memset(c, 0, sizeof(*c));
+	snprintf(c->db, sizeof(c->db), "%s", db);
+	snprintf(c->name, sizeof(c->name), "%s", name);
+
+	return c;
+}
+
+/*
+ * Remove all collections in "db" if "name" is NULL or only "name" otherwise.
+ * Return the number of dropped collections. Must be called with storelock
+ * held.
+ */
+static int
+dropcoll(const char *db, const char *name)
+{
+	size_t i;
+	int n;
+
+	n = 0;
+	for (i = 0; i < ncolls; ) {
+		if (strcmp(colls[i].db, db) != 0 ||
+		    (name && strcmp(colls[i].name, name) != 0)) {
+			i++;
+			continue;
+		}
+
+		free(colls[i].docs.p);
+		free(colls[i].offs);
+		colls[i] = colls[--ncolls];
+		n++;
+	}
+
+	return n;
+}
+
+static int64_t
+ndocs(const struct coll *c)
+{
+	return c->nsynth + c->noffs;
+}
+
+/*
+ * Append document "i" of collection "c" to b. Must be called with storelock
+ * held.
+ */
+static void
+adddoc(struct buf *b, const struct coll *c, int64_t i)
+{
+	const uint8_t *doc;
+
+	if (i < c->nsynth) {
+		gendoc(b, c, i);
+		return;
+	}
+
+	doc = c->docs.p + c->offs[i - c->nsynth];
+	bufadd(b, doc, get32(doc));
+}
+
+static void
+insertdoc(const uint8_t *doc, void *arg)
+{
+	struct coll *c = arg;
+
+	if (c->noffs == c->offssize) {
+		c->offssize = c->offssize ? c->offssize * 2 : 64;
+		c->offs = realloc(c->offs, c->offssize * sizeof(*c->offs));
+		if (c->offs == NULL)
+			err(1, "realloc");
+	}
+
+	c->offs[c->noffs++] = c->docs.len;
+	bufadd(&c->docs, doc, get32(doc));
+}
+
+static void
+addstat(int i, int64_t docs)
+{
+	pthread_mutex_lock(&storelock);
+	stats[i]++;
+	statdocs += docs;
+	pthread_mutex_unlock(&storelock);
+}
+
+static void
+replyok(struct buf *r)
+{
+	adddouble(r, "ok", 1.0);
+}
+
+static void
+replyerr(struct buf *r, int code, const char *codename, const char *errmsg)
+{
+	adddouble(r, "ok", 0.0);
+	addstr(r, "errmsg", errmsg);
+	addint32(r, "code", code);
+	addstr(r, "codeName", codename);
+}
+
+static void
+hello(struct buf *r, int conn)
+{
+	int64_t ms;
+
+	if (now_ms(&ms) == -1)
+		err(1, "clock_gettime");
+
+	addbool(r, "helloOk", 1);
+	addbool(r, "ismaster", 1);
+	addbool(r, "isWritablePrimary", 1);
+	addint32(r, "maxBsonObjectSize", MAXBSONSIZE);
+	addint32(r, "maxMessageSizeBytes", MAXMSGSIZE);
+	addint32(r, "maxWriteBatchSize", 100000);
+	adddate(r, "localTime", ms);
+	addint32(r, "logicalSessionTimeoutMinutes", 30);
+	addint32(r, "connectionId", conn);
+	addint32(r, "minWireVersion", 0);
+	addint32(r, "maxWireVersion", 17);
+	addbool(r, "readOnly", 0);
+	replyok(r);
+}
+
+/*
+ * Write one batch of cursor "cur" as "key" into r and advance the cursor.
+ * Must be called with storelock held.
+ */
+static void
+addbatch(struct buf *r, const char *key, struct cursor *cur, int64_t n)
+{
+	struct coll *c;
+	char idx[24];
+	size_t off, sub, start;
+	int64_t i;
+
+	off = addsub(r, BSON_ARRAY, key);
+	start = r->len;
+
+	c = getcoll(cur->db, cur->coll, 0);
+
+	if (cur->agg) {
+		if (cur->pos < cur->end) {
+			sub = addsub(r, BSON_DOC, "0");
+			addint32(r, "_id", 1);
+			addint64(r, "n", c ? ndocs(c) : 0);
+			docend(r, sub);
+			cur->pos = cur->end;
+		}
+		docend(r, off);
+		return;
+	}
+
+	if (c == NULL || cur->end > ndocs(c))
+		cur->end = c ? ndocs(c) : 0;
+
+	for (i = 0; cur->pos < cur->end && (n <= 0 || i < n); i++) {
+		if (r->len - start >= MAXBATCHBYTES)
+			break;
+		snprintf(idx, sizeof(idx), "%lld", (long long)i);
+		addkey(r, BSON_DOC, idx);
+		adddoc(r, c, cur->pos++);
+	}
+
+	statdocs += i;
+
+	docend(r, off);
+}
+
+/*
+ * Write a cursor reply for cursor "cur" and register it if it is not
+ * exhausted.
+ */
+static void
+replycursor(struct buf *r, struct cursor *cur, const char *key, int64_t n)
+{
+	struct cursor *cs;
+	char ns[2 * MAXNAME + 1];
+	size_t sub;
+	int64_t id;
+	size_t i;
+
+	pthread_mutex_lock(&storelock);
+
+	sub = addsub(r, BSON_DOC, "cursor");
+	addbatch(r, key, cur, n);
+
+	id = 0;
+	if (cur->pos < cur->end) {
+		if (cur->id == 0) {
+			if ((cs = realloc(cursors, (ncursors + 1) *
+			    sizeof(*cursors))) == NULL)
+				err(1, "realloc");
+			cursors = cs;
+			cur->id = nextcursor++;
+			cursors[ncursors++] = *cur;
+		} else {
+			for (i = 0; i < ncursors; i++)
+				if (cursors[i].id == cur->id)
+					cursors[i] = *cur;
+		}
+		id = cur->id;
+	} else if (cur->id != 0) {
+		for (i = 0; i < ncursors; i++)
+			if (cursors[i].id == cur->id)
+				cursors[i] = cursors[--ncursors];
+	}
+
+	pthread_mutex_unlock(&storelock);
+
+	addint64(r, "id", id);
+	snprintf(ns, sizeof(ns), "%s.%s", cur->db, cur->coll);
+	addstr(r, "ns", ns);
+	docend(r, sub);
+	replyok(r);
+}
+
+/*
+ * Open a cursor on the collection of the command.
+ */
+static void
+opencursor(const struct msg *m, struct cursor *cur, int64_t skip,
+    int64_t limit)
+{
+	struct coll *c;
+	int64_t n;
+
+	memset(cur, 0, sizeof(*cur));
+	snprintf(cur->db, sizeof(cur->db), "%s", m->db);
+	snprintf(cur->coll, sizeof(cur->coll), "%s", m->coll);
+
+	pthread_mutex_lock(&storelock);
+	c = getcoll(m->db, m->coll, 0);
+	n = c ? ndocs(c) : 0;
+	pthread_mutex_unlock(&storelock);
+
+	cur->pos = skip < n ? skip : n;
+	cur->end = n;
+	if (limit > 0 && cur->pos + limit < n)
+		cur->end = cur->pos + limit;
+}
+
+/*
+ * Return the size of the first batch.
+ */
+static int64_t
+firstbatch(const uint8_t *opts)
+{
+	return getint(opts, "batchSize", batchsize ? batchsize : FIRSTBATCH);
+}
+
+static void
+cmd_find(const struct msg *m, struct buf *r)
+{
+	struct cursor cur;
+	int64_t limit, n;
+
+	limit = getint(m->body, "limit", 0);
+	if (limit < 0)
+		limit = -limit;
+
+	opencursor(m, &cur, getint(m->body, "skip", 0), limit);
+
+	n = firstbatch(m->body);
+	if (getint(m->body, "singleBatch", 0) && cur.pos + n < cur.end)
+		cur.end = cur.pos + n;
+
+	replycursor(r, &cur, "firstBatch", n);
+}
+
+static void
+cmd_aggregate(const struct msg *m, struct buf *r)
+{
+	const uint8_t *pipeline;
+	struct cursor cur;
+	struct elem e;
+	size_t off;
+
+	opencursor(m, &cur, 0, 0);
+
+	/* count_documents uses a $group stage */
+	if ((pipeline = getdoc(m->body, "pipeline")) != NULL) {
+		off = 0;
+		while (nextelem(pipeline, &off, &e) == 1)
+			if (e.type == BSON_DOC && getdoc(e.val, "$group")) {
+				cur.agg = 1;
+				cur.pos = 0;
+				cur.end = 1;
+			}
+	}
+
+	replycursor(r, &cur, "firstBatch", firstbatch(getdoc(m->body,
+	    "cursor")));
+}
+
+static void
+cmd_getmore(const struct msg *m, struct buf *r)
+{
+	struct cursor cur;
+	struct elem e;
+	size_t i;
+	int found;
+
+	if (!findelem(m->body, "getMore", &e)) {
+		replyerr(r, 2, "BadValue", "missing cursor id");
+		return;
+	}
+
+	found = 0;
+	pthread_mutex_lock(&storelock);
+	for (i = 0; i < ncursors; i++) {
+		if (cursors[i].id == elemint(&e)) {
+			cur = cursors[i];
+			found = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&storelock);
+
+	if (!found) {
+		replyerr(r, 43, "CursorNotFound", "cursor id not found");
+		return;
+	}
+
+	replycursor(r, &cur, "nextBatch", getint(m->body, "batchSize",
+	    batchsize));
+}
+
+static void
+cmd_killcursors(const struct msg *m, struct buf *r)
+{
+	const uint8_t *ids;
+	struct elem e;
+	size_t off, sub, i;
+	int64_t id;
+
+	sub = addsub(r, BSON_ARRAY, "cursorsKilled");
+	if ((ids = getdoc(m->body, "cursors")) != NULL) {
+		off = 0;
+		pthread_mutex_lock(&storelock);
+		while (nextelem(ids, &off, &e) == 1) {
+			id = elemint(&e);
+			for (i = 0; i < ncursors; i++)
+				if (cursors[i].id == id)
+					cursors[i] = cursors[--ncursors];
+			addint64(r, e.key, id);
+		}
+		pthread_mutex_unlock(&storelock);
+	}
+	docend(r, sub);
+	replyok(r);
+}
+
+static void
+cmd_insert(const struct msg *m, struct buf *r)
+{
+	struct coll *c;
+	int64_t n;
+
+	pthread_mutex_lock(&storelock);
+	c = getcoll(m->db, m->coll, 1);
+	n = eachdoc(m, "documents", insertdoc, c);
+	statdocs += n;
+	pthread_mutex_unlock(&storelock);
+
+	addint32(r, "n", n);
+	replyok(r);
+}
+
+static void
+countupdate(const uint8_t *doc, void *arg)
+{
+	int64_t *counts = arg;
+
+	/* counts[0] is the number of documents, counts[1] the result */
+	if (getint(doc, "multi", 0))
+		counts[1] += counts[0];
+	else if (counts[0] > 0)
+		counts[1]++;
+	else if (getint(doc, "upsert", 0))
+		counts[2]++;
+}
+
+static void
+cmd_update(const struct msg *m, struct buf *r)
+{
+	struct coll *c;
+	char idx[24];
+	int64_t counts[3];
+	size_t sub, doc;
+	int64_t i;
+
+	pthread_mutex_lock(&storelock);
+	c = getcoll(m->db, m->coll, 0);
+	counts[0] = c ? ndocs(c) : 0;
+	pthread_mutex_unlock(&storelock);
+
+	counts[1] = 0;
+	counts[2] = 0;
+	eachdoc(m, "updates", countupdate, counts);
+
+	addint32(r, "n", counts[1] + counts[2]);
+	addint32(r, "nModified", counts[1]);
+	if (counts[2] > 0) {
+		sub = addsub(r, BSON_ARRAY, "upserted");
+		for (i = 0; i < counts[2]; i++) {
+			snprintf(idx, sizeof(idx), "%lld", (long long)i);
+			doc = addsub(r, BSON_DOC, idx);
+			addint32(r, "index", i);
+			addoid(r, "_id", nextcursor + i);
+			docend(r, doc);
+		}
+		docend(r, sub);
+	}
+	replyok(r);
+}
+
+static void
+countdelete(const uint8_t *doc, void *arg)
+{
+	int64_t *counts = arg;
+
+	if (getint(doc, "limit", 0) == 1 && counts[0] > 0) {
+		counts[0]--;
+		counts[1]++;
+	} else {
+		counts[1] += counts[0];
+		counts[0] = 0;
+	}
+}
+
+static void
+cmd_delete(const struct msg *m, struct buf *r)
+{
+	struct coll *c;
+	int64_t counts[2];
+
+	pthread_mutex_lock(&storelock);
+	c = getcoll(m->db, m->coll, 0);
+	counts[0] = c ? ndocs(c) : 0;
+	counts[1] = 0;
+	eachdoc(m, "deletes", countdelete, counts);
+
+	/* every filter matches every document, so a delete empties it */
+	if (c && counts[0] == 0) {
+		c->nsynth = 0;
+		c->noffs = 0;
+		c->docs.len = 0;
+	}
+	pthread_mutex_unlock(&storelock);
+
+	addint32(r, "n", counts[1]);
+	replyok(r);
+}
+
+static void
+cmd_count(const struct msg *m, struct buf *r)
+{
+	struct coll *c;
+	int64_t n, skip, limit;
+
+	pthread_mutex_lock(&storelock);
+	c = getcoll(m->db, m->coll, 0);
+	n = c ? ndocs(c) : 0;
+	pthread_mutex_unlock(&storelock);
+
+	skip = getint(m->body, "skip", 0);
+	limit = getint(m->body, "limit", 0);
+	n = skip < n ? n - skip : 0;
+	if (limit > 0 && limit < n)
+		n = limit;
+
+	addint32(r, "n", n);
+	replyok(r);
+}
+
+static void
+cmd_listdatabases(const struct msg *m, struct buf *r)
+{
+	const char *db;
+	char idx[24];
+	size_t sub, doc, i, j, n;
+	int nameonly, seen;
+
+	nameonly = getint(m->body, "nameOnly", 0);
+
+	sub = addsub(r, BSON_ARRAY, "databases");
+	pthread_mutex_lock(&storelock);
+	for (i = 0, n = 0; i < ncolls; i++) {
+		db = colls[i].db;
+		for (j = 0, seen = 0; j < i && !seen; j++)
+			seen = strcmp(colls[j].db, db) == 0;
+		if (seen)
+			continue;
+
+		snprintf(idx, sizeof(idx), "%zu", n++);
+		doc = addsub(r, BSON_DOC, idx);
+		addstr(r, "name", db);
+		if (!nameonly) {
+			addint64(r, "sizeOnDisk", 4096);
+			addbool(r, "empty", 0);
+		}
+		docend(r, doc);
+	}
+	pthread_mutex_unlock(&storelock);
+	docend(r, sub);
+
+	if (!nameonly)
+		addint64(r, "totalSize", 4096 * n);
+	replyok(r);
+}
+
+static void
+cmd_listcollections(const struct msg *m, struct buf *r)
+{
+	char ns[2 * MAXNAME + 16], idx[24];
+	size_t sub, arr, doc, info, i, n;
+	int nameonly;
+
+	nameonly = getint(m->body, "nameOnly", 0);
+
+	sub = addsub(r, BSON_DOC, "cursor");
+	arr = addsub(r, BSON_ARRAY, "firstBatch");
+	pthread_mutex_lock(&storelock);
+	for (i = 0, n = 0; i < ncolls; i++) {
+		if (strcmp(colls[i].db, m->db) != 0)
+			continue;
+
+		snprintf(idx, sizeof(idx), "%zu", n++);
+		doc = addsub(r, BSON_DOC, idx);
+		addstr(r, "name", colls[i].name);
+		addstr(r, "type", "collection");
+		if (!nameonly) {
+			docend(r, addsub(r, BSON_DOC, "options"));
+			info = addsub(r, BSON_DOC, "info");
+			addbool(r, "readOnly", 0);
+			docend(r, info);
+		}
+		docend(r, doc);
+	}
+	pthread_mutex_unlock(&storelock);
+	docend(r, arr);
+	addint64(r, "id", 0);
+	snprintf(ns, sizeof(ns), "%s.$cmd.listCollections", m->db);
+	addstr(r, "ns", ns);
+	docend(r, sub);
+	replyok(r);
+}
+
+static void
+cmd_drop(const struct msg *m, struct buf *r)
+{
+	char ns[2 * MAXNAME + 1];
+	int n;
+
+	pthread_mutex_lock(&storelock);
+	n = dropcoll(m->db, m->coll);
+	pthread_mutex_unlock(&storelock);
+
+	if (n == 0) {
+		replyerr(r, 26, "NamespaceNotFound", "ns not found");
+		return;
+	}
+
+	snprintf(ns, sizeof(ns), "%s.%s", m->db, m->coll);
+	addstr(r, "ns", ns);
+	addint32(r, "nIndexesWas", 1);
+	replyok(r);
+}
+
+static void
+cmd_dropdatabase(const struct msg *m, struct buf *r)
+{
+	pthread_mutex_lock(&storelock);
+	dropcoll(m->db, NULL);
+	pthread_mutex_unlock(&storelock);
+
+	addstr(r, "dropped", m->db);
+	replyok(r);
+}
+
+static void
+cmd_buildinfo(const struct msg *m, struct buf *r)
+{
+	size_t sub;
+
+	(void)m;
+
+	addstr(r, "version", "6.0.0");
+	sub = addsub(r, BSON_ARRAY, "versionArray");
+	addint32(r, "0", 6);
+	addint32(r, "1", 0);
+	addint32(r, "2", 0);
+	addint32(r, "3", 0);
+	docend(r, sub);
+	replyok(r);
+}
+
+/*
+ * Every query is a collection scan that returns every document.
+ */
+static void
+cmd_explain(const struct msg *m, struct buf *r)
+{
+	const uint8_t *cmd;
+	char ns[2 * MAXNAME + 1];
+	struct coll *c;
+	struct elem e;
+	size_t sub, plan, off;
+	int64_t n;
+
+	off = 0;
+	if ((cmd = getdoc(m->body, "explain")) == NULL ||
+	    nextelem(cmd, &off, &e) != 1 || e.type != BSON_STRING) {
+		replyerr(r, 9, "FailedToParse", "explain needs a command");
+		return;
+	}
+
+	pthread_mutex_lock(&storelock);
+	c = getcoll(m->db, (const char *)e.val + 4, 0);
+	n = c ? ndocs(c) : 0;
+	pthread_mutex_unlock(&storelock);
+
+	snprintf(ns, sizeof(ns), "%s.%s", m->db, (const char *)e.val + 4);
+
+	sub = addsub(r, BSON_DOC, "queryPlanner");
+	addstr(r, "namespace", ns);
+	plan = addsub(r, BSON_DOC, "winningPlan");
+	addstr(r, "stage", "COLLSCAN");
+	addstr(r, "direction", "forward");
+	docend(r, plan);
+	docend(r, addsub(r, BSON_ARRAY, "rejectedPlans"));
+	docend(r, sub);
+
+	sub = addsub(r, BSON_DOC, "executionStats");
+	addbool(r, "executionSuccess", 1);
+	addint32(r, "nReturned", n);
+	addint32(r, "executionTimeMillis", 0);
+	addint32(r, "totalKeysExamined", 0);
+	addint32(r, "totalDocsExamined", n);
+	plan = addsub(r, BSON_DOC, "executionStages");
+	addstr(r, "stage", "COLLSCAN");
+	addint32(r, "nReturned", n);
+	addint32(r, "docsExamined", n);
+	docend(r, plan);
+	docend(r, sub);
+
+	replyok(r);
+}
+
+static void
+cmd_ok(const struct msg *m, struct buf *r)
+{
+	(void)m;
+
+	replyok(r);
+}
+
+static const struct {
+	const char *name;
+	void (*fn)(const struct msg *, struct buf *);
+	int stat;
+} cmds[] = {
+	{ "find",		cmd_find,		1 },
+	{ "getMore",		cmd_getmore,		2 },
+	{ "killCursors",	cmd_killcursors,	10 },
+	{ "insert",		cmd_insert,		3 },
+	{ "update",		cmd_update,		4 },
+	{ "delete",		cmd_delete,		5 },
+	{ "aggregate",		cmd_aggregate,		6 },
+	{ "count",		cmd_count,		7 },
+	{ "listDatabases",	cmd_listdatabases,	8 },
+	{ "listCollections",	cmd_listcollections,	9 },
+	{ "drop",		cmd_drop,		10 },
+	{ "dropDatabase",	cmd_dropdatabase,	10 },
+	{ "explain",		cmd_explain,		10 },
+	{ "buildInfo",		cmd_buildinfo,		10 },
+	{ "buildinfo",		cmd_buildinfo,		10 },
+	{ "ping",		cmd_ok,			10 },
+	{ "endSessions",	cmd_ok,			10 },
+	{ NULL,			NULL,			0 }
+};
+
+/*
+ * Run the command in "m" and write the reply document into "r".
+ */
+static void
+runcmd(const struct msg *m, struct buf *r, int conn)
+{
+	char errmsg[MAXNAME + 32];
+	size_t off;
+	int i;
+
+	off = docbegin(r);
+
+	if (strcmp(m->cmd, "hello") == 0 || strcasecmp(m->cmd, "isMaster") == 0) {
+		hello(r, conn);
+		addstat(0, 0);
+		docend(r, off);
+		return;
+	}
+
+	for (i = 0; cmds[i].name != NULL; i++) {
+		if (strcmp(m->cmd, cmds[i].name) == 0) {
+			cmds[i].fn(m, r);
+			addstat(cmds[i].stat, 0);
+			break;
+		}
+	}
+
+	if (cmds[i].name == NULL) {
+		snprintf(errmsg, sizeof(errmsg), "no such command: '%s'",
+		    m->cmd);
+		replyerr(r, 59, "CommandNotFound", errmsg);
+		addstat(10, 0);
+	}
+
+	docend(r, off);
+}
+
+/*
+ * Set the command name, database and collection of "m" from its body. Return
+ * 0 on success, -1 if the body is invalid.
+ */
+static int
+parsecmd(struct msg *m)
+{
+	struct elem e;
+	size_t off, n;
+
+	off = 0;
+	if (nextelem(m->body, &off, &e) != 1)
+		return -1;
+
+	m->cmd = e.key;
+	m->coll[0] = '\0';
+	if (e.type == BSON_STRING) {
+		n = get32(e.val) - 1;
+		if (n >= sizeof(m->coll))
+			n = sizeof(m->coll) - 1;
+		memcpy(m->coll, e.val + 4, n);
+		m->coll[n] = '\0';
+	}
+
+	if (m->db[0] == '\0') {
+		if (!findelem(m->body, "$db", &e) || e.type != BSON_STRING)
+			return -1;
+		snprintf(m->db, sizeof(m->db), "%s", (const char *)e.val + 4);
+	}
+
+	return 0;
+}
+
+/*
+ * Read exactly "n" bytes. Return 1 on success, 0 on EOF and -1 on error.
+ */
+static int
+readall(int fd, uint8_t *dst, size_t n)
+{
+	ssize_t r;
+
+	while (n > 0) {
+		if ((r = read(fd, dst, n)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (r == 0)
+			return 0;
+		dst += r;
+		n -= r;
+	}
+
+	return 1;
+}
+
+static int
+writeall(int fd, const uint8_t *src, size_t n)
+{
+	ssize_t r;
+
+	while (n > 0) {
+		if ((r = write(fd, src, n)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		src += r;
+		n -= r;
+	}
+
+	return 0;
+}
+
+/*
+ * Decode the OP_MSG in "p" of "len" bytes, excluding the header.
+ */
+static int
+parsemsg(struct msg *m, const uint8_t *p, size_t len, uint32_t *flags)
+{
+	const uint8_t *end;
+	size_t n;
+
+	memset(m, 0, sizeof(*m));
+
+	if (len < 5)
+		return -1;
+
+	*flags = get32(p);
+	end = p + len;
+	if (*flags & MSG_CHECKSUM)
+		end -= 4;
+	p += 4;
+
+	while (p < end) {
+		switch (*p++) {
+		case 0:
+			if (end - p < 5 || get32(p) > (size_t)(end - p))
+				return -1;
+			m->body = p;
+			p += get32(p);
+			break;
+		case 1:
+			if (end - p < 4 || get32(p) > (size_t)(end - p) ||
+			    m->nseq == MAXSEQ)
+				return -1;
+			n = get32(p);
+			m->seq[m->nseq].id = (const char *)p + 4;
+			m->seq[m->nseq].docs = p + 4 +
+			    strnlen((const char *)p + 4, n - 4) + 1;
+			m->seq[m->nseq].len = p + n - m->seq[m->nseq].docs;
+			if (m->seq[m->nseq].docs > p + n)
+				return -1;
+			m->nseq++;
+			p += n;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (m->body == NULL)
+		return -1;
+
+	return parsecmd(m);
+}
+
+/*
+ * Decode a legacy OP_QUERY on a "db.$cmd" namespace.
+ */
+static int
+parsequery(struct msg *m, const uint8_t *p, size_t len)
+{
+	const uint8_t *query, *inner;
+	const char *ns, *dot;
+	size_t nslen;
+
+	memset(m, 0, sizeof(*m));
+
+	if (len < 4 + 1 + 8 + 5)
+		return -1;
+
+	ns = (const char *)p + 4;
+	nslen = strnlen(ns, len - 4);
+	if (4 + nslen + 1 + 8 + 5 > len)
+		return -1;
+
+	if ((dot = memchr(ns, '.', nslen)) == NULL ||
+	    (size_t)(dot - ns) >= sizeof(m->db))
+		return -1;
+	memcpy(m->db, ns, dot - ns);
+	m->db[dot - ns] = '\0';
+
+	query = p + 4 + nslen + 1 + 8;
+	if (get32(query) > len - (query - p))
+		return -1;
+
+	if ((inner = getdoc(query, "$query")) != NULL)
+		query = inner;
+
+	m->body = query;
+
+	return parsecmd(m);
+}
+
+/*
+ * Wrap the reply document in "doc" in an OP_REPLY or OP_MSG and send it.
+ */
+static int
+sendreply(int fd, int op, uint32_t reqid, uint32_t respto,
+    const struct buf *doc)
+{
+	struct buf b;
+	int r;
+
+	memset(&b, 0, sizeof(b));
+	add32(&b, 0);
+	add32(&b, reqid);
+	add32(&b, respto);
+
+	if (op == OP_QUERY) {
+		add32(&b, OP_REPLY);
+		add32(&b, 0);		/* responseFlags */
+		add64(&b, 0);		/* cursorID */
+		add32(&b, 0);		/* startingFrom */
+		add32(&b, 1);		/* numberReturned */
+	} else {
+		add32(&b, OP_MSG);
+		add32(&b, 0);		/* flagBits */
+		bufadd(&b, "", 1);	/* kind 0 */
+	}
+
+	bufadd(&b, doc->p, doc->len);
+	put32(b.p, b.len);
+
+	r = writeall(fd, b.p, b.len);
+	free(b.p);
+
+	return r;
+}
+
+static void
+delay(void)
+{
+	struct timespec ts;
+
+	if (latency <= 0)
+		return;
+
+	ts.tv_sec = latency / 1000000;
+	ts.tv_nsec = latency % 1000000 * 1000;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		;
+}
+
+/*
+ * Serve one client connection until it is closed.
+ */
+static void *
+serve(void *arg)
+{
+	uint8_t hdr[16], *p;
+	struct buf reply;
+	struct msg m;
+	uint32_t len, reqid, flags;
+	int fd, op, conn, reqs;
+
+	fd = (int)(intptr_t)arg;
+
+	pthread_mutex_lock(&storelock);
+	conn = nextconn++;
+	pthread_mutex_unlock(&storelock);
+
+	memset(&reply, 0, sizeof(reply));
+	p = NULL;
+	reqid = 0;
+	reqs = 0;
+
+	while (readall(fd, hdr, sizeof(hdr)) == 1) {
+		len = get32(hdr);
+		op = get32(hdr + 12);
+		if (len < sizeof(hdr) || len > MAXMSGSIZE) {
+			warnx("connection %d: invalid message length %u", conn,
+			    len);
+			break;
+		}
+
+		if ((p = realloc(p, len - sizeof(hdr))) == NULL)
+			err(1, "realloc");
+		if (readall(fd, p, len - sizeof(hdr)) != 1)
+			break;
+
+		flags = 0;
+		if (op == OP_MSG) {
+			if (parsemsg(&m, p, len - sizeof(hdr), &flags) == -1) {
+				warnx("connection %d: invalid OP_MSG", conn);
+				break;
+			}
+		} else if (op == OP_QUERY) {
+			if (parsequery(&m, p, len - sizeof(hdr)) == -1) {
+				warnx("connection %d: invalid OP_QUERY", conn);
+				break;
+			}
+		} else {
+			warnx("connection %d: unsupported opcode %d", conn, op);
+			break;
+		}
+
+		if (verbose)
+			warnx("connection %d: %s %s.%s", conn, m.cmd, m.db,
+			    m.coll);
+
+		reply.len = 0;
+		runcmd(&m, &reply, conn);
+		reqs++;
+
+		if (flags & MSG_MORETOCOME)
+			continue;
+
+		delay();
+
+		if (sendreply(fd, op, ++reqid, get32(hdr + 4), &reply) == -1)
+			break;
+	}
+
+	if (verbose)
+		warnx("connection %d: closed after %d requests", conn, reqs);
+
+	free(reply.p);
+	free(p);
+	close(fd);
+
+	return NULL;
+}
+
+static void
+onsignal(int sig)
+{
+	(void)sig;
+
+	stop = 1;
+}
+
+static void
+printstats(void)
+{
+	size_t i;
+
+	fprintf(stderr, "{\"docs\":%llu", statdocs);
+	for (i = 0; i < sizeof(statnames) / sizeof(statnames[0]); i++)
+		fprintf(stderr, ",\"%s\":%lu", statnames[i], stats[i]);
+	fprintf(stderr, "}\n");
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: mockd [-v] [-b batchsize] [-c colls] "
+	    "[-d dbs] [-g small|mixed|wide] [-l usec] [-n docs] [-p port] "
+	    "[-s docsize]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sockaddr_in sin;
+	struct sigaction sa;
+	pthread_attr_t attr;
+	pthread_t thr;
+	char db[MAXNAME], name[MAXNAME];
+	long ndbs, ncoll, ndoc, port;
+	int c, s, fd, one, i, j;
+
+	ndbs = 2;
+	ncoll = 3;
+	ndoc = 1000;
+	port = 27018;
+
+	while ((c = getopt(argc, argv, "b:c:d:g:l:n:p:s:v")) != -1) {
+		switch (c) {
+		case 'b':
+			batchsize = strtol(optarg, NULL, 10);
+			break;
+		case 'c':
+			ncoll = strtol(optarg, NULL, 10);
+			break;
+		case 'd':
+			ndbs = strtol(optarg, NULL, 10);
+			break;
+		case 'g':
+			for (i = 0; i < 3; i++)
+				if (strcmp(optarg, genname[i]) == 0)
+					gen = i;
+			if (strcmp(optarg, genname[gen]) != 0)
+				usage();
+			break;
+		case 'l':
+			latency = strtol(optarg, NULL, 10);
+			break;
+		case 'n':
+			ndoc = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			port = strtol(optarg, NULL, 10);
+			break;
+		case 's':
+			docsize = strtol(optarg, NULL, 10);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (port <= 0 || port > 65535 || batchsize < 0 || latency < 0 ||
+	    ndbs < 0 || ncoll < 0 || ndoc < 0 || docsize < 0)
+		usage();
+
+	for (i = 0; i < ndbs; i++) {
+		for (j = 0; j < ncoll; j++) {
+			snprintf(db, sizeof(db), "db%d", i);
+			snprintf(name, sizeof(name), "coll%d", j);
+			getcoll(db, name, 1)->nsynth = ndoc;
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = onsignal;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGINT, &sa, NULL) == -1 ||
+	    sigaction(SIGTERM, &sa, NULL) == -1)
+		err(1, "sigaction");
+	signal(SIGPIPE, SIG_IGN);
+
+	if ((s = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+		err(1, "socket");
+
+	one = 1;
+	if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1)
+		err(1, "setsockopt");
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(s, (struct sockaddr *)&sin, sizeof(sin)) == -1)
+		err(1, "bind");
+	if (listen(s, 64) == -1)
+		err(1, "listen");
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	while (!stop) {
+		if ((fd = accept(s, NULL, NULL)) == -1) {
+			if (errno == EINTR)
+				continue;
+			err(1, "accept");
+		}
+
+		if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one,
+		    sizeof(one)) == -1)
+			warn("setsockopt");
+
+		if (pthread_create(&thr, &attr, serve, (void *)(intptr_t)fd))
+			errx(1, "pthread_create");
+	}
+
+	printstats();
+
+	return 0;
+}
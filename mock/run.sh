@@ -0,0 +1,139 @@
+#!/bin/sh
+#
+# Run mongovi end-to-end against mockd and print one JSON object per scenario
+# with the wall clock time of each run in milliseconds and the throughput in
+# documents per second, based on the median run.
+
+set -e
+
+usage() {
+	echo "usage: run.sh [-b mongovi] [-g gen] [-l usec] [-m mockd] [-n docs]" \
+	    "[-p port] [-r runs] [-s docsize] [scenario ...]" >&2
+	exit 1
+}
+
+mongovi=./mongovi
+mockd=./mockd
+docs=10000
+latency=0
+gen=mixed
+docsize=0
+port=27018
+runs=5
+
+while getopts b:g:l:m:n:p:r:s: opt; do
+	case $opt in
+	b) mongovi=$OPTARG ;;
+	g) gen=$OPTARG ;;
+	l) latency=$OPTARG ;;
+	m) mockd=$OPTARG ;;
+	n) docs=$OPTARG ;;
+	p) port=$OPTARG ;;
+	r) runs=$OPTARG ;;
+	s) docsize=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+scenarios=${*:-find count ls lsdb import insert}
+
+tmp=$(mktemp -d)
+trap 'kill $pid 2>/dev/null; rm -rf "$tmp"' EXIT INT TERM
+
+"$mockd" -p "$port" -n "$docs" -l "$latency" -g "$gen" -s "$docsize" \
+    2> "$tmp/mockd.log" &
+pid=$!
+
+# mongovi reads the connection string from $HOME/.mongovi
+HOME=$tmp
+export HOME
+echo "mongodb://127.0.0.1:$port/?serverSelectionTimeoutMS=2000" > \
+    "$tmp/.mongovi"
+chmod 600 "$tmp/.mongovi"
+
+i=0
+until echo ls | "$mongovi" / > /dev/null 2>&1; do
+	i=$((i + 1))
+	if [ $i -ge 50 ]; then
+		cat "$tmp/mockd.log" >&2
+		echo "run.sh: mockd did not start" >&2
+		exit 1
+	fi
+	sleep 0.1
+done
+
+# generate import input once, one relaxed JSON document per line
+awk -v n="$docs" 'BEGIN {
+	for (i = 0; i < n; i++)
+		printf "{ i: %d, name: \"doc %d\", tags: [\"a\", \"b\"] }\n", i, i
+}' > "$tmp/import.json"
+
+# the same documents as a script of insert commands
+sed 's/^/insert /' "$tmp/import.json" > "$tmp/insert.txt"
+
+# print the wall clock time of a shell command in milliseconds
+elapsed() {
+	perl -MTime::HiRes=time -e '$t = time; system(@ARGV) == 0 or
+	    die "failed: @ARGV\n"; printf "%.3f\n", (time - $t) * 1000' \
+	    -- sh -c "$1"
+}
+
+# run scenario "name" with command "cmd" that handles "n" documents
+measure() {
+	name=$1 n=$2 cmd=$3
+
+	: > "$tmp/times"
+	r=0
+	while [ $r -lt "$runs" ]; do
+		elapsed "$cmd" >> "$tmp/times"
+		r=$((r + 1))
+	done
+
+	sort -n "$tmp/times" | awk -v name="$name" -v n="$n" -v lat="$latency" '
+	{ t[NR] = $1 }
+	END {
+		med = t[int((NR + 1) / 2)]
+		rate = med > 0 ? n * 1000 / med : 0
+		printf "{\"bench\":\"%s\",\"docs\":%d," \
+		    "\"injected_latency_us\":%d,\"runs\":%d,\"ms_min\":%.3f," \
+		    "\"ms_median\":%.3f,\"ms_max\":%.3f,\"docs_s\":%.0f}\n",
+		    name, n, lat, NR, t[1], med, t[NR], rate
+	}'
+}
+
+for s in $scenarios; do
+	case $s in
+	find)
+		measure find "$docs" \
+		    "echo find | '$mongovi' -s /db0/coll0 > /dev/null"
+		;;
+	count)
+		measure count 1 "echo count | '$mongovi' /db0/coll0 > /dev/null"
+		;;
+	ls)
+		measure ls 1 "echo ls | '$mongovi' /db0 > /dev/null"
+		;;
+	lsdb)
+		measure lsdb 1 "echo ls | '$mongovi' / > /dev/null"
+		;;
+	import)
+		# every run appends to the same collection, which is fine since
+		# imports do not read existing documents
+		measure import "$docs" \
+		    "'$mongovi' -i /bench/import < '$tmp/import.json'"
+		;;
+	insert)
+		measure insert "$docs" \
+		    "'$mongovi' /bench/insert < '$tmp/insert.txt' > /dev/null"
+		;;
+	*)
+		echo "run.sh: unknown scenario: $s" >&2
+		exit 1
+		;;
+	esac
+done
+
+kill -INT $pid
+wait $pid || true
+cat "$tmp/mockd.log" >&2
@@ -25,20 +25,30 @@
 
 #include <locale.h>
 #include <assert.h>
+#include <ctype.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <histedit.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <signal.h>
 #include <string.h>
+#include <time.h>
 
 #include <bson/bson.h>
 #include <mongoc/mongoc.h>
 
 #include "compat/compat.h"
+#include "histogram.h"
 #include "jsonify.h"
+#include "linereader.h"
+#include "nscache.h"
 #include "shorten.h"
 #include "prefix_match.h"
 #include "parse_path.h"
+#include "schema.h"
 
 #ifndef VERSION_MAJOR
 #define VERSION_MAJOR 0
@@ -46,7 +56,6 @@
 #define VERSION_PATCH 0
 #endif
 
-#define MAXLINE 16 * 100 * 1024
 #define MAXUSERNAME 100
 
 #define DFLMONGOURL "mongodb://localhost:27017"
@@ -55,13 +64,41 @@
 #define DOTFILE ".mongovi"
 
 #define MAXPROG 10
-#define MAXDOC 16 * 100 * 1024	/* maximum size of a json document */
 
 #ifndef PATH_MAX
 #define PATH_MAX 1024
 #endif
 
 #define BULKINSERTMAX 10000
+#define INSERTQMAX 1000		/* inserts of a script to send at once */
+#define INSERTQBYTES (8 * 1024 * 1024)
+#define INSERTQWAIT 100000	/* most microseconds to hold an insert back */
+#define READCHUNK 64 * 1024
+#define KEEPBUF 64 * 1024	/* release bigger buffers after each command */
+
+#define BENCHOPS 10000		/* default number of operations of bench */
+#define BENCHTHREADS 4		/* default number of threads of bench */
+#define BENCHMAXTHREADS 64
+#define BENCHIDS 1000		/* number of ids to sample for point queries */
+#define BENCHRANGE 100		/* maximum number of documents per range find */
+#define FIRSTBATCHTTY 20	/* documents in the first batch on a terminal */
+#define FIRSTBATCH 101		/* documents in the first batch otherwise */
+#define MAXREPLY 16 * 1024 * 1024	/* maximum size of a server reply */
+#define TRACEBUF 64 * 1024	/* stdio buffer of the trace file */
+#define NSCACHETTL 300		/* seconds to cache names for completion */
+#define PREFETCHQ 4		/* maximum number of queued prefetches */
+#define PREFETCHWAIT 200	/* milliseconds to wait for a prefetch */
+#define SAMPLESIZE 100		/* documents to sample for field completion */
+#define SAMPLEDOCS 1000		/* sampled documents to remember */
+#define SAMPLEREFRESH 60	/* seconds before sampling again */
+#define SCHEMACACHE 16		/* collections to remember the fields of */
+#define SCHEMADEPTH 20		/* nesting levels to sample */
+#define MAXFIELDPATH 256
+#define MAXJOBS 16		/* background jobs at once, see startjob */
+#define JOBWAIT 100		/* milliseconds between checks for SIGINT */
+#define JOBFREE 0		/* states of a job */
+#define JOBRUNNING 1
+#define JOBDONE 2
 
 #define MAXPROMPTCOLUMNS 30	/* The maximum number of columns the prompt may
 				   use. Should be at least "/x..y/x..y> " = 4 +
@@ -74,8 +111,13 @@ static char progname[MAXPROG];
 
 static path_t path, prevpath, homepath;
 
-/* use as temporary one-time storage while building a query or query results */
-static uint8_t tmpdocs[16 * 1024 * 1024];
+/*
+ * Use as temporary one-time storage while building a query or query results.
+ * Both are grown on demand and reused between commands. Background jobs have
+ * their own, like all state of a command in progress.
+ */
+static _Thread_local char *tmpdocs, *updatedoc;
+static _Thread_local size_t tmpdocssize, updatedocsize;
 
 /*
  * Make sure the prompt can hold MAXPROMPTCOLUMNS + a trailing null. Since
@@ -84,8 +126,147 @@ static uint8_t tmpdocs[16 * 1024 * 1024];
  */
 static char pmpt[8 * MAXPROMPTCOLUMNS + 8] = "/> ";
 
-static mongoc_client_t *client;
-static mongoc_collection_t *ccoll;	/* current collection */
+static char connurl[MAXMONGOURL];
+static mongoc_client_t *client;		/* see getclient */
+static mongoc_collection_t *ccoll;	/* current collection, see getccoll */
+
+/* the driver is initialized on first use, see initmongo */
+static pthread_once_t mongoonce = PTHREAD_ONCE_INIT;
+static int mongoinited;
+
+/* client pool for commands that use multiple threads, see getpool */
+static mongoc_client_pool_t *pool;
+static pthread_mutex_t poolmtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* set by SIGINT, cleared at the start of each command, see intrsetup */
+static volatile sig_atomic_t interrupted;
+static int intrpipe[2] = { -1, -1 };
+
+/* set when the reader of stdout went away, see checkout */
+static int outclosed;
+
+/* comment of the query in progress that is killed on SIGINT, see beginop */
+static char opcomment[64];
+static pthread_mutex_t opmtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* where beginop puts the comment, job->comment in a background job */
+static _Thread_local char *opcur = opcomment;
+
+/* where commands print, job->fp in a background job, see startjob */
+static _Thread_local FILE *outfp;
+
+/* a command that runs in the background on a client from the pool */
+struct job {
+	pthread_t thread;
+	path_t ns;
+	const char *cmd;	/* one of bgcmds */
+	char *args;
+	char file[PATH_MAX];	/* where the output goes */
+	FILE *fp;
+	char comment[sizeof(opcomment)];	/* see beginop */
+	int state;		/* JOBFREE, JOBRUNNING or JOBDONE */
+	int killed;
+	int rc;
+};
+
+/* background jobs by number - 1, state and killed are guarded by jobmtx */
+static struct job bgjobs[MAXJOBS];
+static pthread_mutex_t jobmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobcond = PTHREAD_COND_INITIALIZER;
+
+/* the job of the calling thread, if any */
+static _Thread_local struct job *curjob;
+
+/* a cursor that is printed page by page, see printcursor */
+struct pager {
+	mongoc_cursor_t *cursor;
+	char comment[sizeof(opcomment)];	/* see beginop */
+	uint64_t docs;
+	uint64_t bytes;
+	uint32_t batch;		/* size of the current batch */
+	uint32_t inbatch;	/* documents read from the current batch */
+};
+
+/* the cursor of the last find or aggregate while it has more documents */
+static _Thread_local struct pager pager;
+
+/* consecutive inserts of a script that are sent at once, see queueinsert */
+struct insertq {
+	mongoc_collection_t *coll;
+	bson_t *docs[INSERTQMAX];
+	size_t n;
+	size_t bytes;
+	int64_t first;		/* when the first document was queued */
+};
+
+static struct insertq insertq;
+
+/* write commands between "bulk begin" and "bulk commit", see exec_bulk */
+struct bulk {
+	mongoc_bulk_operation_t *op;
+	path_t ns;		/* the collection it began on */
+	char **cmds;		/* each queued command for error messages */
+	size_t n;
+	size_t size;
+};
+
+static _Thread_local struct bulk bulk;
+
+/* database and collection names for tab completion, see locknames */
+static struct nscache nscache;
+static const char *cachefile;
+static pthread_mutex_t nsmtx = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long nsgen;	/* incremented on every invalidation */
+
+/* fetches names and fields for tab completion in the background */
+struct prefetcher {
+	pthread_t thread;
+	pthread_cond_t cond;	/* the queue changed or a job is done */
+	path_t queue[PREFETCHQ];	/* see prefetchrun */
+	int nqueue;
+	path_t job;		/* the job in progress */
+	int busy;
+	int started;		/* 1 if running, -1 if it failed to start */
+	int quit;
+};
+
+static struct prefetcher prefetcher;
+
+/* the sampled fields of a collection, see prefetchfields */
+struct nsschema {
+	path_t ns;
+	struct schema schema;
+	time_t sampled;
+};
+
+static struct nsschema schemas[SCHEMACACHE];
+static int nschemas;
+
+/* names of the types recorded by bsontype */
+static const char *typenames[] = {
+	"unknown",
+	"double",
+	"string",
+	"object",
+	"array",
+	"binData",
+	"undefined",
+	"objectId",
+	"bool",
+	"date",
+	"null",
+	"regex",
+	"dbPointer",
+	"javascript",
+	"symbol",
+	"javascriptWithScope",
+	"int",
+	"timestamp",
+	"long",
+	"decimal",
+	"maxKey",
+	"minKey"
+};
 
 static bson_t *bsonupsertopt, *bsonprojectid;
 
@@ -95,22 +276,151 @@ static int ttyin, ttyout;
 
 static int import, homepathset;
 
+/* set while reading the continuation lines of a multi-line command */
+static int contline;
+
+/* where the time of the last command went, in microseconds, see exec_cmd */
+struct timing {
+	int64_t start;
+	int64_t connect;	/* creating the client on first use */
+	int64_t parse;		/* converting the arguments to BSON */
+	int64_t first;		/* waiting for the first document */
+	int64_t server;		/* waiting for the server in total */
+	int64_t print;		/* formatting and printing documents */
+	uint64_t docs;
+	uint64_t bytes;		/* BSON size of the documents received */
+};
+
+static _Thread_local struct timing timing;
+static int timingon;
+static int64_t startup;	/* until the first command could be read */
+
+/* latency histogram of one command or query shape, see record */
+struct latency {
+	char *name;
+	struct histogram hist;
+};
+
+struct latencies {
+	struct latency **v;
+	size_t n;
+};
+
+/* latencies of all commands since startup, see exec_stats */
+static struct latencies cmdlat, shapelat;
+
+static char *shape;
+static size_t shapesize;
+
+/* command started by the driver, see tracestarted */
+struct tracecmd {
+	int64_t reqid;
+	uint32_t bytes;
+	char ns[MAXDBNAME + 1 + MAXCOLLNAME];
+};
+
+/* APM trace log, see -t */
+static FILE *tracefp;
+static mongoc_apm_callbacks_t *tracecbs;
+static pthread_mutex_t tracemtx = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * The command in progress of the calling thread. The driver calls the started
+ * and the finished callback of a command on the thread that runs it, and
+ * request ids are only unique per client.
+ */
+static _Thread_local struct tracecmd tracecmd;
+static int64_t tracestart;
+
 static const char *cmds[] = {
 	"aggregate",
+	"bench",
+	"bulk",
 	"cd",
 	"count",
 	"drop",
+	"explain",
 	"find",
 	"help",
 	"insert",
+	"jobs",
+	"kill",
 	"ls",
+	"more",
 	"remove",
+	"stats",
+	"timing",
 	"update",
 	"upsert",
+	"wait",
 	"exit",
 	NULL
 };
 
+/* commands that may run in the background, see startjob */
+static const char *bgcmds[] = {
+	"aggregate",
+	"count",
+	"find",
+	"remove",
+	"update",
+	"upsert",
+	NULL
+};
+
+/* cmds in sorted order for completion */
+static struct pmindex cmdindex;
+
+/* commands with JSON arguments that may span multiple lines */
+static const char *jsoncmds[] = {
+	"aggregate",
+	"bench",
+	"count",
+	"explain",
+	"find",
+	"insert",
+	"remove",
+	"update",
+	"upsert",
+	NULL
+};
+
+/*
+ * Make sure *buf, which is *bufsize bytes, can hold at least "need" bytes.
+ *
+ * Return 0 on success, -1 on failure with errno set.
+ */
+static int
+growbuf(char **buf, size_t *bufsize, size_t need)
+{
+	char *p;
+
+	if (need <= *bufsize)
+		return 0;
+
+	if ((p = realloc(*buf, need)) == NULL)
+		return -1;
+
+	*buf = p;
+	*bufsize = need;
+
+	return 0;
+}
+
+/*
+ * Release *buf if it grew bigger than KEEPBUF bytes.
+ */
+static void
+shrinkbuf(char **buf, size_t *bufsize)
+{
+	if (*bufsize <= KEEPBUF)
+		return;
+
+	free(*buf);
+	*buf = NULL;
+	*bufsize = 0;
+}
+
 /*
  * Test the results of tok_str(3) and tok_line(3) and print an appropriate
  * message on stderr if there was a problem.
@@ -184,28 +494,27 @@ cleanup:
 }
 
 /*
- * Given a word, a cursor position in the word and a list of options, complete
+ * Given a word, a cursor position in the word and an index of options, complete
  * the word to the longest common prefix and print a list of remaining options,
- * if any.
+ * if any. The word is only completed in the line buffer if "e" is not NULL.
  *
- * Returns 1 if word is now complete to one option in opts (possibly by prefix
+ * Returns 1 if word is now complete to one option in idx (possibly by prefix
  * extension) or 0 if not.
  *
  * If one option is selected and *selected is not NULL, it is updated to point
- * into **opts to the selected option.
+ * to the selected option.
  *
  * 0. if no option has the prefix of word or the prefix matches more than one
  *    option
  * 1. if word matches one option
  */
 static int
-complete_word(EditLine *e, const char *word, size_t wordlen, const char **opts,
-    const char **selected)
+complete_word(EditLine *e, const char *word, size_t wordlen,
+    const struct pmindex *idx, const char **selected)
 {
-	const char **matches;
 	char *prefix;
-	size_t lcplen;
-	int r, i;
+	size_t first, i, n;
+	int lcplen;
 
 	prefix = strndup(word, wordlen);
 	if (prefix == NULL) {
@@ -213,866 +522,3501 @@ complete_word(EditLine *e, const char *word, size_t wordlen, const char **opts,
 		abort();
 	}
 
-	if (prefix_match(&matches, opts, prefix) == -1) {
-		warn("complete_word prefix_match");
-		abort();
-	}
+	n = pmindex_range(idx, prefix, &first);
 	free(prefix);
 
-	if (matches[0] == NULL) {
-		free(matches);
+	if (n == 0)
 		return 0;
-	}
 
-	if (matches[1] == NULL) {
-		lcplen = strlen(matches[0]);
+	if (n == 1) {
+		lcplen = strlen(idx->v[first]);
 	} else {
 		printf("\n");
-		for (i = 0; matches[i] != NULL; i++)
-			printf("%s\n", matches[i]);
+		for (i = first; i < first + n; i++)
+			printf("%s\n", idx->v[i]);
 
-		lcplen = common_prefix(matches);
+		lcplen = pmindex_lcp(idx, first, n);
 	}
 
-	if (lcplen > wordlen) {
+	if (lcplen > 0 && (size_t)lcplen > wordlen) {
 		/* zip up */
-		prefix = strndup(&matches[0][wordlen], lcplen - wordlen);
+		prefix = strndup(&idx->v[first][wordlen], lcplen - wordlen);
 		if (prefix == NULL) {
-			warn("complete_word strndup matches[0]");
+			warn("complete_word strndup match");
 			abort();
 		}
-		el_insertstr(e, prefix);
+		if (e != NULL)
+			el_insertstr(e, prefix);
 		free(prefix);
-
-		wordlen = lcplen;
 	}
 
-	r = 0;
-	if (matches[1] == NULL) {
-		/* word is complete */
-		if (selected != NULL)
-			*selected = matches[0];
+	if (n > 1)
+		return 0;
 
-		r = 1;
-	}
+	/* word is complete */
+	if (selected != NULL)
+		*selected = idx->v[first];
 
-	free(matches);
-	return r;
+	return 1;
+}
+
+static void
+initmongo(void)
+{
+	mongoc_init();
+	mongoinited = 1;
 }
 
 /*
- * Complete a /database/collection path.
- *
- * If more than one option matches the same prefix, all options are printed and
- * the common prefix is completed. If exactly one component matches it is
- * completed.
+ * Return the client, create it on first use so that commands that do not talk
+ * to the server do not pay for initializing the driver.
  *
- * Return 0 on success or -1 on failure.
+ * Return NULL on failure.
  */
-static int
-complete_path(EditLine *e, const char *npath, size_t npathlen)
+static mongoc_client_t *
+getclient(void)
 {
-	path_t tmppath;
-	bson_error_t error;
-	mongoc_database_t *db;
-	char p[PATH_MAX], p2[PATH_MAX], lastchar;
-	int i, comps;
-	char **strv;
-	size_t n;
-
-	if (npathlen >= sizeof(p2)) {
-		warnx("complete_path p2 too small: %s", npath);
-		return -1;
-	}
-
-	strncpy(p2, npath, npathlen);
-	p2[npathlen] = '\0';
+	int64_t t;
 
-	if (npathlen > 0) {
-		lastchar = p2[npathlen - 1];
-	} else {
-		lastchar = '\0';
-	}
+	if (client != NULL)
+		return client;
 
-	/* copy current context */
-	if ((size_t)snprintf(p, sizeof(p), "/%s/%s", path.dbname, path.collname)
-	    >= sizeof(p)) {
-		warnx("complete_path p too small: %s", p2);
-		return -1;
-	}
+	t = bson_get_monotonic_time();
 
-	n = resolvepath(p, sizeof(p), p2, &comps);
-	if (n == (size_t)-1) {
-		warnx("complete_path resolvepath error: %s", p2);
-		return -1;
-	}
+	pthread_once(&mongoonce, initmongo);
 
-	if (parse_path(&tmppath, p) == -1) {
-		warnx("parse_path error: %s", p2);
-		abort();
+	if ((client = mongoc_client_new(connurl)) == NULL) {
+		warnx("can't connect to mongo using connection string \"%s\"",
+		    connurl);
+		return NULL;
 	}
 
-	if (comps > 1 || (comps == 1 && lastchar == '/') ||
-	    (comps == 1 && lastchar == '\0')) {
-		db = mongoc_client_get_database(client, tmppath.dbname);
-		strv = mongoc_database_get_collection_names_with_opts(db, NULL,
-		    &error);
-		mongoc_database_destroy(db);
-		db = NULL;
-		if (strv == NULL) {
-			warnx("complete collection failed: %d.%d %s",
-			    error.domain, error.code, error.message);
-			return -1;
-		}
+	if (tracecbs != NULL && !mongoc_client_set_apm_callbacks(client,
+	    tracecbs, NULL))
+		warnx("could not trace the client");
 
-		i = complete_word(e, tmppath.collname, strlen(tmppath.collname),
-		    (const char **)strv, NULL);
-		bson_strfreev(strv);
-		strv = NULL;
+	timing.connect += bson_get_monotonic_time() - t;
 
-		if (i == 1 && lastchar != ' ' && lastchar != '\0')
-			el_insertstr(e, " ");
-	} else {
-		strv = mongoc_client_get_database_names_with_opts(client, NULL,
-		    &error);
-		if (strv == NULL) {
-			warnx("complete db failed: %d.%d %s", error.domain,
-			    error.code, error.message);
-			return -1;
-		}
+	return client;
+}
 
-		i = complete_word(e, tmppath.dbname, strlen(tmppath.dbname),
-		    (const char **)strv, NULL);
-		bson_strfreev(strv);
-		strv = NULL;
+/*
+ * Return the collection of the current path, create it on first use.
+ *
+ * Return NULL if no collection is selected or on failure.
+ */
+static mongoc_collection_t *
+getccoll(void)
+{
+	mongoc_client_t *c;
 
-		/* append trailing "/" if word is completed or relative root */
-		if ((i == 1 && lastchar != '/') || (comps == 0 && lastchar != '/'))
-			el_insertstr(e, "/");
-	}
+	if (ccoll == NULL && strlen(path.collname) > 0 &&
+	    (c = getclient()) != NULL)
+		ccoll = mongoc_client_get_collection(c, path.dbname,
+		    path.collname);
 
-	return 0;
+	return ccoll;
 }
 
 /*
- * Tab complete commands and path arguments.
- *
- * if empty, print all commands
- * if matches more than one command, print all with matching prefix
- * if matches exactly one command and not complete, complete
- * if command is complete and needs args, look at that
+ * Return the client pool, create it on first use.
  */
-static unsigned char
-complete(EditLine *e, __attribute__((unused)) int ch)
+static mongoc_client_pool_t *
+getpool(void)
 {
-	Tokenizer *t;
-	const char **av;
-	int i, rc, ac, cc, co;
+	bson_error_t error;
+	mongoc_uri_t *uri;
 
-	t = tok_init(NULL);
-	rc = tok_line(t, el_line(e), &ac, &av, &cc, &co);
-	rc = test_tokresult(rc);
+	/* killops may call this from another thread */
+	pthread_mutex_lock(&poolmtx);
 
-	if (rc == -1) {
-		rc = CC_ERROR;
-		goto cleanup;
+	if (pool != NULL) {
+		pthread_mutex_unlock(&poolmtx);
+		return pool;
 	}
 
-	if (ac == 0) {
-		printf("\n");
-		for (i = 0; cmds[i] != NULL; i++)
-			printf("%s\n", cmds[i]);
+	pthread_once(&mongoonce, initmongo);
 
-		rc = CC_REDISPLAY;
-		goto cleanup;
+	if ((uri = mongoc_uri_new_with_error(connurl, &error)) == NULL) {
+		pthread_mutex_unlock(&poolmtx);
+		warnx("could not parse connection string: %d.%d %s",
+		    error.domain, error.code, error.message);
+		return NULL;
 	}
 
-	/*
-	 * If the first word is currently selected, try to complete as a
-	 * command, if the second word is selected and the command (first word)
-	 * supports a path argument, try to complete as a path.
-	 */
-	if (cc == 0) {
-		/* append trailing " " if command is complete(d) */
-		i = complete_word(e, av[cc], co, cmds, NULL);
-		if (i == 1)
-			el_insertstr(e, " ");
+	pool = mongoc_client_pool_new(uri);
+	mongoc_uri_destroy(uri);
 
-		rc = CC_REDISPLAY;
-	} else if (cc >= 1) {
-		if (strcmp(av[0], "cd") == 0 || strcmp(av[0], "ls") == 0 ||
-		    strcmp(av[0], "drop") == 0) {
-			if (complete_path(e, av[cc], co) == -1) {
-				warnx("complete_path error");
-				goto cleanup;
-			}
-		}
-		rc = CC_REDISPLAY;
+	if (pool == NULL) {
+		pthread_mutex_unlock(&poolmtx);
+		warnx("could not create client pool");
+		return NULL;
 	}
 
-cleanup:
-	tok_end(t);
+	mongoc_client_pool_set_error_api(pool, 2);
 
-	return rc;
+	if (tracecbs != NULL && !mongoc_client_pool_set_apm_callbacks(pool,
+	    tracecbs, NULL))
+		warnx("could not trace the client pool");
+
+	pthread_mutex_unlock(&poolmtx);
+
+	return pool;
 }
 
 /*
- * Find the next token starting at *line. *line is updated to point to the
- * first non-whitespace character.
- *
- * Note: the separator is always an ASCII SPACE (0x20) or ASCII HTAB (0x09).
+ * Append the options for listing the names under "key" that start with
+ * "prefix" to "opts". Only the namespaces the user is authorized for are
+ * requested, which lets users without the listDatabases or listCollections
+ * privilege list them and saves the server from checking each one. A prefix
+ * is sent as an anchored regular expression in which every ASCII character
+ * that is not alphanumeric is escaped, so the server matches it literally.
  *
- * Returns the number of bytes of the token starting at *line.
+ * The driver already sets "nameOnly" for both commands.
  */
-static size_t
-nexttok(const char **line)
+static void
+nameopts(bson_t *opts, const char *key, const char *prefix)
 {
-	*line = &(*line)[strspn(*line, " \t")];
-	return strcspn(*line, " \t");
+	bson_t filter, name;
+	char re[2 * MAXCOLLNAME + 2];
+	size_t i, j;
+
+	if (strlen(key) == 0)
+		BSON_APPEND_BOOL(opts, "authorizedDatabases", true);
+	else
+		BSON_APPEND_BOOL(opts, "authorizedCollections", true);
+
+	if (strlen(prefix) == 0 || strlen(prefix) >= MAXCOLLNAME)
+		return;
+
+	re[0] = '^';
+	for (i = 0, j = 1; prefix[i] != '\0'; i++) {
+		if ((unsigned char)prefix[i] < 0x80 &&
+		    !isalnum((unsigned char)prefix[i]))
+			re[j++] = '\\';
+		re[j++] = prefix[i];
+	}
+	re[j] = '\0';
+
+	BSON_APPEND_DOCUMENT_BEGIN(opts, "filter", &filter);
+	BSON_APPEND_DOCUMENT_BEGIN(&filter, "name", &name);
+	BSON_APPEND_UTF8(&name, "$regex", re);
+	bson_append_document_end(&filter, &name);
+	bson_append_document_end(opts, &filter);
 }
 
 /*
- * Create a mongo extended JSON id selector document. If selector is 24 hex
- * digits treat it as an object id, otherwise as a literal.
- *
- * dst     - resulting json doc is written to dst
- * dstsize - the size of dst
- * sel     - selector, must be NUL terminated
- * sellen  - length of sel, excluding the terminating NUL character
+ * Fetch the names of the collections in database "key", or of the databases
+ * if "key" is "", that start with "prefix" using "c". Use "" to fetch all
+ * names.
  *
- * Return 0 on success, -1 on failure.
+ * Return the names on success, which must be released with bson_strfreev, or
+ * NULL on failure with "error" set.
  */
-static int
-idtosel(char *dst, size_t dstsize, const char *sel, size_t sellen)
+static char **
+fetchnames(mongoc_client_t *c, const char *key, const char *prefix,
+    bson_error_t *error)
 {
-	const size_t oidlen = 24;
-	size_t n;
+	mongoc_database_t *db;
+	bson_t opts;
+	char **strv;
 
-	if (dstsize < 1 || sellen < 1)
-		return -1;
+	bson_init(&opts);
+	nameopts(&opts, key, prefix);
 
-	/* if 24 hex chars, assume an object id otherwise treat as a literal */
-	if (sellen == oidlen && (strspn(sel, "0123456789abcdefABCDEF") ==
-	    oidlen)) {
-		n = snprintf(dst, dstsize,
-		    "{ \"_id\": { \"$oid\": \"%.*s\" } }", (int)oidlen, sel);
-		if (n >= dstsize)
-			return -1;
+	if (strlen(key) == 0) {
+		strv = mongoc_client_get_database_names_with_opts(c, &opts,
+		    error);
 	} else {
-		n = snprintf(dst, dstsize, "{ \"_id\": \"%.*s\" }", (int)sellen,
-		    sel);
-		if (n >= dstsize)
-			return -1;
+		db = mongoc_client_get_database(c, key);
+		strv = mongoc_database_get_collection_names_with_opts(db,
+		    &opts, error);
+		mongoc_database_destroy(db);
 	}
 
-	return 0;
+	bson_destroy(&opts);
+
+	return strv;
 }
 
 /*
- * Parse the selector in line, that is the first (relaxed) json object or
- * literal id. A strictly conforming JSON object is written in "doc" on
- * success.
- *
- * "line" must be null terminated and "linelen" must exclude the terminating
- * null byte.
- *
- * Return the number of bytes parsed on success or -1 on failure.
- * On success, if docsize > 0, a null byte is always written to doc.
+ * Store "names" under "key" and "prefix" in the cache unless it was
+ * invalidated since generation "gen". Must be called with nsmtx held.
  */
-static int
-parse_selector(uint8_t *doc, size_t docsize, const char *line, size_t linelen)
+static void
+storenames(const char *key, const char *prefix, char **names,
+    unsigned long gen)
 {
-	const char *id;
-	size_t n, idlen;
-	int offset;
+	if (gen != nsgen)
+		return;
 
-	/*
-	 * If the first non-blank char is a "{" then try to parse it as a
-	 * relaxed JSON object. Otherwise try to parse it as a literal and
-	 * convert to an id selector.
-         */
-	n = strspn(line, " \t");
-	if (line[n] == '{') {
-		offset = relaxed_to_strict((char *)doc, docsize, line, linelen,
-		    1);
-		if (offset == -1) {
-			warnx("could not parse line as JSON object(s): %.*s",
-			    (int)linelen, line);
-			return -1;
-		}
+	if (nscache_put(&nscache, key, prefix, names, time(NULL)) == -1)
+		warn("nscache_put");
+}
 
-		return offset;
-	}
+/*
+ * Invalidate the cached names under "key", or all names if "key" is NULL.
+ */
+static void
+forgetns(const char *key)
+{
+	pthread_mutex_lock(&nsmtx);
+	nscache_invalidate(&nscache, key);
+	nsgen++;
+	pthread_mutex_unlock(&nsmtx);
+}
 
-	id = line + n;
+/*
+ * Return whether "a" and "b" are the same database and collection.
+ */
+static int
+samepath(const path_t *a, const path_t *b)
+{
+	return strcmp(a->dbname, b->dbname) == 0 &&
+	    strcmp(a->collname, b->collname) == 0;
+}
 
-	if (id[0] == '"') {
-		id++;
-		idlen = strcspn(id, "\"");
+/*
+ * Return whether "job" is queued or in progress in the background. Must be
+ * called with nsmtx held.
+ */
+static int
+prefetchpending(const path_t *job)
+{
+	int i;
 
-		if (idlen == 0) {
-			warnx("could not parse selector as double quoted id: "
-			    "\"%.*s\"", (int)linelen, line);
-			return -1;
-		}
-	} else if (id[0] == '\'') {
-		id++;
-		idlen = strcspn(id, "'");
+	if (prefetcher.busy && samepath(&prefetcher.job, job))
+		return 1;
 
-		if (idlen == 0) {
-			warnx("could not parse selector as single quoted id: "
-			    "\"%.*s\"", (int)linelen, line);
-			return -1;
-		}
-	} else {
-		idlen = strcspn(id, " \t");
+	for (i = 0; i < prefetcher.nqueue; i++)
+		if (samepath(&prefetcher.queue[i], job))
+			return 1;
 
-		if (idlen == 0) {
-			if (docsize > 0)
-				doc[0] = '\0';
+	return 0;
+}
 
-			return 0;
-		}
-	}
+/*
+ * Wait at most PREFETCHWAIT milliseconds for "job" if it is queued or in
+ * progress. Must be called with nsmtx held.
+ */
+static void
+prefetchwait(const path_t *job)
+{
+	struct timespec deadline;
 
-	if (idtosel((char *)doc, docsize, id, idlen) == -1) {
-		warnx("could not parse selector as an id: \"%.*s\"", (int)idlen,
-		    id);
-		return -1;
-	}
+	if (!prefetchpending(job))
+		return;
 
-	return (id - line) + idlen;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_nsec += PREFETCHWAIT * 1000000L;
+	deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+	deadline.tv_nsec %= 1000000000L;
+
+	while (prefetchpending(job))
+		if (pthread_cond_timedwait(&prefetcher.cond, &nsmtx, &deadline)
+		    == ETIMEDOUT)
+			break;
 }
 
-static char *
-prompt(void)
+/*
+ * Return the sampled fields of collection "ns" or NULL if there are none. Must
+ * be called with nsmtx held.
+ */
+static struct nsschema *
+findschema(const path_t *ns)
 {
-	return pmpt;
+	int i;
+
+	for (i = 0; i < nschemas; i++)
+		if (samepath(&schemas[i].ns, ns))
+			return &schemas[i];
+
+	return NULL;
 }
 
 /*
- * Update the prompt with the given dbname and collname. If the prompt exceeds
- * MAXPROMPTCOLUMNS than shorten the dbname and collname.
- *
- * The following cases can arise:
- * 1. dbname and collname are NULL, then prompt will be "/> "
- * 2. dbname is not NULL and collname is NULL:
- *   a. if columns("/> ") + columns(dbname) is <= MAXPROMPTCOLUMNS
- *      then the prompt will be "/dbname> "
- *   b. if columns("/> ") + columns(dbname) is > MAXPROMPTCOLUMNS
- *      then dbname will be shortened and the prompt will be "/db..me> "
- * 3. dbname is not NULL and collname is not NULL:
- *   a. if columns("//> ") + columns(dbname) + columns(collname) is <= MAXPROMPTCOLUMNS
- *      then the prompt will be "/dbname/collname> "
- *   b. if columns("//> ") + columns(dbname) + columns(collname) is > MAXPROMPTCOLUMNS
- *      then dbname and collname will be shortened and the prompt will be
- *      "/db..me/co..me> ".
+ * Add the fields "s" that were sampled from collection "ns" to the fields that
+ * were sampled before, unless they were invalidated since generation "gen".
+ * The fields of the collection that was sampled longest ago are replaced if
+ * there is no room. Must be called with nsmtx held.
  */
-static int
-set_prompt(const char *dbname, size_t dbnamelen, const char *collname,
-    size_t collnamelen)
+static void
+storeschema(const path_t *ns, const struct schema *s, unsigned long gen)
 {
-	char c1[sizeof(pmpt)], c2[sizeof(pmpt)];
-	size_t n;
+	struct nsschema *e;
+	int i;
 
-	if (dbnamelen == 0 && collnamelen == 0) {
-		if ((size_t)snprintf(pmpt, sizeof(pmpt), "/> ") >= sizeof(pmpt))
-			return -1;
+	if (gen != nsgen)
+		return;
 
-		return 0;
+	if ((e = findschema(ns)) == NULL) {
+		if (nschemas < SCHEMACACHE) {
+			e = &schemas[nschemas++];
+		} else {
+			e = &schemas[0];
+			for (i = 1; i < nschemas; i++)
+				if (schemas[i].sampled < e->sampled)
+					e = &schemas[i];
+			schema_free(&e->schema);
+		}
+
+		e->ns = *ns;
+		schema_init(&e->schema);
 	}
 
-	/* err if only collname is provided */
-	if (dbnamelen == 0)
-		return -1;
+	if (schema_merge(&e->schema, s) == -1)
+		warn("schema_merge");
 
-	c1[0] = '\0';
-	c2[0] = '\0';
+	/* let fields that are no longer used fade away */
+	while (e->schema.ndocs > SAMPLEDOCS)
+		schema_decay(&e->schema);
 
-	/* default to db only prompt */
-	n = strlen("/> ");
+	e->sampled = time(NULL);
+}
 
-	if (strlcpy(c1, dbname, sizeof(c1)) >= sizeof(c1))
-		return -1;
+/*
+ * Forget the sampled fields of collection "ns", or of all collections in the
+ * database of "ns" if it has no collection name.
+ */
+static void
+forgetfields(const path_t *ns)
+{
+	int i;
 
-	if (collnamelen > 0) {
-		/* make dbname + collname prompt */
-		n = strlen("//> ");
-		if (strlcpy(c2, collname, sizeof(c2)) >= sizeof(c2))
-			return -1;
-	}
+	pthread_mutex_lock(&nsmtx);
 
-	if (shorten_comps(c1, c2, MAXPROMPTCOLUMNS - n) == (size_t)-1)
-		return -1;
+	for (i = 0; i < nschemas; ) {
+		if (strcmp(schemas[i].ns.dbname, ns->dbname) != 0 ||
+		    (strlen(ns->collname) > 0 &&
+		    strcmp(schemas[i].ns.collname, ns->collname) != 0)) {
+			i++;
+			continue;
+		}
 
-	if (collnamelen == 0) {
-		n = snprintf(pmpt, sizeof(pmpt), "/%s> ", c1);
-		if (n >= sizeof(pmpt))
-			return -1;
-	} else {
-		n = snprintf(pmpt, sizeof(pmpt), "/%s/%s> ", c1, c2);
-		if (n >= sizeof(pmpt))
-			return -1;
+		schema_free(&schemas[i].schema);
+		schemas[i] = schemas[--nschemas];
 	}
+	nsgen++;
 
-	return 0;
+	pthread_mutex_unlock(&nsmtx);
+}
+
+static void
+freeschemas(void)
+{
+	while (nschemas > 0)
+		schema_free(&schemas[--nschemas].schema);
 }
 
 /*
- * Exhaust a cursor and print each object.
+ * Return the type "t" as a bit number for schema_add, see typenames.
  */
-static int
-printcursor(mongoc_cursor_t *cursor)
+static unsigned int
+bsontype(bson_type_t t)
 {
-	bson_error_t error;
-	size_t rlen;
-	const bson_t *doc;
-	char *str;
-	struct winsize w;
+	if (t == BSON_TYPE_MAXKEY)
+		return 20;
+	if (t == BSON_TYPE_MINKEY)
+		return 21;
 
-	w.ws_row = 0;
-	w.ws_col = 0;
-	if (hr && ttyout) {
-		if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == -1)
-			warn("could not determine window size: %d %d", w.ws_row,
-			    w.ws_col);
-	}
+	return t < 20 ? t : 0;
+}
 
-	while (mongoc_cursor_next(cursor, &doc)) {
-		if (hr) {
-			str = bson_as_relaxed_extended_json(doc, &rlen);
-		} else {
-			str = bson_as_canonical_extended_json(doc, &rlen);
-		}
+/*
+ * Add the fields of the document that "it" iterates over to "s", prefixed with
+ * the "len" bytes in "path" which is MAXFIELDPATH bytes. The fields of
+ * documents in arrays are added without the array index, like in dot notation.
+ */
+static void
+addfields(struct schema *s, bson_iter_t *it, char *path, size_t len, int depth)
+{
+	bson_iter_t child, elem;
+	const char *key;
+	size_t n;
 
-		if (hr && rlen > w.ws_col) {
-			if (human_readable((char *)tmpdocs, sizeof(tmpdocs),
-			    str, rlen) == -1) {
-				warnx("could not make human readable JSON "
-				    "string");
+	while (bson_iter_next(it)) {
+		key = bson_iter_key(it);
 
-				return -1;
-			}
-			printf("%s\n", tmpdocs);
-		} else {
-			printf("%s\n", str);
-		}
+		n = len + (len > 0) + strlen(key);
+		if (n >= MAXFIELDPATH)
+			continue;
 
-		bson_free(str);
-	}
+		if (len > 0)
+			path[len] = '.';
+		strcpy(&path[len + (len > 0)], key);
 
-	if (mongoc_cursor_error(cursor, &error)) {
-		warnx("cursor failed: %d.%d %s", error.domain, error.code,
-		    error.message);
-		return -1;
+		if (schema_add(s, path, bsontype(bson_iter_type(it))) == -1)
+			break;
+
+		if (depth == SCHEMADEPTH)
+			continue;
+
+		if (BSON_ITER_HOLDS_DOCUMENT(it) &&
+		    bson_iter_recurse(it, &child)) {
+			addfields(s, &child, path, n, depth + 1);
+		} else if (BSON_ITER_HOLDS_ARRAY(it) &&
+		    bson_iter_recurse(it, &elem)) {
+			while (bson_iter_next(&elem))
+				if (BSON_ITER_HOLDS_DOCUMENT(&elem) &&
+				    bson_iter_recurse(&elem, &child))
+					addfields(s, &child, path, n,
+					    depth + 1);
+		}
 	}
 
-	return 0;
+	path[len] = '\0';
 }
 
 /*
- * List database for the given client.
+ * Add the fields of SAMPLESIZE random documents of collection "ns" to "s",
+ * using "c".
  *
  * Return 0 on success, -1 on failure.
  */
 static int
-exec_lsdbs(mongoc_client_t *client)
+samplefields(mongoc_client_t *c, const path_t *ns, struct schema *s)
 {
-	bson_error_t error;
-	char **strv;
-	int i;
+	mongoc_collection_t *coll;
+	mongoc_cursor_t *cursor;
+	const bson_t *doc;
+	bson_t *pipeline;
+	bson_iter_t it;
+	char path[MAXFIELDPATH], json[64];
+	int rc;
 
-	strv = mongoc_client_get_database_names_with_opts(client, NULL, &error);
-	if (strv == NULL) {
-		warnx("could not get database names: %d.%d %s", error.domain,
-		    error.code, error.message);
+	snprintf(json, sizeof(json), "[{ \"$sample\": { \"size\": %d } }]",
+	    SAMPLESIZE);
+	if ((pipeline = bson_new_from_json((uint8_t *)json, -1, NULL)) == NULL)
 		return -1;
+
+	coll = mongoc_client_get_collection(c, ns->dbname, ns->collname);
+	cursor = mongoc_collection_aggregate(coll, MONGOC_QUERY_NONE, pipeline,
+	    NULL, NULL);
+	bson_destroy(pipeline);
+
+	while (mongoc_cursor_next(cursor, &doc)) {
+		if (!bson_iter_init(&it, doc))
+			continue;
+
+		schema_adddoc(s);
+		path[0] = '\0';
+		addfields(s, &it, path, 0, 0);
 	}
 
-	for (i = 0; strv[i] != NULL; i++)
-		printf("%s\n", strv[i]);
+	rc = mongoc_cursor_error(cursor, NULL) ? -1 : 0;
 
-	bson_strfreev(strv);
-	strv = NULL;
+	mongoc_cursor_destroy(cursor);
+	mongoc_collection_destroy(coll);
 
-	return 0;
+	return rc;
 }
 
 /*
- * List collections for the given database.
- *
- * Return 0 on success, -1 on failure.
+ * Run the jobs in the queue of the prefetcher using a client of pool "arg". A
+ * job without a collection name fetches the names of all collections in the
+ * database, or of all databases if it has no database name either, and stores
+ * them in the cache. Otherwise it samples the fields of the collection.
+ * Failures are ignored, locknames reports them when it fetches the names
+ * itself.
  */
-static int
-exec_lscolls(mongoc_client_t *client, char *dbname)
+static void *
+prefetchrun(void *arg)
 {
+	mongoc_client_pool_t *p = arg;
+	mongoc_client_t *c;
+	struct schema s;
 	bson_error_t error;
-	mongoc_database_t *db;
+	unsigned long gen;
 	char **strv;
-	int i;
+	int rc;
 
-	db = mongoc_client_get_database(client, dbname);
-	strv = mongoc_database_get_collection_names_with_opts(db, NULL, &error);
-	mongoc_database_destroy(db);
-	db = NULL;
-	if (strv == NULL) {
-		warnx("could not get collection names: %d.%d %s", error.domain,
-		    error.code, error.message);
-		return -1;
-	}
+	pthread_mutex_lock(&nsmtx);
+	for (;;) {
+		while (prefetcher.nqueue == 0 && !prefetcher.quit)
+			pthread_cond_wait(&prefetcher.cond, &nsmtx);
 
-	for (i = 0; strv[i] != NULL; i++)
-		printf("%s\n", strv[i]);
+		if (prefetcher.quit)
+			break;
 
-	bson_strfreev(strv);
-	strv = NULL;
+		prefetcher.job = prefetcher.queue[0];
+		memmove(&prefetcher.queue[0], &prefetcher.queue[1],
+		    --prefetcher.nqueue * sizeof(prefetcher.queue[0]));
+		prefetcher.busy = 1;
+		gen = nsgen;
+		pthread_mutex_unlock(&nsmtx);
 
-	return 0;
+		strv = NULL;
+		schema_init(&s);
+
+		c = mongoc_client_pool_pop(p);
+		if (strlen(prefetcher.job.collname) == 0) {
+			strv = fetchnames(c, prefetcher.job.dbname, "",
+			    &error);
+			rc = strv == NULL ? -1 : 0;
+		} else {
+			rc = samplefields(c, &prefetcher.job, &s);
+		}
+		mongoc_client_pool_push(p, c);
+
+		pthread_mutex_lock(&nsmtx);
+		if (rc == 0 && strv != NULL)
+			storenames(prefetcher.job.dbname, "", strv, gen);
+		else if (rc == 0)
+			storeschema(&prefetcher.job, &s, gen);
+		prefetcher.busy = 0;
+		pthread_cond_broadcast(&prefetcher.cond);
+
+		bson_strfreev(strv);
+		schema_free(&s);
+	}
+	pthread_mutex_unlock(&nsmtx);
+
+	return NULL;
 }
 
 /*
- * Change dbname and/or collname, set ccoll and update prompt.
+ * Start the prefetcher thread, if it is not running yet.
  *
  * Return 0 on success, -1 on failure.
  */
 static int
-exec_chcoll(mongoc_client_t *client, const path_t newpath)
+prefetchstart(void)
 {
-	size_t dbnamelen, collnamelen;
+	mongoc_client_pool_t *p;
+	pthread_condattr_t attr;
+	sigset_t set, oset;
+	int rc;
 
-	if (strcmp(newpath.dbname, path.dbname) == 0 &&
-	    strcmp(newpath.collname, path.collname) == 0) {
-		return 0;
-	}
+	if (prefetcher.started)
+		return prefetcher.started == 1 ? 0 : -1;
 
-	if (ccoll != NULL) {
-		mongoc_collection_destroy(ccoll);
-		ccoll = NULL;
-	}
+	prefetcher.started = -1;
 
-	dbnamelen = strlen(newpath.dbname);
-	collnamelen = strlen(newpath.collname);
+	if ((p = getpool()) == NULL)
+		return -1;
 
-	if (dbnamelen == 0 && collnamelen > 0) {
-		warnx("can't change collection because no db is set");
+	/* locknames waits with a timeout unaffected by clock changes */
+	if ((rc = pthread_condattr_init(&attr)) != 0) {
+		warnx("pthread_condattr_init: %s", strerror(rc));
+		return -1;
+	}
+	if ((rc = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC)) == 0)
+		rc = pthread_cond_init(&prefetcher.cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (rc != 0) {
+		warnx("pthread_cond_init: %s", strerror(rc));
 		return -1;
 	}
 
-	if (collnamelen > 0)
-		ccoll = mongoc_client_get_collection(client, newpath.dbname,
-		    newpath.collname);
-
-	if (set_prompt(newpath.dbname, dbnamelen, newpath.collname, collnamelen)
-	    == -1)
-		warnx("can't update prompt with db and collection name");
+	/* leave SIGINT to the main thread so that it interrupts el_wgets */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &set, &oset);
+	rc = pthread_create(&prefetcher.thread, NULL, prefetchrun, p);
+	pthread_sigmask(SIG_SETMASK, &oset, NULL);
 
-	if (homepathset == 0 && dbnamelen > 0) {
-		homepath = newpath;
-		homepathset = 1;
+	if (rc != 0) {
+		warnx("pthread_create: %s", strerror(rc));
+		pthread_cond_destroy(&prefetcher.cond);
+		return -1;
 	}
 
-	prevpath = path;
-	path = newpath;
+	prefetcher.started = 1;
 
 	return 0;
 }
 
 /*
- * Execute a query.
- *
- * Return 0 on success, -1 on failure.
+ * Stop the prefetcher thread, if it is running. A fetch in progress is
+ * finished first.
  */
-static int
-exec_query(mongoc_collection_t *collection, const char *line, size_t linelen,
-   int idsonly)
+static void
+prefetchstop(void)
 {
-	mongoc_cursor_t *cursor;
-	bson_error_t error;
-	bson_t *query;
-	int rc;
-
-	if (sizeof(tmpdocs) < 3)
-		abort();
-
-	if (parse_selector(tmpdocs, sizeof(tmpdocs), line, linelen) == -1)
-		return -1;
-
-	/* default to all documents */
-	if (strlen((char *)tmpdocs) == 0) {
-		tmpdocs[0] = '{';
-		tmpdocs[1] = '}';
-		tmpdocs[2] = '\0';
-	}
+	if (prefetcher.started != 1)
+		return;
 
-	if ((query = bson_new_from_json(tmpdocs, -1, &error)) == NULL) {
-		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
-		    tmpdocs);
-		return -1;
-	}
+	pthread_mutex_lock(&nsmtx);
+	prefetcher.quit = 1;
+	pthread_cond_broadcast(&prefetcher.cond);
+	pthread_mutex_unlock(&nsmtx);
 
-	cursor = mongoc_collection_find_with_opts(collection, query,
-	    idsonly ? bsonprojectid : NULL, NULL);
+	pthread_join(prefetcher.thread, NULL);
+	pthread_cond_destroy(&prefetcher.cond);
 
-	bson_destroy(query);
+	prefetcher.started = 0;
+}
 
-	rc = printcursor(cursor);
+/*
+ * Queue "job" for the prefetcher, dropping the oldest job if the queue is full.
+ * Must be called with nsmtx held.
+ */
+static void
+prefetchqueue(const path_t *job)
+{
+	if (prefetchpending(job))
+		return;
 
-	mongoc_cursor_destroy(cursor);
-	cursor = NULL;
+	/* the user moved on */
+	if (prefetcher.nqueue == PREFETCHQ)
+		memmove(&prefetcher.queue[0], &prefetcher.queue[1],
+		    --prefetcher.nqueue * sizeof(prefetcher.queue[0]));
 
-	return rc;
+	prefetcher.queue[prefetcher.nqueue++] = *job;
+	pthread_cond_broadcast(&prefetcher.cond);
 }
 
 /*
- * Count number of documents in collection.
- *
- * Return 0 on success, -1 on failure.
+ * Fetch the names of all collections in "dbname", or of all databases if
+ * "dbname" is NULL, in the background if they are not cached, so that tab
+ * completion does not have to wait for the server. Only done when reading
+ * commands from a terminal.
  */
-static int
-exec_count(mongoc_collection_t *collection, const char *line, size_t linelen)
+static void
+prefetch(const char *dbname)
 {
-	bson_error_t error;
-	bson_t *query;
-	int64_t count;
-
-	if (sizeof(tmpdocs) < 3)
-		abort();
+	path_t job = { "", "" };
 
-	if (parse_selector(tmpdocs, sizeof(tmpdocs), line, linelen) == -1)
-		return -1;
+	if (!ttyin || import)
+		return;
 
-	/* default to all documents */
-	if (strlen((char *)tmpdocs) == 0) {
-		tmpdocs[0] = '{';
-		tmpdocs[1] = '}';
-		tmpdocs[2] = '\0';
-	}
+	if (dbname != NULL && strlcpy(job.dbname, dbname, sizeof(job.dbname))
+	    >= sizeof(job.dbname))
+		return;
 
-	if ((query = bson_new_from_json(tmpdocs, -1, &error)) == NULL) {
-		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
-		    tmpdocs);
-		return -1;
-	}
+	if (prefetchstart() == -1)
+		return;
 
-	count = mongoc_collection_count_documents(collection, query, NULL, NULL,
-	    NULL, &error);
+	pthread_mutex_lock(&nsmtx);
+	if (nscache_get(&nscache, job.dbname, "", time(NULL), NULL) == NULL)
+		prefetchqueue(&job);
+	pthread_mutex_unlock(&nsmtx);
+}
 
-	bson_destroy(query);
+/*
+ * Sample the fields of collection "ns" in the background if it was not sampled
+ * in the last SAMPLEREFRESH seconds. The new sample is added to the fields
+ * that were sampled before. Only done when reading commands from a terminal.
+ */
+static void
+prefetchfields(const path_t *ns)
+{
+	struct nsschema *e;
+	time_t now;
 
-	if (count == -1) {
-		warnx("count failed: %d.%d %s: %s", error.domain, error.code,
-		    error.message, tmpdocs);
-		return -1;
-	}
+	if (!ttyin || import)
+		return;
 
-	printf("%ld\n", count);
+	if (prefetchstart() == -1)
+		return;
 
-	return 0;
+	pthread_mutex_lock(&nsmtx);
+	now = time(NULL);
+	e = findschema(ns);
+	if (e == NULL || now < e->sampled || now - e->sampled >= SAMPLEREFRESH)
+		prefetchqueue(ns);
+	pthread_mutex_unlock(&nsmtx);
 }
 
 /*
- * Parse update command, expect two json objects, a selector, and an update
- * doc.
+ * Set "idx" to a sorted list with at least the names of the collections in
+ * "dbname", or of the databases if "dbname" is NULL, that start with "prefix".
+ * The names are only fetched from the server if they are not cached or if they
+ * expired, and then only the ones that start with "prefix". If all names are
+ * being fetched in the background, wait at most PREFETCHWAIT milliseconds for
+ * the result.
+ *
+ * Return 0 on success with nsmtx held, "idx" is valid until it is released.
+ * Return -1 on failure.
  */
 static int
-exec_update(mongoc_collection_t *collection, const char *line, size_t linelen,
-    int upsert)
+locknames(const char *dbname, const char *prefix, struct pmindex *idx)
 {
-	uint8_t update_docs[MAXDOC];
-	uint8_t *update_doc = update_docs;
+	path_t job = { "", "" };
+	mongoc_client_t *c;
 	bson_error_t error;
-	bson_t *query, *update, *opts;
-	int offset;
+	char **names, **strv;
+	unsigned long gen;
 
-	opts = NULL;
-	if (upsert)
-		opts = bsonupsertopt;
+	if (dbname != NULL)
+		strlcpy(job.dbname, dbname, sizeof(job.dbname));
 
-	/* expect two json objects */
-	offset = parse_selector(tmpdocs, sizeof(tmpdocs), line, linelen);
-	if (offset <= 0)
-		return -1;
+	pthread_mutex_lock(&nsmtx);
 
-	line += offset;
-	linelen -= offset;
+	prefetchwait(&job);
 
-	offset = relaxed_to_strict((char *)update_doc, MAXDOC, line, linelen,
-	    1);
-	if (offset <= 0) {
-		warnx("could not parse update doc: %s", line);
-		return -1;
+	names = nscache_get(&nscache, job.dbname, prefix, time(NULL), &idx->n);
+	if (names != NULL) {
+		idx->v = (const char **)names;
+		return 0;
 	}
 
-	line += offset;
-	linelen -= offset;
+	gen = nsgen;
+	pthread_mutex_unlock(&nsmtx);
 
-	if ((query = bson_new_from_json(tmpdocs, -1, &error)) == NULL) {
-		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
-		    tmpdocs);
+	if ((c = getclient()) == NULL)
 		return -1;
-	}
 
-	if ((update = bson_new_from_json(update_doc, -1, &error)) == NULL) {
-		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
-		    update_doc);
-		goto cleanuperr;
+	if ((strv = fetchnames(c, job.dbname, prefix, &error)) == NULL) {
+		warnx("could not get %s names: %d.%d %s",
+		    dbname == NULL ? "database" : "collection", error.domain,
+		    error.code, error.message);
+		return -1;
 	}
 
-	if (!mongoc_collection_update_many(collection, query, update, opts,
-	    NULL, &error)) {
-		warnx("update failed: %d.%d %s: %s %s", error.domain,
-		    error.code, error.message, tmpdocs, update_doc);
-		goto cleanuperr;
-	}
+	pthread_mutex_lock(&nsmtx);
+	storenames(job.dbname, prefix, strv, gen);
+	bson_strfreev(strv);
 
-	bson_destroy(query);
-	bson_destroy(update);
+	names = nscache_get(&nscache, job.dbname, prefix, time(NULL), &idx->n);
+	if (names == NULL) {
+		pthread_mutex_unlock(&nsmtx);
+		return -1;
+	}
+	idx->v = (const char **)names;
 
 	return 0;
+}
 
-cleanuperr:
-	bson_destroy(query);
-	bson_destroy(update);
+/*
+ * Return whether "name" is in the sorted list of "n" names.
+ */
+static int
+hasname(char **names, size_t n, const char *name)
+{
+	struct pmindex idx;
+	size_t first;
 
-	return -1;
+	idx.v = (const char **)names;
+	idx.n = n;
+
+	return pmindex_range(&idx, name, &first) > 0 &&
+	    strcmp(names[first], name) == 0;
 }
 
-/* parse insert command, expect one json object, the insert doc and exec */
-static int
-exec_insert(mongoc_collection_t *collection, const char *line, size_t linelen)
+/*
+ * Invalidate the cached names that do not include "dbname" or "collname",
+ * because the namespace was just created or the cache is stale.
+ */
+static void
+touchns(const char *dbname, const char *collname)
 {
-	bson_error_t error;
-	bson_t *doc;
-	int offset;
+	char **names;
+	size_t n;
+	time_t now;
 
-	offset = parse_selector(tmpdocs, sizeof(tmpdocs), line, linelen);
-	if (offset <= 0)
-		return -1;
+	if (strlen(dbname) == 0)
+		return;
 
-	if ((doc = bson_new_from_json(tmpdocs, -1, &error)) == NULL) {
-		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
-		    tmpdocs);
-		return -1;
-	}
+	pthread_mutex_lock(&nsmtx);
+	now = time(NULL);
 
-	if (!mongoc_collection_insert_one(collection, doc, NULL, NULL, &error))
-	    {
-		warnx("insert failed: %d.%d %s: %s", error.domain, error.code,
-		    error.message, tmpdocs);
-		bson_destroy(doc);
-		return -1;
+	names = nscache_get(&nscache, "", dbname, now, &n);
+	if (names != NULL && !hasname(names, n, dbname)) {
+		nscache_invalidate(&nscache, "");
+		nsgen++;
 	}
 
-	bson_destroy(doc);
+	names = nscache_get(&nscache, dbname, collname, now, &n);
+	if (strlen(collname) > 0 && names != NULL &&
+	    !hasname(names, n, collname)) {
+		nscache_invalidate(&nscache, dbname);
+		nsgen++;
+	}
 
-	return 0;
+	pthread_mutex_unlock(&nsmtx);
 }
 
-/* parse remove command, expect one selector */
-static int
-exec_remove(mongoc_collection_t *collection, const char *line, size_t linelen)
+/*
+ * Read the namespace cache from "cachefile", if any. A missing file is not an
+ * error.
+ */
+static void
+cacheload(void)
 {
-	int offset;
-	bson_error_t error;
-	bson_t *selector;
-
-	offset = parse_selector(tmpdocs, sizeof(tmpdocs), line, linelen);
-	if (offset <= 0)
-		return -1;
+	FILE *fp;
 
-	if ((selector = bson_new_from_json(tmpdocs, -1, &error)) == NULL) {
-		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
-		    tmpdocs);
-		return -1;
-	}
+	if (cachefile == NULL)
+		return;
 
-	if (!mongoc_collection_delete_many(collection, selector, NULL, NULL,
-	    &error)) {
-		warnx("remove failed: %d.%d %s: %s", error.domain, error.code,
-		    error.message, tmpdocs);
-		bson_destroy(selector);
-		return -1;
+	if ((fp = fopen(cachefile, "r")) == NULL) {
+		if (errno != ENOENT)
+			warn("%s", cachefile);
+		return;
 	}
 
-	bson_destroy(selector);
+	if (nscache_load(&nscache, fp) == -1)
+		warnx("%s: ignoring malformed cache file", cachefile);
 
-	return 0;
+	fclose(fp);
 }
 
 /*
- * Execute an aggregation pipeline.
- *
- * Return 0 on success, -1 on failure.
+ * Atomically replace "cachefile", if any, with the namespace cache.
  */
-static int
-exec_agquery(mongoc_collection_t *collection, const char *line, size_t linelen)
+static void
+cachesave(void)
 {
-	bson_error_t error;
-	bson_t *aggr_query;
-	mongoc_cursor_t *cursor;
-	int rc;
+	char tmp[PATH_MAX];
+	FILE *fp;
+	int fd;
 
-	if (sizeof(tmpdocs) < 3)
-		abort();
+	if (cachefile == NULL)
+		return;
 
-	if (relaxed_to_strict((char *)tmpdocs, sizeof(tmpdocs), line, linelen,
-	    0) == -1) {
-		warnx("could not parse line as JSON object(s): %.*s",
-		    (int)linelen, line);
-		return -1;
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.XXXXXX", cachefile) >=
+	    sizeof(tmp)) {
+		warnx("%s: path too long", cachefile);
+		return;
 	}
 
-	/* default to all documents */
-	if (strlen((char *)tmpdocs) == 0) {
-		tmpdocs[0] = '[';
-		tmpdocs[1] = ']';
-		tmpdocs[2] = '\0';
+	if ((fd = mkstemp(tmp)) == -1) {
+		warn("%s", tmp);
+		return;
 	}
 
-	if ((aggr_query = bson_new_from_json(tmpdocs, -1, &error)) == NULL) {
-		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
-		    tmpdocs);
-		return -1;
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		warn("%s", tmp);
+		close(fd);
+		unlink(tmp);
+		return;
 	}
 
-	cursor = mongoc_collection_aggregate(collection, MONGOC_QUERY_NONE,
-	    aggr_query, NULL, NULL);
-
-	bson_destroy(aggr_query);
-
-	rc = printcursor(cursor);
-
-	mongoc_cursor_destroy(cursor);
-	cursor = NULL;
+	if (nscache_save(&nscache, fp) == -1 || fclose(fp) == EOF) {
+		warn("%s", tmp);
+		unlink(tmp);
+		return;
+	}
 
-	return rc;
+	if (rename(tmp, cachefile) == -1) {
+		warn("%s", cachefile);
+		unlink(tmp);
+	}
 }
 
 /*
- * Change database/collection.
+ * Complete a /database/collection path.
  *
- * Return 0 on success, -1 on failure.
+ * If more than one option matches the same prefix, all options are printed and
+ * the common prefix is completed. If exactly one component matches it is
+ * completed.
+ *
+ * Return 0 on success or -1 on failure.
  */
 static int
-exec_cd(const char *paths)
+complete_path(EditLine *e, const char *npath, size_t npathlen)
 {
-	char p1[PATH_MAX], p2[PATH_MAX];
 	path_t tmppath;
-	Tokenizer *t;
-	const char **av, *s;
-	path_t *ps;
-	int rc, ac;
+	struct pmindex idx;
+	char p[PATH_MAX], p2[PATH_MAX], lastchar;
+	int i, comps;
 	size_t n;
 
-	ps = NULL;
-
-	t = tok_init(NULL);
+	if (npathlen >= sizeof(p2)) {
+		warnx("complete_path p2 too small: %s", npath);
+		return -1;
+	}
 
-	rc = tok_str(t, paths, &ac, &av);
-	rc = test_tokresult(rc);
+	strncpy(p2, npath, npathlen);
+	p2[npathlen] = '\0';
 
-	if (rc == -1) /* assert message is printed by test_tokresult */
-		goto cleanup;
+	if (npathlen > 0) {
+		lastchar = p2[npathlen - 1];
+	} else {
+		lastchar = '\0';
+	}
+
+	/* copy current context */
+	if ((size_t)snprintf(p, sizeof(p), "/%s/%s", path.dbname, path.collname)
+	    >= sizeof(p)) {
+		warnx("complete_path p too small: %s", p2);
+		return -1;
+	}
+
+	n = resolvepath(p, sizeof(p), p2, &comps);
+	if (n == (size_t)-1) {
+		warnx("complete_path resolvepath error: %s", p2);
+		return -1;
+	}
+
+	if (parse_path(&tmppath, p) == -1) {
+		warnx("parse_path error: %s", p2);
+		abort();
+	}
+
+	if (comps > 1 || (comps == 1 && lastchar == '/') ||
+	    (comps == 1 && lastchar == '\0')) {
+		if (locknames(tmppath.dbname, tmppath.collname, &idx) == -1)
+			return -1;
+
+		i = complete_word(e, tmppath.collname, strlen(tmppath.collname),
+		    &idx, NULL);
+		pthread_mutex_unlock(&nsmtx);
+
+		if (i == 1 && lastchar != ' ' && lastchar != '\0')
+			el_insertstr(e, " ");
+	} else {
+		if (locknames(NULL, tmppath.dbname, &idx) == -1)
+			return -1;
+
+		i = complete_word(e, tmppath.dbname, strlen(tmppath.dbname),
+		    &idx, NULL);
+		pthread_mutex_unlock(&nsmtx);
+
+		/* append trailing "/" if word is completed or relative root */
+		if ((i == 1 && lastchar != '/') || (comps == 0 && lastchar != '/'))
+			el_insertstr(e, "/");
+	}
+
+	return 0;
+}
+
+/*
+ * Return whether "c" can be part of a field name without quotes.
+ */
+static int
+isfieldchar(char c)
+{
+	return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$' ||
+	    (unsigned char)c >= 0x80;
+}
+
+/*
+ * Print the field names "v" with the share of sampled documents that have the
+ * field and the types that were seen, followed by a newline.
+ */
+static void
+printfields(const struct schema *s, char **v)
+{
+	const struct schemafield *f;
+	const size_t ntypes = sizeof(typenames) / sizeof(typenames[0]);
+	size_t i, t, width;
+	int sep;
+
+	width = 0;
+	for (i = 0; v[i] != NULL; i++)
+		if (strlen(v[i]) > width)
+			width = strlen(v[i]);
+
+	printf("\n");
+	for (i = 0; v[i] != NULL; i++) {
+		printf("%-*s", (int)width, v[i]);
+
+		if ((f = schema_field(s, v[i])) != NULL && s->ndocs > 0) {
+			printf(" %3d%% ", (int)(f->count * 100 / s->ndocs));
+			sep = 0;
+			for (t = 0; t < ntypes; t++) {
+				if (f->types & (uint32_t)1 << t) {
+					printf("%s%s", sep ? "," : "",
+					    typenames[t]);
+					sep = 1;
+				}
+			}
+		}
+		printf("\n");
+	}
+}
+
+/*
+ * Complete the field name before the cursor if it is a key in the JSON
+ * arguments of a command, using the fields sampled from the current
+ * collection. Keys of nested documents are completed as full paths like in
+ * dot notation, since that is how they are written in queries and updates.
+ *
+ * Return 1 if the cursor is at a key, 0 if not.
+ */
+static int
+complete_field(EditLine *e)
+{
+	const LineInfo *li;
+	const char **matches;
+	const char *cmdend, *end, *p, *word;
+	char cmd[16], buf[MAXFIELDPATH], **v;
+	struct nsschema *ns;
+	size_t len, n;
+	int i, lcplen;
+
+	li = el_line(e);
+	end = li->cursor;
+
+	/* the cursor must be past a command that takes JSON arguments */
+	for (p = li->buffer; p < end && (*p == ' ' || *p == '\t'); p++)
+		;
+	for (n = 0; &p[n] < end && p[n] != ' ' && p[n] != '\t'; n++)
+		;
+	if (&p[n] == end || n == 0 || n >= sizeof(cmd))
+		return 0;
+	cmdend = &p[n];
+
+	memcpy(cmd, p, n);
+	cmd[n] = '\0';
+	if (prefix_match(&matches, cmds, cmd) == -1) {
+		warn("complete_field prefix_match");
+		return 0;
+	}
+	i = matches[0] != NULL && matches[1] == NULL;
+	if (i) {
+		i = 0;
+		for (n = 0; jsoncmds[n] != NULL; n++)
+			if (strcmp(matches[0], jsoncmds[n]) == 0)
+				i = 1;
+	}
+	free(matches);
+	if (!i)
+		return 0;
+
+	/* a key follows "{" or "," and may be quoted */
+	for (word = end; word > cmdend && isfieldchar(word[-1]); word--)
+		;
+	p = word;
+	if (p > cmdend && (p[-1] == '"' || p[-1] == '\''))
+		p--;
+	while (p > cmdend && (p[-1] == ' ' || p[-1] == '\t'))
+		p--;
+	if (p == cmdend || (p[-1] != '{' && p[-1] != ','))
+		return 0;
+
+	/* leave operators alone */
+	len = end - word;
+	if (len >= sizeof(buf) || (len > 0 && *word == '$'))
+		return 1;
+
+	if (strlen(path.collname) == 0)
+		return 1;
+
+	memcpy(buf, word, len);
+	buf[len] = '\0';
+
+	pthread_mutex_lock(&nsmtx);
+
+	prefetchwait(&path);
+
+	v = NULL;
+	if ((ns = findschema(&path)) != NULL) {
+		if ((v = schema_complete(&ns->schema, buf)) == NULL)
+			warn("schema_complete");
+		else if (v[0] != NULL && v[1] != NULL)
+			printfields(&ns->schema, v);
+	}
+
+	pthread_mutex_unlock(&nsmtx);
+
+	/* sample again if the fields are missing or old */
+	prefetchfields(&path);
+
+	if (v == NULL)
+		return 1;
+
+	if (v[0] != NULL) {
+		/* zip up */
+		lcplen = common_prefix((const char **)v);
+		if (lcplen > 0 && (size_t)lcplen > len) {
+			memcpy(buf, &v[0][len], lcplen - len);
+			buf[lcplen - len] = '\0';
+			el_insertstr(e, buf);
+		}
+	}
+
+	schema_freev(v);
+
+	return 1;
+}
+
+/*
+ * Tab complete commands and path arguments.
+ *
+ * if empty, print all commands
+ * if matches more than one command, print all with matching prefix
+ * if matches exactly one command and not complete, complete
+ * if command is complete and needs args, look at that
+ */
+static unsigned char
+complete(EditLine *e, __attribute__((unused)) int ch)
+{
+	Tokenizer *t;
+	const char **av;
+	int i, rc, ac, cc, co;
+
+	/* before tokenizing, JSON may contain unmatched quotes */
+	if (complete_field(e))
+		return CC_REDISPLAY;
+
+	t = tok_init(NULL);
+	rc = tok_line(t, el_line(e), &ac, &av, &cc, &co);
+	rc = test_tokresult(rc);
+
+	if (rc == -1) {
+		rc = CC_ERROR;
+		goto cleanup;
+	}
+
+	if (ac == 0) {
+		printf("\n");
+		for (i = 0; cmds[i] != NULL; i++)
+			printf("%s\n", cmds[i]);
+
+		rc = CC_REDISPLAY;
+		goto cleanup;
+	}
+
+	/*
+	 * If the first word is currently selected, try to complete as a
+	 * command, if the second word is selected and the command (first word)
+	 * supports a path argument, try to complete as a path.
+	 */
+	if (cc == 0) {
+		/* append trailing " " if command is complete(d) */
+		i = complete_word(e, av[cc], co, &cmdindex, NULL);
+		if (i == 1)
+			el_insertstr(e, " ");
+
+		rc = CC_REDISPLAY;
+	} else if (cc >= 1) {
+		if (strcmp(av[0], "cd") == 0 || strcmp(av[0], "ls") == 0 ||
+		    strcmp(av[0], "drop") == 0) {
+			if (complete_path(e, av[cc], co) == -1) {
+				warnx("complete_path error");
+				goto cleanup;
+			}
+		}
+		rc = CC_REDISPLAY;
+	}
+
+cleanup:
+	tok_end(t);
+
+	return rc;
+}
+
+/*
+ * Find the next token starting at *line. *line is updated to point to the
+ * first non-whitespace character.
+ *
+ * Note: the separator is always an ASCII SPACE (0x20) or ASCII HTAB (0x09).
+ *
+ * Returns the number of bytes of the token starting at *line.
+ */
+static size_t
+nexttok(const char **line)
+{
+	*line = &(*line)[strspn(*line, " \t")];
+	return strcspn(*line, " \t");
+}
+
+/*
+ * Create a mongo extended JSON id selector document. If selector is 24 hex
+ * digits treat it as an object id, otherwise as a literal.
+ *
+ * dst     - resulting json doc is written to *dst, which is grown as needed
+ * dstsize - the size of *dst
+ * sel     - selector, must be NUL terminated
+ * sellen  - length of sel, excluding the terminating NUL character
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+idtosel(char **dst, size_t *dstsize, const char *sel, size_t sellen)
+{
+	const size_t oidlen = 24;
+	size_t n;
+
+	if (sellen < 1)
+		return -1;
+
+	if (growbuf(dst, dstsize, sellen + 32) == -1)
+		return -1;
+
+	/* if 24 hex chars, assume an object id otherwise treat as a literal */
+	if (sellen == oidlen && (strspn(sel, "0123456789abcdefABCDEF") ==
+	    oidlen)) {
+		n = snprintf(*dst, *dstsize,
+		    "{ \"_id\": { \"$oid\": \"%.*s\" } }", (int)oidlen, sel);
+		if (n >= *dstsize)
+			return -1;
+	} else {
+		n = snprintf(*dst, *dstsize, "{ \"_id\": \"%.*s\" }",
+		    (int)sellen, sel);
+		if (n >= *dstsize)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Parse the selector in line, that is the first (relaxed) json object or
+ * literal id. A strictly conforming JSON object is written in "*doc" on
+ * success. "*doc" is a buffer of "*docsize" bytes that is grown as needed.
+ *
+ * "line" must be null terminated and "linelen" must exclude the terminating
+ * null byte.
+ *
+ * Return the number of bytes parsed on success or -1 on failure.
+ * On success a null byte is always written to *doc.
+ */
+static int
+parse_selector(char **doc, size_t *docsize, const char *line, size_t linelen)
+{
+	const char *id;
+	size_t n, idlen;
+	int offset;
+
+	/*
+	 * If the first non-blank char is a "{" then try to parse it as a
+	 * relaxed JSON object. Otherwise try to parse it as a literal and
+	 * convert to an id selector.
+         */
+	n = strspn(line, " \t");
+	if (line[n] == '{') {
+		offset = relaxed_to_strict_alloc(doc, docsize, line, linelen,
+		    1);
+		if (offset == -1) {
+			warnx("could not parse line as JSON object(s): %.*s",
+			    (int)linelen, line);
+			return -1;
+		}
+
+		return offset;
+	}
+
+	id = line + n;
+
+	if (id[0] == '"') {
+		id++;
+		idlen = strcspn(id, "\"");
+
+		if (idlen == 0) {
+			warnx("could not parse selector as double quoted id: "
+			    "\"%.*s\"", (int)linelen, line);
+			return -1;
+		}
+	} else if (id[0] == '\'') {
+		id++;
+		idlen = strcspn(id, "'");
+
+		if (idlen == 0) {
+			warnx("could not parse selector as single quoted id: "
+			    "\"%.*s\"", (int)linelen, line);
+			return -1;
+		}
+	} else {
+		idlen = strcspn(id, " \t");
+
+		if (idlen == 0) {
+			if (growbuf(doc, docsize, 1) == -1) {
+				warn("parse_selector");
+				return -1;
+			}
+			(*doc)[0] = '\0';
+
+			return 0;
+		}
+	}
+
+	if (idtosel(doc, docsize, id, idlen) == -1) {
+		warnx("could not parse selector as an id: \"%.*s\"", (int)idlen,
+		    id);
+		return -1;
+	}
+
+	return (id - line) + idlen;
+}
+
+static char *
+prompt(void)
+{
+	if (contline)
+		return "... ";
+
+	return pmpt;
+}
+
+/*
+ * Determine whether "line" is a command with a JSON argument that is not
+ * closed yet, in which case the next line of input is a continuation of it.
+ *
+ * Return 1 if more lines are needed, 0 if not.
+ */
+static int
+needsmore(const char *line)
+{
+	struct jsonstream js;
+	const char **matches, *obj;
+	char *cmd;
+	size_t n, objlen;
+	int r, i, bench;
+
+	n = nexttok(&line);
+	if (n == 0)
+		return 0;
+
+	if ((cmd = strndup(line, n)) == NULL)
+		err(1, "needsmore strndup");
+
+	if (prefix_match(&matches, cmds, cmd) == -1)
+		err(1, "needsmore prefix_match");
+	free(cmd);
+
+	r = 0;
+	bench = 0;
+	if (matches[0] != NULL && matches[1] == NULL) {
+		for (i = 0; jsoncmds[i] != NULL; i++)
+			if (strcmp(matches[0], jsoncmds[i]) == 0)
+				r = 1;
+		bench = strcmp(matches[0], "bench") == 0;
+	}
+	free(matches);
+
+	if (r == 0)
+		return 0;
+
+	line += n;
+
+	/* the document of bench follows its mode and options */
+	if (bench)
+		while ((n = nexttok(&line)) > 0 && *line != '{')
+			line += n;
+
+	jsonstream_init(&js);
+	if (jsonstream_feed(&js, line, strlen(line)) == -1)
+		err(1, "needsmore jsonstream_feed");
+
+	while ((r = jsonstream_next(&js, &obj, &objlen)) == 1)
+		;
+
+	r = r == 0 && jsonstream_pending(&js);
+	jsonstream_free(&js);
+
+	return r;
+}
+
+/*
+ * Update the prompt with the given dbname and collname. If the prompt exceeds
+ * MAXPROMPTCOLUMNS than shorten the dbname and collname.
+ *
+ * The following cases can arise:
+ * 1. dbname and collname are NULL, then prompt will be "/> "
+ * 2. dbname is not NULL and collname is NULL:
+ *   a. if columns("/> ") + columns(dbname) is <= MAXPROMPTCOLUMNS
+ *      then the prompt will be "/dbname> "
+ *   b. if columns("/> ") + columns(dbname) is > MAXPROMPTCOLUMNS
+ *      then dbname will be shortened and the prompt will be "/db..me> "
+ * 3. dbname is not NULL and collname is not NULL:
+ *   a. if columns("//> ") + columns(dbname) + columns(collname) is <= MAXPROMPTCOLUMNS
+ *      then the prompt will be "/dbname/collname> "
+ *   b. if columns("//> ") + columns(dbname) + columns(collname) is > MAXPROMPTCOLUMNS
+ *      then dbname and collname will be shortened and the prompt will be
+ *      "/db..me/co..me> ".
+ */
+static int
+set_prompt(const char *dbname, size_t dbnamelen, const char *collname,
+    size_t collnamelen)
+{
+	char c1[sizeof(pmpt)], c2[sizeof(pmpt)];
+	size_t n;
+
+	if (dbnamelen == 0 && collnamelen == 0) {
+		if ((size_t)snprintf(pmpt, sizeof(pmpt), "/> ") >= sizeof(pmpt))
+			return -1;
+
+		return 0;
+	}
+
+	/* err if only collname is provided */
+	if (dbnamelen == 0)
+		return -1;
+
+	c1[0] = '\0';
+	c2[0] = '\0';
+
+	/* default to db only prompt */
+	n = strlen("/> ");
+
+	if (strlcpy(c1, dbname, sizeof(c1)) >= sizeof(c1))
+		return -1;
+
+	if (collnamelen > 0) {
+		/* make dbname + collname prompt */
+		n = strlen("//> ");
+		if (strlcpy(c2, collname, sizeof(c2)) >= sizeof(c2))
+			return -1;
+	}
+
+	if (shorten_comps(c1, c2, MAXPROMPTCOLUMNS - n) == (size_t)-1)
+		return -1;
+
+	if (collnamelen == 0) {
+		n = snprintf(pmpt, sizeof(pmpt), "/%s> ", c1);
+		if (n >= sizeof(pmpt))
+			return -1;
+	} else {
+		n = snprintf(pmpt, sizeof(pmpt), "/%s/%s> ", c1, c2);
+		if (n >= sizeof(pmpt))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Return the number of microseconds since *t and set *t to the current time.
+ */
+static int64_t
+lap(int64_t *t)
+{
+	int64_t prev;
+
+	prev = *t;
+	*t = bson_get_monotonic_time();
+
+	return *t - prev;
+}
+
+/*
+ * Check whether writing the output of the command failed. If the reader of a
+ * pipe on stdout went away, set outclosed so that mongovi stops and exits
+ * normally.
+ *
+ * Return 0 if the output is fine, -1 if not.
+ */
+static int
+checkout(void)
+{
+	if (!ferror(outfp))
+		return 0;
+
+	if (outfp == stdout && errno == EPIPE)
+		outclosed = 1;
+	else if (outfp == stdout)
+		warn("could not write to stdout");
+	else
+		warn("could not write to %s", curjob->file);
+
+	return -1;
+}
+
+/*
+ * Return whether the command in progress should stop, because of SIGINT or,
+ * in a background job, because the job is killed.
+ */
+static int
+stopped(void)
+{
+	int killed;
+
+	if (curjob == NULL)
+		return interrupted;
+
+	pthread_mutex_lock(&jobmtx);
+	killed = curjob->killed;
+	pthread_mutex_unlock(&jobmtx);
+
+	return killed;
+}
+
+/*
+ * Return the size of the batch that follows a batch of "batch" documents with
+ * an average size of "avg" bytes. Grow geometrically for few round trips, but
+ * not beyond what fits in a reply.
+ */
+static uint32_t
+nextbatch(uint32_t batch, uint64_t avg)
+{
+	uint64_t max;
+
+	max = MAXREPLY / (avg > 0 ? avg : 1);
+	if (max < 1)
+		max = 1;
+
+	if ((uint64_t)batch * 2 > max)
+		return max;
+
+	return batch * 2;
+}
+
+/*
+ * Print the documents of the pager. Stop after "max" documents, or after a
+ * screenful if "max" is 0, unless "max" is negative. Also stop early if stdout
+ * is closed.
+ *
+ * On a terminal every batch is small so that each screenful shows up fast.
+ * Otherwise every next batch is twice as big to save round trips.
+ *
+ * Return 1 if stopped after "max" documents or a screenful, 0 if the cursor is
+ * exhausted and -1 on failure.
+ */
+static int
+printcursor(long max)
+{
+	mongoc_cursor_t *cursor;
+	bson_error_t error;
+	size_t rlen;
+	const bson_t *doc;
+	const char *cp;
+	char *str;
+	struct winsize w;
+	long ndocs, nlines, rows;
+	int64_t t, d;
+
+	cursor = pager.cursor;
+
+	w.ws_row = 0;
+	w.ws_col = 0;
+	if (ttyout && curjob == NULL) {
+		if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == -1)
+			warn("could not determine window size: %d %d", w.ws_row,
+			    w.ws_col);
+	}
+
+	/* leave room for the prompt */
+	rows = w.ws_row > 2 ? w.ws_row - 2 : 22;
+
+	ndocs = 0;
+	nlines = 0;
+
+	t = bson_get_monotonic_time();
+	while (!stopped() && mongoc_cursor_next(cursor, &doc)) {
+		d = lap(&t);
+		timing.server += d;
+		if (timing.docs == 0)
+			timing.first = d;
+		timing.docs++;
+		timing.bytes += doc->len;
+
+		pager.docs++;
+		pager.bytes += doc->len;
+
+		/* the next call fetches a new batch */
+		if (++pager.inbatch == pager.batch) {
+			if (!ttyout || curjob != NULL) {
+				pager.batch = nextbatch(pager.batch,
+				    pager.bytes / pager.docs);
+				mongoc_cursor_set_batch_size(cursor,
+				    pager.batch);
+			}
+			pager.inbatch = 0;
+		}
+
+		if (hr) {
+			str = bson_as_relaxed_extended_json(doc, &rlen);
+		} else {
+			str = bson_as_canonical_extended_json(doc, &rlen);
+		}
+
+		cp = str;
+		if (hr && rlen > w.ws_col) {
+			if (human_readable_alloc(&tmpdocs, &tmpdocssize, str,
+			    rlen) == -1) {
+				warnx("could not make human readable JSON "
+				    "string");
+				bson_free(str);
+
+				return -1;
+			}
+			cp = tmpdocs;
+		}
+		fprintf(outfp, "%s\n", cp);
+
+		if (max == 0)
+			for (nlines++; (cp = strchr(cp, '\n')) != NULL; cp++)
+				nlines++;
+
+		bson_free(str);
+
+		timing.print += lap(&t);
+
+		/* the caller destroys the cursor, which kills it on the server */
+		if (checkout() == -1)
+			return -1;
+
+		if ((max > 0 && ++ndocs >= max) || (max == 0 && nlines >= rows))
+			return 1;
+	}
+	timing.server += lap(&t);
+
+	/* the caller destroys the cursor, which kills it on the server */
+	if (stopped()) {
+		warnx("interrupted");
+		return -1;
+	}
+
+	if (mongoc_cursor_error(cursor, &error)) {
+		warnx("cursor failed: %d.%d %s", error.domain, error.code,
+		    error.message);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Destroy the cursor of the pager, if any, which kills it on the server if it
+ * is not exhausted.
+ */
+static void
+pagerclose(void)
+{
+	if (pager.cursor != NULL)
+		mongoc_cursor_destroy(pager.cursor);
+
+	memset(&pager, 0, sizeof(pager));
+}
+
+/*
+ * Print the next page of the pager, or all documents if not interactive, and
+ * close the pager unless there are more documents.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+pagernext(long max)
+{
+	int rc;
+
+	if (!ttyin || !ttyout || curjob != NULL)
+		max = -1;
+
+	rc = printcursor(max);
+
+	if (rc == 1 && mongoc_cursor_more(pager.cursor)) {
+		printf("Type \"more\" for more\n");
+		return 0;
+	}
+
+	pagerclose();
+
+	return rc == -1 ? -1 : 0;
+}
+
+/*
+ * Replace the cursor of the pager with "cursor" and print the first page. The
+ * comment of the operation in progress is kept for killops.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+pagerstart(mongoc_cursor_t *cursor)
+{
+	pagerclose();
+
+	pager.cursor = cursor;
+	pager.batch = ttyout && curjob == NULL ? FIRSTBATCHTTY : FIRSTBATCH;
+	mongoc_cursor_set_batch_size(cursor, pager.batch);
+
+	pthread_mutex_lock(&opmtx);
+	memcpy(pager.comment, opcur, sizeof(pager.comment));
+	pthread_mutex_unlock(&opmtx);
+
+	return pagernext(0);
+}
+
+/*
+ * List database for the given client.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_lsdbs(mongoc_client_t *client)
+{
+	bson_error_t error;
+	char **strv;
+	int64_t t;
+	int i;
+
+	t = bson_get_monotonic_time();
+	strv = fetchnames(client, "", "", &error);
+	timing.server += lap(&t);
+	if (strv == NULL) {
+		warnx("could not get database names: %d.%d %s", error.domain,
+		    error.code, error.message);
+		return -1;
+	}
+
+	for (i = 0; strv[i] != NULL; i++)
+		printf("%s\n", strv[i]);
+
+	pthread_mutex_lock(&nsmtx);
+	storenames("", "", strv, nsgen);
+	pthread_mutex_unlock(&nsmtx);
+
+	bson_strfreev(strv);
+	strv = NULL;
+
+	return 0;
+}
+
+/*
+ * List collections for the given database.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_lscolls(mongoc_client_t *client, char *dbname)
+{
+	bson_error_t error;
+	char **strv;
+	int64_t t;
+	int i;
+
+	t = bson_get_monotonic_time();
+	strv = fetchnames(client, dbname, "", &error);
+	timing.server += lap(&t);
+	if (strv == NULL) {
+		warnx("could not get collection names: %d.%d %s", error.domain,
+		    error.code, error.message);
+		return -1;
+	}
+
+	for (i = 0; strv[i] != NULL; i++)
+		printf("%s\n", strv[i]);
+
+	pthread_mutex_lock(&nsmtx);
+	storenames(dbname, "", strv, nsgen);
+	pthread_mutex_unlock(&nsmtx);
+
+	bson_strfreev(strv);
+	strv = NULL;
+
+	return 0;
+}
+
+/*
+ * Parse write error "it" of a bulk write into the index of the failed
+ * operation, the error code and the message.
+ *
+ * Return 0 on success, -1 if "it" is not a write error.
+ */
+static int
+parsewriteerror(const bson_iter_t *it, int64_t *idx, int64_t *code,
+    const char **msg)
+{
+	bson_iter_t we;
+	const char *key;
+
+	if (!BSON_ITER_HOLDS_DOCUMENT(it) || !bson_iter_recurse(it, &we))
+		return -1;
+
+	*idx = -1;
+	*code = 0;
+	*msg = "";
+	while (bson_iter_next(&we)) {
+		key = bson_iter_key(&we);
+		if (strcmp(key, "index") == 0)
+			*idx = bson_iter_as_int64(&we);
+		else if (strcmp(key, "code") == 0)
+			*code = bson_iter_as_int64(&we);
+		else if (strcmp(key, "errmsg") == 0 &&
+		    BSON_ITER_HOLDS_UTF8(&we))
+			*msg = bson_iter_utf8(&we, NULL);
+	}
+
+	return *idx < 0 ? -1 : 0;
+}
+
+/*
+ * Print write error "it" of a bulk insert of the queued inserts together with
+ * the document it refers to.
+ */
+static void
+printwriteerror(const bson_iter_t *it, uint32_t domain)
+{
+	const char *msg;
+	char *json;
+	int64_t idx, code;
+
+	if (parsewriteerror(it, &idx, &code, &msg) == -1 ||
+	    (uint64_t)idx >= insertq.n)
+		return;
+
+	json = bson_as_relaxed_extended_json(insertq.docs[idx], NULL);
+	warnx("insert failed: %d.%d %s: %s", (int)domain, (int)code, msg,
+	    json != NULL ? json : "");
+	bson_free(json);
+}
+
+/*
+ * Send the queued inserts, if any, in one unordered bulk insert so that one
+ * failed document does not stop the others, like separate inserts. Each failed
+ * document is reported separately.
+ *
+ * Return 0 on success, -1 if any document could not be inserted.
+ */
+static int
+flushinserts(void)
+{
+	bson_t opts = BSON_INITIALIZER, reply;
+	bson_error_t error;
+	bson_iter_t it, errs;
+	size_t i;
+	int64_t t;
+	int rc;
+
+	if (insertq.n == 0)
+		return 0;
+
+	BSON_APPEND_BOOL(&opts, "ordered", false);
+
+	rc = 0;
+	t = bson_get_monotonic_time();
+	if (!mongoc_collection_insert_many(insertq.coll,
+	    (const bson_t **)insertq.docs, insertq.n, &opts, &reply, &error)) {
+		rc = -1;
+
+		if (bson_iter_init_find(&it, &reply, "writeErrors") &&
+		    BSON_ITER_HOLDS_ARRAY(&it) &&
+		    bson_iter_recurse(&it, &errs)) {
+			while (bson_iter_next(&errs))
+				printwriteerror(&errs, error.domain);
+		} else {
+			warnx("insert of %zu documents failed: %d.%d %s",
+			    insertq.n, error.domain, error.code, error.message);
+		}
+	}
+	timing.server += lap(&t);
+
+	for (i = 0; i < insertq.n; i++)
+		bson_destroy(insertq.docs[i]);
+	insertq.n = 0;
+	insertq.bytes = 0;
+	insertq.coll = NULL;
+
+	bson_destroy(&reply);
+	bson_destroy(&opts);
+
+	return rc;
+}
+
+/*
+ * Queue "doc" for insertion into "coll" and take ownership of it. The queue is
+ * sent when it is full, when the first document waited long enough, before any
+ * other command and before the script waits for more input.
+ *
+ * Return 0 on success, -1 if sending the queue failed.
+ */
+static int
+queueinsert(mongoc_collection_t *coll, bson_t *doc)
+{
+	int rc;
+
+	rc = 0;
+	if (insertq.n > 0 && insertq.coll != coll)
+		rc = flushinserts();
+
+	if (insertq.n == 0) {
+		insertq.coll = coll;
+		insertq.first = bson_get_monotonic_time();
+	}
+
+	insertq.docs[insertq.n++] = doc;
+	insertq.bytes += doc->len;
+
+	if (insertq.n == INSERTQMAX || insertq.bytes >= INSERTQBYTES ||
+	    bson_get_monotonic_time() - insertq.first >= INSERTQWAIT)
+		if (flushinserts() == -1)
+			rc = -1;
+
+	return rc;
+}
+
+/*
+ * Make room for one more command in the bulk write.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+bulkgrow(void)
+{
+	char **cmds;
+	size_t size;
+
+	if (bulk.n < bulk.size)
+		return 0;
+
+	size = bulk.size == 0 ? 64 : bulk.size * 2;
+	if ((cmds = reallocarray(bulk.cmds, size, sizeof(*cmds))) == NULL) {
+		warn("could not queue command in bulk write");
+		return -1;
+	}
+
+	bulk.cmds = cmds;
+	bulk.size = size;
+
+	return 0;
+}
+
+/*
+ * Remember command "cmd" with the JSON documents "doc1" and optionally "doc2"
+ * that was just added to the bulk write. Only used for error messages, so a
+ * failed allocation leaves an empty entry.
+ */
+static void
+bulkrecord(const char *cmd, const char *doc1, const char *doc2)
+{
+	char *s;
+	size_t n;
+
+	if (doc2 == NULL)
+		doc2 = "";
+
+	n = strlen(cmd) + 1 + strlen(doc1) + 1 + strlen(doc2) + 1;
+	if ((s = malloc(n)) != NULL)
+		snprintf(s, n, "%s %s %s", cmd, doc1, doc2);
+
+	bulk.cmds[bulk.n++] = s;
+}
+
+/*
+ * Release the bulk write and the commands in it without executing it.
+ */
+static void
+bulkfree(void)
+{
+	size_t i;
+
+	for (i = 0; i < bulk.n; i++)
+		free(bulk.cmds[i]);
+	free(bulk.cmds);
+	bulk.cmds = NULL;
+	bulk.n = 0;
+	bulk.size = 0;
+
+	mongoc_bulk_operation_destroy(bulk.op);
+	bulk.op = NULL;
+}
+
+/*
+ * Discard a bulk write that was begun but never committed, if any.
+ *
+ * Return 0 if there was none, -1 if one was discarded.
+ */
+static int
+dropbulk(void)
+{
+	if (bulk.op == NULL)
+		return 0;
+
+	warnx("bulk write of %zu commands not committed", bulk.n);
+	bulkfree();
+
+	return -1;
+}
+
+/*
+ * Change dbname and/or collname, reset ccoll and update prompt.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_chcoll(const path_t newpath)
+{
+	size_t dbnamelen, collnamelen;
+
+	if (strcmp(newpath.dbname, path.dbname) == 0 &&
+	    strcmp(newpath.collname, path.collname) == 0) {
+		return 0;
+	}
+
+	/* the queue refers to ccoll */
+	flushinserts();
+
+	if (ccoll != NULL) {
+		mongoc_collection_destroy(ccoll);
+		ccoll = NULL;
+	}
+
+	dbnamelen = strlen(newpath.dbname);
+	collnamelen = strlen(newpath.collname);
+
+	if (dbnamelen == 0 && collnamelen > 0) {
+		warnx("can't change collection because no db is set");
+		return -1;
+	}
+
+	if (set_prompt(newpath.dbname, dbnamelen, newpath.collname, collnamelen)
+	    == -1)
+		warnx("can't update prompt with db and collection name");
+
+	if (homepathset == 0 && dbnamelen > 0) {
+		homepath = newpath;
+		homepathset = 1;
+	}
+
+	prevpath = path;
+	path = newpath;
+
+	touchns(path.dbname, path.collname);
+
+	/* make the first tab in the new database fast */
+	prefetch(dbnamelen > 0 ? path.dbname : NULL);
+	if (collnamelen > 0)
+		prefetchfields(&path);
+
+	return 0;
+}
+
+/*
+ * Initialize "opts" with the options in "base", if not NULL. When SIGINT is
+ * handled or in a background job, also add a unique comment that identifies
+ * the operation on the server so that it can be killed, see killops. Release
+ * with endop.
+ */
+static void
+beginop(bson_t *opts, const bson_t *base)
+{
+	static unsigned long seq;
+
+	bson_init(opts);
+	if (base != NULL)
+		bson_concat(opts, base);
+
+	if (intrpipe[1] == -1 && curjob == NULL)
+		return;
+
+	pthread_mutex_lock(&opmtx);
+	snprintf(opcur, sizeof(opcomment), "mongovi %ld %lu",
+	    (long)getpid(), ++seq);
+	BSON_APPEND_UTF8(opts, "comment", opcur);
+	pthread_mutex_unlock(&opmtx);
+}
+
+/*
+ * Set the comment of the operation in progress.
+ */
+static void
+setop(const char *comment)
+{
+	pthread_mutex_lock(&opmtx);
+	snprintf(opcur, sizeof(opcomment), "%s", comment);
+	pthread_mutex_unlock(&opmtx);
+}
+
+static void
+endop(bson_t *opts)
+{
+	setop("");
+	bson_destroy(opts);
+}
+
+/*
+ * Print the next "n" documents of the last find or aggregate, or the next
+ * screenful if "line" is empty.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_more(const char *line)
+{
+	const char *arg;
+	char *end;
+	size_t arglen;
+	long n;
+	int rc;
+
+	if (pager.cursor == NULL) {
+		warnx("no more documents");
+		return -1;
+	}
+
+	n = 0;
+	arg = line;
+	if ((arglen = nexttok(&arg)) > 0) {
+		errno = 0;
+		n = strtol(arg, &end, 10);
+		if (errno != 0 || end != arg + arglen || n < 1) {
+			warnx("usage: more [n]");
+			return -1;
+		}
+	}
+
+	setop(pager.comment);
+	rc = pagernext(n);
+	setop("");
+
+	return rc;
+}
+
+/*
+ * Execute a query.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_query(mongoc_collection_t *collection, const char *line, size_t linelen,
+   int idsonly)
+{
+	mongoc_cursor_t *cursor;
+	bson_error_t error;
+	bson_t *query, opts;
+	int64_t t;
+	int rc;
+
+	t = bson_get_monotonic_time();
+
+	if (parse_selector(&tmpdocs, &tmpdocssize, line, linelen) == -1)
+		return -1;
+
+	/* default to all documents */
+	if (strlen(tmpdocs) == 0) {
+		if (growbuf(&tmpdocs, &tmpdocssize, 3) == -1) {
+			warn("default selector");
+			return -1;
+		}
+		tmpdocs[0] = '{';
+		tmpdocs[1] = '}';
+		tmpdocs[2] = '\0';
+	}
+
+	if ((query = bson_new_from_json((uint8_t *)tmpdocs, -1, &error)) ==
+	    NULL) {
+		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
+		    tmpdocs);
+		return -1;
+	}
+
+	timing.parse += lap(&t);
+
+	beginop(&opts, idsonly ? bsonprojectid : NULL);
+
+	cursor = mongoc_collection_find_with_opts(collection, query, &opts,
+	    NULL);
+
+	bson_destroy(query);
+
+	rc = pagerstart(cursor);
+	cursor = NULL;
+
+	endop(&opts);
+
+	return rc;
+}
+
+/*
+ * Count number of documents in collection.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_count(mongoc_collection_t *collection, const char *line, size_t linelen)
+{
+	bson_error_t error;
+	bson_t *query, opts;
+	int64_t count, t;
+
+	t = bson_get_monotonic_time();
+
+	if (parse_selector(&tmpdocs, &tmpdocssize, line, linelen) == -1)
+		return -1;
+
+	/* default to all documents */
+	if (strlen(tmpdocs) == 0) {
+		if (growbuf(&tmpdocs, &tmpdocssize, 3) == -1) {
+			warn("default selector");
+			return -1;
+		}
+		tmpdocs[0] = '{';
+		tmpdocs[1] = '}';
+		tmpdocs[2] = '\0';
+	}
+
+	if ((query = bson_new_from_json((uint8_t *)tmpdocs, -1, &error)) ==
+	    NULL) {
+		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
+		    tmpdocs);
+		return -1;
+	}
+
+	timing.parse += lap(&t);
+
+	beginop(&opts, NULL);
+
+	count = mongoc_collection_count_documents(collection, query, &opts,
+	    NULL, NULL, &error);
+
+	timing.server += lap(&t);
+
+	endop(&opts);
+	bson_destroy(query);
+
+	if (count == -1) {
+		warnx("count failed: %d.%d %s: %s", error.domain, error.code,
+		    error.message, tmpdocs);
+		return -1;
+	}
+
+	fprintf(outfp, "%ld\n", count);
+
+	return 0;
+}
+
+/*
+ * Parse update command, expect two json objects, a selector, and an update
+ * doc.
+ */
+static int
+exec_update(mongoc_collection_t *collection, const char *line, size_t linelen,
+    int upsert)
+{
+	bson_error_t error;
+	bson_t *query, *update, *opts;
+	int64_t t;
+	int offset;
+
+	t = bson_get_monotonic_time();
+
+	opts = NULL;
+	if (upsert)
+		opts = bsonupsertopt;
+
+	/* expect two json objects */
+	offset = parse_selector(&tmpdocs, &tmpdocssize, line, linelen);
+	if (offset <= 0)
+		return -1;
+
+	line += offset;
+	linelen -= offset;
+
+	offset = relaxed_to_strict_alloc(&updatedoc, &updatedocsize, line,
+	    linelen, 1);
+	if (offset <= 0) {
+		warnx("could not parse update doc: %s", line);
+		return -1;
+	}
+
+	line += offset;
+	linelen -= offset;
+
+	if ((query = bson_new_from_json((uint8_t *)tmpdocs, -1, &error)) ==
+	    NULL) {
+		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
+		    tmpdocs);
+		return -1;
+	}
+
+	if ((update = bson_new_from_json((uint8_t *)updatedoc, -1, &error)) ==
+	    NULL) {
+		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
+		    updatedoc);
+		goto cleanuperr;
+	}
+
+	timing.parse += lap(&t);
+
+	if (bulk.op != NULL) {
+		if (bulkgrow() == -1)
+			goto cleanuperr;
+
+		if (!mongoc_bulk_operation_update_many_with_opts(bulk.op, query,
+		    update, opts, &error)) {
+			warnx("update failed: %d.%d %s: %s %s", error.domain,
+			    error.code, error.message, tmpdocs, updatedoc);
+			goto cleanuperr;
+		}
+
+		bulkrecord(upsert ? "upsert" : "update", tmpdocs, updatedoc);
+		goto cleanup;
+	}
+
+	if (!mongoc_collection_update_many(collection, query, update, opts,
+	    NULL, &error)) {
+		timing.server += lap(&t);
+		warnx("update failed: %d.%d %s: %s %s", error.domain,
+		    error.code, error.message, tmpdocs, updatedoc);
+		goto cleanuperr;
+	}
+
+	timing.server += lap(&t);
+
+cleanup:
+	bson_destroy(query);
+	bson_destroy(update);
+
+	return 0;
+
+cleanuperr:
+	bson_destroy(query);
+	bson_destroy(update);
+
+	return -1;
+}
+
+/* parse insert command, expect one json object, the insert doc and exec */
+static int
+exec_insert(mongoc_collection_t *collection, const char *line, size_t linelen)
+{
+	bson_error_t error;
+	bson_t *doc;
+	int64_t t;
+	int offset;
+
+	t = bson_get_monotonic_time();
+
+	offset = parse_selector(&tmpdocs, &tmpdocssize, line, linelen);
+	if (offset <= 0)
+		return -1;
+
+	if ((doc = bson_new_from_json((uint8_t *)tmpdocs, -1, &error)) == NULL) {
+		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
+		    tmpdocs);
+		return -1;
+	}
+
+	timing.parse += lap(&t);
+
+	if (bulk.op != NULL) {
+		if (bulkgrow() == -1) {
+			bson_destroy(doc);
+			return -1;
+		}
+
+		if (!mongoc_bulk_operation_insert_with_opts(bulk.op, doc, NULL,
+		    &error)) {
+			warnx("insert failed: %d.%d %s: %s", error.domain,
+			    error.code, error.message, tmpdocs);
+			bson_destroy(doc);
+			return -1;
+		}
+
+		bulkrecord("insert", tmpdocs, NULL);
+		bson_destroy(doc);
+		return 0;
+	}
+
+	/* scripts send consecutive inserts at once */
+	if (!ttyin)
+		return queueinsert(collection, doc);
+
+	if (!mongoc_collection_insert_one(collection, doc, NULL, NULL, &error))
+	    {
+		timing.server += lap(&t);
+		warnx("insert failed: %d.%d %s: %s", error.domain, error.code,
+		    error.message, tmpdocs);
+		bson_destroy(doc);
+		return -1;
+	}
+
+	timing.server += lap(&t);
+
+	bson_destroy(doc);
+
+	return 0;
+}
+
+/* parse remove command, expect one selector */
+static int
+exec_remove(mongoc_collection_t *collection, const char *line, size_t linelen)
+{
+	int offset;
+	bson_error_t error;
+	bson_t *selector;
+	int64_t t;
+
+	t = bson_get_monotonic_time();
+
+	offset = parse_selector(&tmpdocs, &tmpdocssize, line, linelen);
+	if (offset <= 0)
+		return -1;
+
+	if ((selector = bson_new_from_json((uint8_t *)tmpdocs, -1, &error)) ==
+	    NULL) {
+		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
+		    tmpdocs);
+		return -1;
+	}
+
+	timing.parse += lap(&t);
+
+	if (bulk.op != NULL) {
+		if (bulkgrow() == -1) {
+			bson_destroy(selector);
+			return -1;
+		}
+
+		if (!mongoc_bulk_operation_remove_many_with_opts(bulk.op,
+		    selector, NULL, &error)) {
+			warnx("remove failed: %d.%d %s: %s", error.domain,
+			    error.code, error.message, tmpdocs);
+			bson_destroy(selector);
+			return -1;
+		}
+
+		bulkrecord("remove", tmpdocs, NULL);
+		bson_destroy(selector);
+		return 0;
+	}
+
+	if (!mongoc_collection_delete_many(collection, selector, NULL, NULL,
+	    &error)) {
+		timing.server += lap(&t);
+		warnx("remove failed: %d.%d %s: %s", error.domain, error.code,
+		    error.message, tmpdocs);
+		bson_destroy(selector);
+		return -1;
+	}
+
+	timing.server += lap(&t);
+
+	bson_destroy(selector);
+
+	return 0;
+}
+
+/*
+ * Execute an aggregation pipeline.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_agquery(mongoc_collection_t *collection, const char *line, size_t linelen)
+{
+	bson_error_t error;
+	bson_t *aggr_query, opts;
+	mongoc_cursor_t *cursor;
+	int64_t t;
+	int rc;
+
+	t = bson_get_monotonic_time();
+
+	if (relaxed_to_strict_alloc(&tmpdocs, &tmpdocssize, line, linelen, 0)
+	    == -1) {
+		warnx("could not parse line as JSON object(s): %.*s",
+		    (int)linelen, line);
+		return -1;
+	}
+
+	/* default to all documents */
+	if (strlen(tmpdocs) == 0) {
+		if (growbuf(&tmpdocs, &tmpdocssize, 3) == -1) {
+			warn("default pipeline");
+			return -1;
+		}
+		tmpdocs[0] = '[';
+		tmpdocs[1] = ']';
+		tmpdocs[2] = '\0';
+	}
+
+	if ((aggr_query = bson_new_from_json((uint8_t *)tmpdocs, -1, &error))
+	    == NULL) {
+		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
+		    tmpdocs);
+		return -1;
+	}
+
+	timing.parse += lap(&t);
+
+	beginop(&opts, NULL);
+
+	cursor = mongoc_collection_aggregate(collection, MONGOC_QUERY_NONE,
+	    aggr_query, &opts, NULL);
+
+	bson_destroy(aggr_query);
+
+	rc = pagerstart(cursor);
+	cursor = NULL;
+
+	endop(&opts);
+
+	return rc;
+}
+
+/* what the explain output of a query reveals, see printplan */
+struct explain {
+	const char *index;	/* first index used */
+	int collscan;
+	int sort;		/* in-memory sort */
+};
+
+/*
+ * Print the stages of the query plan "plan" from the root to the leaves,
+ * separated by "<".
+ */
+static void
+printplan(const bson_iter_t *plan, struct explain *ex)
+{
+	bson_iter_t it, child;
+	const char *stage, *index;
+	int n;
+
+	stage = "?";
+	if (bson_iter_recurse(plan, &it) && bson_iter_find(&it, "stage") &&
+	    BSON_ITER_HOLDS_UTF8(&it))
+		stage = bson_iter_utf8(&it, NULL);
+
+	printf("%s", stage);
+
+	if (strcmp(stage, "COLLSCAN") == 0)
+		ex->collscan = 1;
+	else if (strcmp(stage, "SORT") == 0)
+		ex->sort = 1;
+
+	if (bson_iter_recurse(plan, &it) && bson_iter_find(&it, "indexName") &&
+	    BSON_ITER_HOLDS_UTF8(&it)) {
+		index = bson_iter_utf8(&it, NULL);
+		printf(" %s", index);
+		if (ex->index == NULL)
+			ex->index = index;
+	}
+
+	if (bson_iter_recurse(plan, &it) && bson_iter_find(&it, "inputStage") &&
+	    BSON_ITER_HOLDS_DOCUMENT(&it)) {
+		printf(" < ");
+		printplan(&it, ex);
+	} else if (bson_iter_recurse(plan, &it) &&
+	    bson_iter_find(&it, "inputStages") && BSON_ITER_HOLDS_ARRAY(&it) &&
+	    bson_iter_recurse(&it, &child)) {
+		printf(" < (");
+		for (n = 0; bson_iter_next(&child); n++) {
+			if (n > 0)
+				printf(", ");
+			if (BSON_ITER_HOLDS_DOCUMENT(&child))
+				printplan(&child, ex);
+		}
+		printf(")");
+	}
+}
+
+/*
+ * Find the dotted "key" in explain output "reply", either at the top or in the
+ * $cursor stage of an aggregation that is not fully pushed down to the query
+ * layer.
+ *
+ * Return 1 if found, 0 if not.
+ */
+static int
+explainfind(const bson_t *reply, const char *key, bson_iter_t *dst)
+{
+	bson_iter_t it;
+	char path[64];
+
+	if (bson_iter_init(&it, reply) && bson_iter_find_descendant(&it, key,
+	    dst))
+		return 1;
+
+	snprintf(path, sizeof(path), "stages.0.$cursor.%s", key);
+	if (bson_iter_init(&it, reply) && bson_iter_find_descendant(&it, path,
+	    dst))
+		return 1;
+
+	return 0;
+}
+
+/*
+ * Return the integer "key" of executionStats in "reply" or -1 if it is absent.
+ */
+static int64_t
+explainint(const bson_t *reply, const char *key)
+{
+	bson_iter_t it;
+	char path[64];
+
+	snprintf(path, sizeof(path), "executionStats.%s", key);
+	if (!explainfind(reply, path, &it))
+		return -1;
+
+	return bson_iter_as_int64(&it);
+}
+
+/*
+ * Print a summary of the explain output "reply".
+ */
+static void
+printexplain(const bson_t *reply)
+{
+	struct explain ex;
+	bson_iter_t it, stages, stage;
+	const char *key;
+
+	memset(&ex, 0, sizeof(ex));
+
+	if (explainfind(reply, "queryPlanner.winningPlan", &it) &&
+	    BSON_ITER_HOLDS_DOCUMENT(&it)) {
+		/* the slot based engine wraps the classic plan */
+		if (bson_iter_recurse(&it, &stage) && bson_iter_find(&stage,
+		    "queryPlan") && BSON_ITER_HOLDS_DOCUMENT(&stage))
+			it = stage;
+
+		printf("plan: ");
+		printplan(&it, &ex);
+		printf("\n");
+	}
+
+	/* aggregation stages that run after the query layer */
+	if (bson_iter_init_find(&it, reply, "stages") &&
+	    BSON_ITER_HOLDS_ARRAY(&it) && bson_iter_recurse(&it, &stages)) {
+		printf("stages:");
+		while (bson_iter_next(&stages)) {
+			if (!bson_iter_recurse(&stages, &stage) ||
+			    !bson_iter_next(&stage))
+				continue;
+			key = bson_iter_key(&stage);
+			printf(" %s", key);
+			if (strcmp(key, "$sort") == 0)
+				ex.sort = 1;
+		}
+		printf("\n");
+	}
+
+	printf("index: %s\n", ex.index ? ex.index : "none");
+
+	printf("examined: %lld keys, %lld docs, returned: %lld, %lld ms\n",
+	    (long long)explainint(reply, "totalKeysExamined"),
+	    (long long)explainint(reply, "totalDocsExamined"),
+	    (long long)explainint(reply, "nReturned"),
+	    (long long)explainint(reply, "executionTimeMillis"));
+
+	if (ex.collscan)
+		printf("warning: collection scan\n");
+	if (ex.sort)
+		printf("warning: in-memory sort\n");
+}
+
+/*
+ * Explain a find with the selector in "line" or, if "line" starts with a "[",
+ * an aggregation pipeline, and print a summary of how the server executes it.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_explain(mongoc_collection_t *collection, const char *line, size_t linelen)
+{
+	bson_error_t error;
+	bson_t *query, cmd, sub, cursor, reply, opts;
+	const char *dfl;
+	int64_t t;
+	int pipeline, rc;
+
+	t = bson_get_monotonic_time();
+
+	pipeline = line[strspn(line, " \t")] == '[';
+	if (pipeline) {
+		dfl = "[]";
+		if (relaxed_to_strict_alloc(&tmpdocs, &tmpdocssize, line,
+		    linelen, 0) == -1) {
+			warnx("could not parse line as JSON object(s): %.*s",
+			    (int)linelen, line);
+			return -1;
+		}
+	} else {
+		dfl = "{}";
+		if (parse_selector(&tmpdocs, &tmpdocssize, line, linelen) == -1)
+			return -1;
+	}
+
+	if (strlen(tmpdocs) == 0) {
+		if (growbuf(&tmpdocs, &tmpdocssize, 3) == -1) {
+			warn("default selector");
+			return -1;
+		}
+		memcpy(tmpdocs, dfl, 3);
+	}
+
+	if ((query = bson_new_from_json((uint8_t *)tmpdocs, -1, &error)) ==
+	    NULL) {
+		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
+		    tmpdocs);
+		return -1;
+	}
+
+	bson_init(&cmd);
+	BSON_APPEND_DOCUMENT_BEGIN(&cmd, "explain", &sub);
+	if (pipeline) {
+		BSON_APPEND_UTF8(&sub, "aggregate",
+		    mongoc_collection_get_name(collection));
+		BSON_APPEND_ARRAY(&sub, "pipeline", query);
+		BSON_APPEND_DOCUMENT_BEGIN(&sub, "cursor", &cursor);
+		bson_append_document_end(&sub, &cursor);
+	} else {
+		BSON_APPEND_UTF8(&sub, "find",
+		    mongoc_collection_get_name(collection));
+		BSON_APPEND_DOCUMENT(&sub, "filter", query);
+	}
+	bson_append_document_end(&cmd, &sub);
+	BSON_APPEND_UTF8(&cmd, "verbosity", "executionStats");
+
+	bson_destroy(query);
+
+	timing.parse += lap(&t);
+
+	/* executionStats runs the query, so make it killable like find */
+	beginop(&opts, NULL);
+
+	rc = 0;
+	if (mongoc_collection_read_command_with_opts(collection, &cmd, NULL,
+	    &opts, &reply, &error)) {
+		timing.server += lap(&t);
+		printexplain(&reply);
+	} else {
+		timing.server += lap(&t);
+		warnx("explain failed: %d.%d %s: %s", error.domain, error.code,
+		    error.message, tmpdocs);
+		rc = -1;
+	}
+
+	endop(&opts);
+	bson_destroy(&reply);
+	bson_destroy(&cmd);
+
+	return rc;
+}
+
+enum benchmode { BENCH_INSERT, BENCH_FIND, BENCH_RANGE, BENCH_UPDATE };
+
+static const char *benchmodes[] = {
+	"insert",
+	"find",
+	"range",
+	"update",
+	NULL
+};
+
+/* work and results of one bench thread */
+struct benchjob {
+	pthread_t thr;
+	enum benchmode mode;
+	const char *dbname;
+	const char *collname;
+	const bson_t *doc;	/* insert doc, range selector or update doc */
+	const bson_value_t *ids;	/* sampled ids for find and update */
+	size_t nids;
+	long first;		/* index of the first operation of this job */
+	long ops;
+	long errors;
+	bson_error_t error;	/* first error */
+	struct histogram hist;	/* latency in microseconds */
+};
+
+/*
+ * Write "s" as a JSON string to the trace file.
+ */
+static void
+tracestr(const char *s)
+{
+	putc('"', tracefp);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(tracefp, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(tracefp, "\\u%04x", *s);
+		else
+			putc(*s, tracefp);
+	}
+	putc('"', tracefp);
+}
+
+/*
+ * Remember the namespace and size of a command until it finishes. The
+ * collection is the value of the first element, or of "collection" for
+ * getMore.
+ */
+static void
+tracestarted(const mongoc_apm_command_started_t *event)
+{
+	struct tracecmd *tc;
+	const bson_t *cmd;
+	const char *coll;
+	bson_iter_t it;
+	int64_t reqid;
+
+	cmd = mongoc_apm_command_started_get_command(event);
+	reqid = mongoc_apm_command_started_get_request_id(event);
+
+	coll = NULL;
+	if (bson_iter_init(&it, cmd) && bson_iter_next(&it)) {
+		if (BSON_ITER_HOLDS_UTF8(&it))
+			coll = bson_iter_utf8(&it, NULL);
+		else if (bson_iter_find(&it, "collection") &&
+		    BSON_ITER_HOLDS_UTF8(&it))
+			coll = bson_iter_utf8(&it, NULL);
+	}
+
+	tc = &tracecmd;
+	tc->reqid = reqid;
+	tc->bytes = cmd->len;
+	snprintf(tc->ns, sizeof(tc->ns), "%s%s%s",
+	    mongoc_apm_command_started_get_database_name(event),
+	    coll ? "." : "", coll ? coll : "");
+}
+
+/*
+ * Write one line with the name, namespace, duration in microseconds, request
+ * and reply size, cursor id and server of a finished command.
+ */
+static void
+traceend(int64_t reqid, const char *cmdname, int64_t us, const bson_t *reply,
+    const mongoc_host_list_t *host, const char *error)
+{
+	struct tracecmd *tc;
+	bson_iter_t it, id;
+	int64_t cursor;
+
+	cursor = 0;
+	if (reply != NULL && bson_iter_init(&it, reply) &&
+	    bson_iter_find_descendant(&it, "cursor.id", &id))
+		cursor = bson_iter_as_int64(&id);
+
+	tc = &tracecmd;
+	if (tc->reqid != reqid)
+		tc = NULL;
+
+	pthread_mutex_lock(&tracemtx);
+
+	fprintf(tracefp, "{\"t\":%lld,\"cmd\":",
+	    (long long)(bson_get_monotonic_time() - us - tracestart));
+	tracestr(cmdname);
+	fprintf(tracefp, ",\"ns\":");
+	tracestr(tc ? tc->ns : "");
+	fprintf(tracefp, ",\"us\":%lld,\"reqbytes\":%lu,\"replybytes\":%lu,"
+	    "\"cursor\":%lld,\"server\":", (long long)us,
+	    tc ? (unsigned long)tc->bytes : 0UL,
+	    reply ? (unsigned long)reply->len : 0UL, (long long)cursor);
+	tracestr(host ? host->host_and_port : "");
+	if (error != NULL) {
+		fprintf(tracefp, ",\"error\":");
+		tracestr(error);
+	}
+	fprintf(tracefp, "}\n");
+
+	pthread_mutex_unlock(&tracemtx);
+}
+
+static void
+tracesucceeded(const mongoc_apm_command_succeeded_t *event)
+{
+	traceend(mongoc_apm_command_succeeded_get_request_id(event),
+	    mongoc_apm_command_succeeded_get_command_name(event),
+	    mongoc_apm_command_succeeded_get_duration(event),
+	    mongoc_apm_command_succeeded_get_reply(event),
+	    mongoc_apm_command_succeeded_get_host(event), NULL);
+}
+
+static void
+tracefailed(const mongoc_apm_command_failed_t *event)
+{
+	bson_error_t error;
+
+	mongoc_apm_command_failed_get_error(event, &error);
+
+	traceend(mongoc_apm_command_failed_get_request_id(event),
+	    mongoc_apm_command_failed_get_command_name(event),
+	    mongoc_apm_command_failed_get_duration(event),
+	    mongoc_apm_command_failed_get_reply(event),
+	    mongoc_apm_command_failed_get_host(event), error.message);
+}
+
+/*
+ * Open "file" and log every command the driver sends to it as one JSON
+ * object per line. The callbacks are installed on the client and on the pool
+ * when it is created.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+traceopen(const char *file)
+{
+	if ((tracefp = fopen(file, "w")) == NULL) {
+		warn("%s", file);
+		return -1;
+	}
+
+	if (setvbuf(tracefp, NULL, _IOFBF, TRACEBUF) != 0)
+		warnx("could not set trace buffer");
+
+	if ((tracecbs = mongoc_apm_callbacks_new()) == NULL) {
+		warnx("could not create APM callbacks");
+		fclose(tracefp);
+		tracefp = NULL;
+		return -1;
+	}
+
+	mongoc_apm_set_command_started_cb(tracecbs, tracestarted);
+	mongoc_apm_set_command_succeeded_cb(tracecbs, tracesucceeded);
+	mongoc_apm_set_command_failed_cb(tracecbs, tracefailed);
+
+	tracestart = bson_get_monotonic_time();
+
+	return 0;
+}
+
+/*
+ * Flush and close the trace file, if any.
+ */
+static void
+traceclose(void)
+{
+	if (tracefp == NULL)
+		return;
+
+	if (fclose(tracefp) == EOF)
+		warn("could not write trace");
+	tracefp = NULL;
+
+	mongoc_apm_callbacks_destroy(tracecbs);
+	tracecbs = NULL;
+}
+
+/*
+ * Kill the operations on the server with comment "comment", using a client
+ * from the pool because the main client is waiting for the operation.
+ */
+static void
+killops(const char *comment)
+{
+	mongoc_client_pool_t *p;
+	mongoc_client_t *pc;
+	mongoc_database_t *admin;
+	mongoc_cursor_t *cursor;
+	const bson_t *doc;
+	bson_t pipeline, stage, sub, or, cond, cmd;
+	bson_error_t error;
+	bson_iter_t it;
+
+	if ((p = getpool()) == NULL)
+		return;
+
+	pc = mongoc_client_pool_pop(p);
+	admin = mongoc_client_get_database(pc, "admin");
+
+	bson_init(&pipeline);
+	BSON_APPEND_DOCUMENT_BEGIN(&pipeline, "0", &stage);
+	BSON_APPEND_DOCUMENT_BEGIN(&stage, "$currentOp", &sub);
+	bson_append_document_end(&stage, &sub);
+	bson_append_document_end(&pipeline, &stage);
+	BSON_APPEND_DOCUMENT_BEGIN(&pipeline, "1", &stage);
+	BSON_APPEND_DOCUMENT_BEGIN(&stage, "$match", &sub);
+	BSON_APPEND_ARRAY_BEGIN(&sub, "$or", &or);
+	BSON_APPEND_DOCUMENT_BEGIN(&or, "0", &cond);
+	BSON_APPEND_UTF8(&cond, "command.comment", comment);
+	bson_append_document_end(&or, &cond);
+	BSON_APPEND_DOCUMENT_BEGIN(&or, "1", &cond);
+	BSON_APPEND_UTF8(&cond, "cursor.originatingCommand.comment", comment);
+	bson_append_document_end(&or, &cond);
+	bson_append_array_end(&sub, &or);
+	bson_append_document_end(&stage, &sub);
+	bson_append_document_end(&pipeline, &stage);
+
+	cursor = mongoc_database_aggregate(admin, &pipeline, NULL, NULL);
+	while (mongoc_cursor_next(cursor, &doc)) {
+		if (!bson_iter_init_find(&it, doc, "opid"))
+			continue;
+
+		bson_init(&cmd);
+		BSON_APPEND_INT32(&cmd, "killOp", 1);
+		BSON_APPEND_VALUE(&cmd, "op", bson_iter_value(&it));
+		if (!mongoc_database_command_simple(admin, &cmd, NULL, NULL,
+		    &error))
+			warnx("killOp failed: %d.%d %s", error.domain,
+			    error.code, error.message);
+		bson_destroy(&cmd);
+	}
+
+	if (mongoc_cursor_error(cursor, &error))
+		warnx("could not list operations to kill: %d.%d %s",
+		    error.domain, error.code, error.message);
+
+	mongoc_cursor_destroy(cursor);
+	bson_destroy(&pipeline);
+	mongoc_database_destroy(admin);
+	mongoc_client_pool_push(p, pc);
+}
+
+/*
+ * Wait for SIGINT and kill the query in progress, if any.
+ */
+static void *
+killer(void *arg)
+{
+	char comment[sizeof(opcomment)], c;
+	ssize_t n;
+
+	(void)arg;
+
+	for (;;) {
+		if ((n = read(intrpipe[0], &c, 1)) == -1 && errno == EINTR)
+			continue;
+		if (n != 1)
+			return NULL;
+
+		pthread_mutex_lock(&opmtx);
+		memcpy(comment, opcomment, sizeof(comment));
+		pthread_mutex_unlock(&opmtx);
+
+		if (comment[0] != '\0')
+			killops(comment);
+	}
+}
+
+static void
+onintr(int sig)
+{
+	ssize_t n;
+	int saved;
+
+	(void)sig;
+
+	saved = errno;
+	interrupted = 1;
+	n = write(intrpipe[1], "", 1);
+	(void)n;
+	errno = saved;
+}
+
+/*
+ * Make SIGINT interrupt the command in progress instead of exiting. The
+ * handler wakes up a thread that kills the query on the server, which is
+ * needed if the server takes long to return the first batch. System calls
+ * are not restarted so that a blocking read of editline returns.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+intrsetup(void)
+{
+	struct sigaction sa;
+	sigset_t set, oset;
+	pthread_t thr;
+	int rc;
+
+	if (pipe(intrpipe) == -1) {
+		warn("pipe");
+		return -1;
+	}
+
+	/* never block in the signal handler */
+	if (fcntl(intrpipe[1], F_SETFL, O_NONBLOCK) == -1) {
+		warn("fcntl");
+		goto err;
+	}
+
+	/* leave SIGINT to the main thread so that it interrupts el_wgets */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &set, &oset);
+	rc = pthread_create(&thr, NULL, killer, NULL);
+	pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+	if (rc != 0) {
+		warnx("pthread_create: %s", strerror(rc));
+		goto err;
+	}
+	pthread_detach(thr);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = onintr;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGINT, &sa, NULL) == -1) {
+		warn("sigaction");
+		return -1;
+	}
+
+	return 0;
+
+err:
+	close(intrpipe[0]);
+	close(intrpipe[1]);
+	intrpipe[0] = -1;
+	intrpipe[1] = -1;
+
+	return -1;
+}
+
+/*
+ * Run the operations of one bench job on a client from the pool.
+ */
+static void *
+benchrun(void *arg)
+{
+	struct benchjob *job = arg;
+	mongoc_client_t *pc;
+	mongoc_collection_t *coll;
+	mongoc_cursor_t *cursor;
+	const bson_t *doc;
+	bson_error_t error;
+	bson_t sel, opts;
+	int64_t start;
+	long i;
+	int ok;
+
+	pc = mongoc_client_pool_pop(pool);
+	coll = mongoc_client_get_collection(pc, job->dbname, job->collname);
+
+	bson_init(&opts);
+	if (job->mode == BENCH_FIND)
+		BSON_APPEND_INT64(&opts, "limit", 1);
+	else if (job->mode == BENCH_RANGE)
+		BSON_APPEND_INT64(&opts, "limit", BENCHRANGE);
+
+	bson_init(&sel);
+
+	for (i = 0; i < job->ops && !interrupted; i++) {
+		if (job->nids > 0) {
+			bson_reinit(&sel);
+			BSON_APPEND_VALUE(&sel, "_id",
+			    &job->ids[(job->first + i) % job->nids]);
+		}
+
+		start = bson_get_monotonic_time();
+
+		ok = 0;
+		switch (job->mode) {
+		case BENCH_INSERT:
+			ok = mongoc_collection_insert_one(coll, job->doc, NULL,
+			    NULL, &error);
+			break;
+		case BENCH_FIND:
+		case BENCH_RANGE:
+			cursor = mongoc_collection_find_with_opts(coll,
+			    job->mode == BENCH_FIND ? &sel : job->doc, &opts,
+			    NULL);
+			while (mongoc_cursor_next(cursor, &doc))
+				;
+			ok = !mongoc_cursor_error(cursor, &error);
+			mongoc_cursor_destroy(cursor);
+			break;
+		case BENCH_UPDATE:
+			ok = mongoc_collection_update_one(coll, &sel, job->doc,
+			    NULL, NULL, &error);
+			break;
+		}
+
+		histogram_add(&job->hist, bson_get_monotonic_time() - start);
+
+		if (!ok && job->errors++ == 0)
+			job->error = error;
+	}
+
+	bson_destroy(&sel);
+	bson_destroy(&opts);
+
+	mongoc_collection_destroy(coll);
+	mongoc_client_pool_push(pool, pc);
+
+	return NULL;
+}
+
+/*
+ * Sample at most "max" ids from "collection" into the newly allocated array
+ * *ids. Release with freeids.
+ *
+ * Return the number of ids on success or -1 on failure.
+ */
+static int
+sampleids(mongoc_collection_t *collection, bson_value_t **ids, size_t max)
+{
+	mongoc_cursor_t *cursor;
+	bson_error_t error;
+	const bson_t *doc;
+	bson_t filter = BSON_INITIALIZER;
+	bson_t *opts;
+	bson_iter_t it;
+	int n;
+
+	if ((*ids = calloc(max, sizeof(**ids))) == NULL) {
+		warn("sampleids");
+		return -1;
+	}
+
+	opts = bson_copy(bsonprojectid);
+	BSON_APPEND_INT64(opts, "limit", max);
+	cursor = mongoc_collection_find_with_opts(collection, &filter, opts,
+	    NULL);
+	bson_destroy(opts);
+
+	n = 0;
+	while ((size_t)n < max && mongoc_cursor_next(cursor, &doc))
+		if (bson_iter_init_find(&it, doc, "_id"))
+			bson_value_copy(bson_iter_value(&it), &(*ids)[n++]);
+
+	if (mongoc_cursor_error(cursor, &error)) {
+		warnx("could not sample ids: %d.%d %s", error.domain,
+		    error.code, error.message);
+		while (n > 0)
+			bson_value_destroy(&(*ids)[--n]);
+		free(*ids);
+		*ids = NULL;
+		n = -1;
+	}
+
+	mongoc_cursor_destroy(cursor);
+
+	return n;
+}
+
+static void
+freeids(bson_value_t *ids, int nids)
+{
+	while (nids > 0)
+		bson_value_destroy(&ids[--nids]);
+	free(ids);
+}
+
+/*
+ * Parse the numeric option value at *line, advance *line past it.
+ *
+ * Return the value on success or -1 on failure.
+ */
+static long
+benchnum(const char **line, const char *opt)
+{
+	char *end;
+	long v;
+	size_t n;
+
+	*line += strlen(opt);
+	n = nexttok(line);
+	v = strtol(*line, &end, 10);
+	if (n == 0 || end != *line + n || v < 1) {
+		warnx("bench: %s expects a positive number", opt);
+		return -1;
+	}
+	*line += n;
+
+	return v;
+}
+
+/*
+ * Generate load on the current collection from multiple threads and report
+ * the throughput and latency percentiles.
+ *
+ * bench insert|find|range|update [-n ops] [-t threads] [doc]
+ *
+ * insert inserts copies of doc, find does point queries and update updates
+ * single documents by _id, sampled from the collection, and range runs the
+ * selector doc with a limit of BENCHRANGE documents.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_bench(const char *line, size_t linelen)
+{
+	struct benchjob *jobs;
+	struct histogram hist;
+	enum benchmode mode;
+	bson_error_t error;
+	sigset_t set, oset;
+	bson_value_t *ids;
+	bson_t *doc;
+	const char **matches;
+	char *modename;
+	size_t n;
+	int64_t start, elapsed;
+	long ops, nthreads, errors, i;
+	int nids, rc;
+
+	/* the mode may be abbreviated like commands */
+	n = nexttok(&line);
+	if ((modename = strndup(line, n)) == NULL) {
+		warn("exec_bench");
+		return -1;
+	}
+	if (prefix_match(&matches, benchmodes, modename) == -1) {
+		warn("exec_bench");
+		free(modename);
+		return -1;
+	}
+	free(modename);
+	rc = n > 0 && matches[0] != NULL && matches[1] == NULL;
+	for (i = 0; rc && strcmp(benchmodes[i], matches[0]) != 0; i++)
+		;
+	free(matches);
+	if (!rc) {
+		warnx("usage: bench insert|find|range|update [-n ops] "
+		    "[-t threads] [doc]");
+		return -1;
+	}
+	mode = i;
+	line += n;
+
+	ops = BENCHOPS;
+	nthreads = BENCHTHREADS;
+	for (;;) {
+		n = nexttok(&line);
+		if (n == 2 && strncmp(line, "-n", 2) == 0)
+			ops = benchnum(&line, "-n");
+		else if (n == 2 && strncmp(line, "-t", 2) == 0)
+			nthreads = benchnum(&line, "-t");
+		else
+			break;
+
+		if (ops == -1 || nthreads == -1)
+			return -1;
+	}
+
+	if (nthreads > BENCHMAXTHREADS) {
+		warnx("bench: at most %d threads", BENCHMAXTHREADS);
+		return -1;
+	}
+
+	if (nthreads > ops)
+		nthreads = ops;
+
+	linelen = strlen(line);
+
+	/* parse the document or selector, or use a default */
+	switch (mode) {
+	case BENCH_INSERT:
+		if (linelen == 0)
+			line = "{ bench: true, n: 1, "
+			    "s: \"abcdefghijklmnopqrstuvwxyz\" }";
+		if (parse_selector(&tmpdocs, &tmpdocssize, line, strlen(line))
+		    <= 0)
+			return -1;
+		break;
+	case BENCH_UPDATE:
+		if (linelen == 0)
+			line = "{ $inc: { bench: 1 } }";
+		if (relaxed_to_strict_alloc(&tmpdocs, &tmpdocssize, line,
+		    strlen(line), 1) <= 0) {
+			warnx("could not parse update doc: %s", line);
+			return -1;
+		}
+		break;
+	case BENCH_RANGE:
+		if (parse_selector(&tmpdocs, &tmpdocssize, line, linelen) == -1)
+			return -1;
+		if (strlen(tmpdocs) == 0)
+			line = "{}";
+		else
+			line = tmpdocs;
+		if (growbuf(&tmpdocs, &tmpdocssize, strlen(line) + 1) == -1) {
+			warn("exec_bench");
+			return -1;
+		}
+		memmove(tmpdocs, line, strlen(line) + 1);
+		break;
+	case BENCH_FIND:
+		if (linelen > 0) {
+			warnx("bench: find does not take a document");
+			return -1;
+		}
+		if (growbuf(&tmpdocs, &tmpdocssize, 3) == -1) {
+			warn("exec_bench");
+			return -1;
+		}
+		strcpy(tmpdocs, "{}");
+		break;
+	}
+
+	if ((doc = bson_new_from_json((uint8_t *)tmpdocs, -1, &error)) ==
+	    NULL) {
+		warnx("%d.%d %s: %s", error.domain, error.code, error.message,
+		    tmpdocs);
+		return -1;
+	}
+
+	ids = NULL;
+	nids = 0;
+	if (mode == BENCH_FIND || mode == BENCH_UPDATE) {
+		if ((nids = sampleids(ccoll, &ids, BENCHIDS)) == -1) {
+			bson_destroy(doc);
+			return -1;
+		}
+		if (nids == 0) {
+			warnx("bench: collection is empty");
+			bson_destroy(doc);
+			free(ids);
+			return -1;
+		}
+	}
+
+	if (getpool() == NULL) {
+		bson_destroy(doc);
+		freeids(ids, nids);
+		return -1;
+	}
+
+	/* each job holds a histogram, too large for the stack */
+	if ((jobs = calloc(nthreads, sizeof(*jobs))) == NULL) {
+		warn("exec_bench");
+		bson_destroy(doc);
+		freeids(ids, nids);
+		return -1;
+	}
+
+	start = bson_get_monotonic_time();
+
+	/* leave SIGINT to the main thread, the workers check interrupted */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &set, &oset);
+
+	for (i = 0; i < nthreads; i++) {
+		jobs[i].mode = mode;
+		jobs[i].dbname = path.dbname;
+		jobs[i].collname = path.collname;
+		jobs[i].doc = doc;
+		jobs[i].ids = ids;
+		jobs[i].nids = nids;
+		jobs[i].first = i * (ops / nthreads);
+		jobs[i].ops = ops / nthreads + (i < ops % nthreads);
+		histogram_init(&jobs[i].hist);
+
+		if ((rc = pthread_create(&jobs[i].thr, NULL, benchrun,
+		    &jobs[i])) != 0) {
+			warnx("pthread_create: %s", strerror(rc));
+			nthreads = i;
+			break;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+	histogram_init(&hist);
+	errors = 0;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(jobs[i].thr, NULL);
+		histogram_merge(&hist, &jobs[i].hist);
+		if (jobs[i].errors > 0 && errors == 0)
+			warnx("%s failed: %d.%d %s", benchmodes[mode],
+			    jobs[i].error.domain, jobs[i].error.code,
+			    jobs[i].error.message);
+		errors += jobs[i].errors;
+	}
+
+	elapsed = bson_get_monotonic_time() - start;
+
+	free(jobs);
+	bson_destroy(doc);
+	freeids(ids, nids);
+
+	printf("%s: %llu ops, %ld threads, %.3f s, %.0f ops/s, %ld errors\n",
+	    benchmodes[mode], (unsigned long long)hist.n, nthreads,
+	    elapsed / 1e6, elapsed > 0 ? hist.n * 1e6 / elapsed : 0.0,
+	    errors);
+	printf("latency us: min %llu, p50 %llu, p90 %llu, p99 %llu, "
+	    "p99.9 %llu, max %llu\n", (unsigned long long)hist.min,
+	    (unsigned long long)histogram_percentile(&hist, 50),
+	    (unsigned long long)histogram_percentile(&hist, 90),
+	    (unsigned long long)histogram_percentile(&hist, 99),
+	    (unsigned long long)histogram_percentile(&hist, 99.9),
+	    (unsigned long long)hist.max);
+
+	return errors > 0 ? -1 : 0;
+}
+
+/*
+ * Change database/collection.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_cd(const char *paths)
+{
+	char p1[PATH_MAX], p2[PATH_MAX];
+	path_t tmppath;
+	Tokenizer *t;
+	const char **av, *s;
+	path_t *ps;
+	int rc, ac;
+	size_t n;
+
+	ps = NULL;
+
+	t = tok_init(NULL);
+
+	rc = tok_str(t, paths, &ac, &av);
+	rc = test_tokresult(rc);
+
+	if (rc == -1) /* assert message is printed by test_tokresult */
+		goto cleanup;
 
 	if (ac == 0) {
 		if (homepathset == 0) {
@@ -1080,264 +4024,1227 @@ exec_cd(const char *paths)
 			    "entered yet");
 			rc = -1;
 		} else {
-			rc = exec_chcoll(client, homepath);
+			rc = exec_chcoll(homepath);
+		}
+		goto cleanup;
+	}
+
+	if (ac > 2) {
+		warnx("too many arguments");
+		rc = -1;
+		goto cleanup;
+	}
+
+	if (ac == 2) {
+		if ((size_t)snprintf(p1, sizeof(p1), "/%s/%s", path.dbname,
+		    path.collname) >= sizeof(p1)) {
+			warnx("exec_cd p1 too small");
+			rc = -1;
+			goto cleanup;
+		}
+
+		s = strstr(p1, av[0]);
+		if (s == NULL) {
+			warnx("%s not found in %s", av[0], p1);
+			rc = -1;
+			goto cleanup;
+		}
+
+		if ((size_t)snprintf(p2, sizeof(p2), "%.*s%s%s", (int)(s - p1), p1,
+		    av[1], &p1[(s - p1) + strlen(av[0])]) >= sizeof(p2)) {
+			warnx("exec_cd p2 too small for new path");
+			rc = -1;
+			goto cleanup;
+		}
+
+		/* assert p1 still contains cwd */
+		n = resolvepath(p1, sizeof(p1), p2, NULL);
+		if (n == (size_t)-1) {
+			warnx("exec_cd resolvepath error: %s", p2);
+			rc = -1;
+			goto cleanup;
+		}
+
+		if (parse_path(&tmppath, p1) == -1) {
+			warnx("exec_cd parse_path error: %s", p1);
+			rc = -1;
+			goto cleanup;
+		}
+
+		rc = exec_chcoll(tmppath);
+	} else if (strcmp("-", av[0]) == 0) {
+		/* cd - */
+		rc = exec_chcoll(prevpath);
+	} else {
+		if (parse_paths(&ps, path, av, ac) == -1) {
+			warnx("could not parse paths: %s", paths);
+			rc = -1;
+			goto cleanup;
+		}
+
+		rc = exec_chcoll(*ps);
+	}
+
+cleanup:
+	free(ps);
+	tok_end(t);
+
+	return rc;
+}
+
+/*
+ * List all databases, collections and/or object ids for each path in paths.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_ls(const char *paths)
+{
+	path_t *psp, *ps = NULL;
+	mongoc_client_t *c;
+	mongoc_collection_t *coll;
+	int rc, i, n;
+
+	n = tok_paths(&ps, paths);
+	if (n == -1) {
+		warnx("could not parse paths: %s", paths);
+		return -1;
+	}
+
+	if (n == 0) {
+		/* default to current path */
+		psp = &path;
+		n = 1;
+	} else {
+		psp = ps;
+	}
+
+	if ((c = getclient()) == NULL) {
+		rc = -1;
+		goto cleanup;
+	}
+
+	rc = 0;
+
+	for (i = 0; i < n; i++) {
+		if (strlen(psp[i].collname) > 0) {
+			coll = mongoc_client_get_collection(c, psp[i].dbname,
+			    psp[i].collname);
+			rc = exec_query(coll, "{}", 2, 1);
+			if (coll != NULL) {
+				mongoc_collection_destroy(coll);
+				coll = NULL;
+			}
+		} else if (strlen(psp[i].dbname) > 0) {
+			rc = exec_lscolls(c, psp[i].dbname);
+		} else {
+			rc = exec_lsdbs(c);
+		}
+
+		/* assert an error message was printed */
+		if (rc == -1)
+			goto cleanup;
+	}
+
+cleanup:
+	free(ps);
+
+	return rc;
+}
+
+static int
+exec_drop(const char *paths)
+{
+	path_t *psp, *ps = NULL;
+	mongoc_client_t *c;
+	mongoc_collection_t *coll;
+	mongoc_database_t *db;
+	bson_error_t error;
+	int rc, i, n;
+
+	n = tok_paths(&ps, paths);
+	if (n == -1) {
+		warnx("could not parse paths: %s", paths);
+		return -1;
+	}
+
+	if (n == 0) {
+		/* default to current path */
+		psp = &path;
+		n = 1;
+	} else {
+		psp = ps;
+	}
+
+	if ((c = getclient()) == NULL) {
+		rc = -1;
+		goto cleanup;
+	}
+
+	rc = 0;
+
+	for (i = 0; i < n; i++) {
+		/* forget the names whether or not the drop succeeds */
+		if (strlen(psp[i].dbname) > 0)
+			forgetns(psp[i].dbname);
+		if (strlen(psp[i].collname) == 0)
+			forgetns("");
+		forgetfields(&psp[i]);
+
+		if (strlen(psp[i].collname) > 0) {	/* drop collection */
+			coll = mongoc_client_get_collection(c, psp[i].dbname,
+			    psp[i].collname);
+			if (!mongoc_collection_drop(coll, &error)) {
+				warnx("failed dropping /%s/%s: %d.%d %s",
+				    psp[i].dbname, psp[i].collname,
+				    error.domain, error.code, error.message);
+
+				// ignore 5.26 ns not found
+				if (error.domain != 5 || error.code != 26)
+					rc = -1;
+			} else {
+				printf("dropped /%s/%s\n", psp[i].dbname,
+				    psp[i].collname);
+			}
+			if (coll != NULL) {
+				mongoc_collection_destroy(coll);
+				coll = NULL;
+			}
+		} else if (strlen(psp[i].dbname) > 0) {
+			db = mongoc_client_get_database(c, psp[i].dbname);
+			if (!mongoc_database_drop(db, &error)) {
+				warnx("failed dropping /%s: %d.%d %s",
+				    psp[i].dbname, error.domain, error.code,
+				    error.message);
+				rc = -1;
+			} else {
+				printf("dropped /%s\n", psp[i].dbname);
+			}
+			mongoc_database_destroy(db);
+			db = NULL;
+		} else {
+			warnx("can't drop all databases at once");
+			rc = -1;
+		}
+
+		if (rc != 0) {
+			rc = -1;
+			goto cleanup;
+		}
+	}
+
+cleanup:
+	free(ps);
+
+	return rc;
+}
+
+/*
+ * Turn printing of timings after each command on or off, or print whether it
+ * is on if "line" is empty.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_timing(const char *line)
+{
+	const char *arg;
+	size_t arglen;
+
+	arg = line;
+	arglen = nexttok(&arg);
+
+	if (arglen == 0) {
+		printf("timing is %s\n", timingon ? "on" : "off");
+		return 0;
+	}
+
+	if (arglen == 2 && strncmp(arg, "on", arglen) == 0) {
+		timingon = 1;
+	} else if (arglen == 3 && strncmp(arg, "off", arglen) == 0) {
+		timingon = 0;
+	} else {
+		warnx("usage: timing [on|off]");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Print the counts of bulk write "reply" on one line.
+ */
+static void
+printbulkreply(const bson_t *reply)
+{
+	static const char *keys[] = {
+		"nInserted", "nMatched", "nModified", "nUpserted", "nRemoved"
+	};
+	static const char *names[] = {
+		"inserted", "matched", "modified", "upserted", "removed"
+	};
+	bson_iter_t it;
+	int64_t v;
+	size_t i;
+
+	for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		v = 0;
+		if (bson_iter_init_find(&it, reply, keys[i]))
+			v = bson_iter_as_int64(&it);
+
+		printf("%s%s %lld", i > 0 ? ", " : "", names[i], (long long)v);
+	}
+	printf("\n");
+}
+
+/*
+ * Execute the bulk write and print its counts. Each failed command is reported
+ * separately.
+ *
+ * Return 0 on success, -1 if any command failed.
+ */
+static int
+commitbulk(void)
+{
+	bson_t reply;
+	bson_error_t error;
+	bson_iter_t it, errs;
+	const char *msg;
+	int64_t t, idx, code;
+	int rc;
+
+	/* the server refuses an empty bulk write */
+	if (bulk.n == 0) {
+		bson_init(&reply);
+		printbulkreply(&reply);
+		bson_destroy(&reply);
+		bulkfree();
+		return 0;
+	}
+
+	rc = 0;
+	t = bson_get_monotonic_time();
+	if (mongoc_bulk_operation_execute(bulk.op, &reply, &error) == 0) {
+		rc = -1;
+
+		if (bson_iter_init_find(&it, &reply, "writeErrors") &&
+		    BSON_ITER_HOLDS_ARRAY(&it) &&
+		    bson_iter_recurse(&it, &errs)) {
+			while (bson_iter_next(&errs)) {
+				if (parsewriteerror(&errs, &idx, &code, &msg)
+				    == -1 || (uint64_t)idx >= bulk.n)
+					continue;
+
+				warnx("%d.%d %s: %s", error.domain, (int)code,
+				    msg, bulk.cmds[idx] != NULL ?
+				    bulk.cmds[idx] : "");
+			}
+		} else {
+			warnx("bulk write of %zu commands failed: %d.%d %s",
+			    bulk.n, error.domain, error.code, error.message);
 		}
-		goto cleanup;
 	}
+	timing.server += lap(&t);
 
-	if (ac > 2) {
-		warnx("too many arguments");
+	printbulkreply(&reply);
+
+	bson_destroy(&reply);
+	bulkfree();
+
+	return rc;
+}
+
+/*
+ * Begin, commit or abort a bulk write. In between, insert, update, upsert and
+ * remove on the collection it began on are only queued, and commit sends them
+ * in as few round trips as the server allows. An ordered bulk write stops at
+ * the first failed command, an unordered one does not.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_bulk(const char *line)
+{
+	bson_t opts = BSON_INITIALIZER;
+	const char *arg, *arg2;
+	size_t arglen, arg2len;
+
+	arg = line;
+	arglen = nexttok(&arg);
+	arg2 = arg + arglen;
+	arg2len = nexttok(&arg2);
+
+	if (arglen == 5 && strncmp(arg, "begin", arglen) == 0 &&
+	    (arg2len == 0 ||
+	    (arg2len == 9 && strncmp(arg2, "unordered", arg2len) == 0))) {
+		if (bulk.op != NULL) {
+			warnx("bulk write already begun on /%s/%s",
+			    bulk.ns.dbname, bulk.ns.collname);
+			return -1;
+		}
+
+		if (strlen(path.collname) == 0) {
+			warnx("no collection selected");
+			return -1;
+		}
+
+		if (getccoll() == NULL)
+			return -1;
+
+		BSON_APPEND_BOOL(&opts, "ordered", arg2len == 0);
+		bulk.op = mongoc_collection_create_bulk_operation_with_opts(
+		    ccoll, &opts);
+		bulk.ns = path;
+		bson_destroy(&opts);
+
+		return 0;
+	}
+
+	if (arg2len == 0 &&
+	    ((arglen == 6 && strncmp(arg, "commit", arglen) == 0) ||
+	    (arglen == 5 && strncmp(arg, "abort", arglen) == 0))) {
+		if (bulk.op == NULL) {
+			warnx("no bulk write begun");
+			return -1;
+		}
+
+		if (arglen == 6)
+			return commitbulk();
+
+		bulkfree();
+		return 0;
+	}
+
+	warnx("usage: bulk begin [unordered] | commit | abort");
+	return -1;
+}
+
+/*
+ * Print where the time of the last command went on stderr.
+ */
+static void
+printtiming(void)
+{
+	int64_t total;
+
+	total = bson_get_monotonic_time() - timing.start;
+
+	fprintf(stderr, "connect %.3f ms, parse %.3f ms, first doc %.3f ms, "
+	    "server %.3f ms, print %.3f ms, total %.3f ms, %llu docs, "
+	    "%llu bytes\n", timing.connect / 1000.0,
+	    timing.parse / 1000.0, timing.first / 1000.0,
+	    timing.server / 1000.0, timing.print / 1000.0, total / 1000.0,
+	    (unsigned long long)timing.docs, (unsigned long long)timing.bytes);
+}
+
+/*
+ * Execute command "cmd" that works on collection "coll" with given arguments.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+dispatch_collcmd(mongoc_collection_t *coll, const char *cmd, const char *line,
+    size_t linelen)
+{
+	if (strcmp("bench", cmd) == 0) {
+		return exec_bench(line, linelen);
+	} else if (strcmp("count", cmd) == 0) {
+		return exec_count(coll, line, linelen);
+	} else if (strcmp("explain", cmd) == 0) {
+		return exec_explain(coll, line, linelen);
+	} else if (strcmp("update", cmd) == 0) {
+		return exec_update(coll, line, linelen, 0);
+	} else if (strcmp("upsert", cmd) == 0) {
+		return exec_update(coll, line, linelen, 1);
+	} else if (strcmp("insert", cmd) == 0) {
+		return exec_insert(coll, line, linelen);
+	} else if (strcmp("remove", cmd) == 0) {
+		return exec_remove(coll, line, linelen);
+	} else if (strcmp("find", cmd) == 0) {
+		return exec_query(coll, line, linelen, 0);
+	} else if (strcmp("aggregate", cmd) == 0) {
+		return exec_agquery(coll, line, linelen);
+	}
+
+	warnx("unknown command: \"%s\"", line);
+	return -1;
+}
+
+/*
+ * Run the command of background job "arg" on a client from the pool with its
+ * own command state and its output in job->fp.
+ */
+static void *
+jobrun(void *arg)
+{
+	struct job *job = arg;
+	mongoc_client_t *pc;
+	mongoc_collection_t *coll;
+	int rc;
+
+	curjob = job;
+	outfp = job->fp;
+	opcur = job->comment;
+
+	pc = mongoc_client_pool_pop(pool);
+	coll = mongoc_client_get_collection(pc, job->ns.dbname,
+	    job->ns.collname);
+
+	rc = dispatch_collcmd(coll, job->cmd, job->args, strlen(job->args));
+
+	pagerclose();
+	mongoc_collection_destroy(coll);
+	mongoc_client_pool_push(pool, pc);
+
+	if (fclose(job->fp) == EOF) {
+		warn("%s", job->file);
 		rc = -1;
-		goto cleanup;
 	}
+	job->fp = NULL;
 
-	if (ac == 2) {
-		if ((size_t)snprintf(p1, sizeof(p1), "/%s/%s", path.dbname,
-		    path.collname) >= sizeof(p1)) {
-			warnx("exec_cd p1 too small");
-			rc = -1;
-			goto cleanup;
+	free(tmpdocs);
+	tmpdocs = NULL;
+	free(updatedoc);
+	updatedoc = NULL;
+	jsonify_free();
+
+	pthread_mutex_lock(&jobmtx);
+	job->rc = rc;
+	job->state = JOBDONE;
+	pthread_cond_broadcast(&jobcond);
+	pthread_mutex_unlock(&jobmtx);
+
+	return NULL;
+}
+
+/*
+ * Start command "cmd" with arguments "line" on the current collection in the
+ * background, with its output in a new file in TMPDIR. SIGINT only interrupts
+ * the command in the foreground, see kill.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+startjob(const char *cmd, const char *line, size_t linelen)
+{
+	sigset_t set, oset;
+	struct job *job;
+	const char *tmpdir;
+	int fd, i, rc;
+
+	for (i = 0; bgcmds[i] != NULL; i++)
+		if (strcmp(cmd, bgcmds[i]) == 0)
+			break;
+
+	if (bgcmds[i] == NULL) {
+		warnx("%s can't run in the background", cmd);
+		return -1;
+	}
+	cmd = bgcmds[i];
+
+	/* a job has no bulk write and would run ahead of the queued writes */
+	if (bulk.op != NULL && (strcmp("remove", cmd) == 0 ||
+	    strcmp("update", cmd) == 0 || strcmp("upsert", cmd) == 0)) {
+		warnx("%s can't run in the background during a bulk write",
+		    cmd);
+		return -1;
+	}
+
+	if (strlen(path.collname) == 0) {
+		warnx("no collection selected");
+		return -1;
+	}
+
+	if (getpool() == NULL)
+		return -1;
+
+	/* only this thread frees and takes slots */
+	pthread_mutex_lock(&jobmtx);
+	for (i = 0; i < MAXJOBS; i++)
+		if (bgjobs[i].state == JOBFREE)
+			break;
+	pthread_mutex_unlock(&jobmtx);
+
+	if (i == MAXJOBS) {
+		warnx("too many jobs, wait for one to finish");
+		return -1;
+	}
+	job = &bgjobs[i];
+
+	if ((tmpdir = getenv("TMPDIR")) == NULL || *tmpdir == '\0')
+		tmpdir = "/tmp";
+
+	if ((size_t)snprintf(job->file, sizeof(job->file), "%s/mongovi.XXXXXX",
+	    tmpdir) >= sizeof(job->file)) {
+		warnx("TMPDIR too long: %s", tmpdir);
+		return -1;
+	}
+
+	if ((fd = mkstemp(job->file)) == -1) {
+		warn("%s", job->file);
+		return -1;
+	}
+
+	if ((job->fp = fdopen(fd, "w")) == NULL) {
+		warn("%s", job->file);
+		close(fd);
+		unlink(job->file);
+		return -1;
+	}
+
+	if ((job->args = strndup(line, linelen)) == NULL) {
+		warn("could not start job");
+		goto err;
+	}
+
+	job->ns = path;
+	job->cmd = cmd;
+	job->comment[0] = '\0';
+	job->rc = 0;
+
+	pthread_mutex_lock(&jobmtx);
+	job->state = JOBRUNNING;
+	job->killed = 0;
+	pthread_mutex_unlock(&jobmtx);
+
+	if (strcmp("upsert", cmd) == 0)
+		touchns(path.dbname, path.collname);
+
+	/* the thread inherits the signal mask */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &set, &oset);
+	rc = pthread_create(&job->thread, NULL, jobrun, job);
+	pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+	if (rc != 0) {
+		warnx("pthread_create: %s", strerror(rc));
+		pthread_mutex_lock(&jobmtx);
+		job->state = JOBFREE;
+		pthread_mutex_unlock(&jobmtx);
+		free(job->args);
+		job->args = NULL;
+		goto err;
+	}
+
+	fprintf(stderr, "[%d] %s\n", i + 1, job->file);
+
+	return 0;
+
+err:
+	fclose(job->fp);
+	job->fp = NULL;
+	unlink(job->file);
+
+	return -1;
+}
+
+/*
+ * Print the number, state, collection, command and output file of job "i" on
+ * one line.
+ */
+static void
+printjob(FILE *fp, int i)
+{
+	struct job *job;
+	const char *state;
+
+	job = &bgjobs[i];
+
+	pthread_mutex_lock(&jobmtx);
+	if (job->state == JOBRUNNING)
+		state = job->killed ? "killing" : "running";
+	else if (job->rc == 0)
+		state = "done";
+	else
+		state = job->killed ? "killed" : "failed";
+	pthread_mutex_unlock(&jobmtx);
+
+	fprintf(fp, "[%d] %-7s /%s/%s %s%s%s > %s\n", i + 1, state,
+	    job->ns.dbname, job->ns.collname, job->cmd,
+	    *job->args != '\0' ? " " : "", job->args, job->file);
+}
+
+/*
+ * Wait for job "i" to finish, print it on "fp" if not NULL and free its slot.
+ *
+ * Return 0 if the command of the job succeeded, -1 if not.
+ */
+static int
+reapjob(int i, FILE *fp)
+{
+	struct job *job;
+
+	job = &bgjobs[i];
+
+	pthread_join(job->thread, NULL);
+
+	if (fp != NULL)
+		printjob(fp, i);
+
+	free(job->args);
+	job->args = NULL;
+
+	pthread_mutex_lock(&jobmtx);
+	job->state = JOBFREE;
+	pthread_mutex_unlock(&jobmtx);
+
+	return job->rc == 0 ? 0 : -1;
+}
+
+/*
+ * Report the jobs that finished since the last command on stderr, like a
+ * shell does before the next prompt.
+ */
+static void
+notifyjobs(void)
+{
+	int i, done;
+
+	for (i = 0; i < MAXJOBS; i++) {
+		pthread_mutex_lock(&jobmtx);
+		done = bgjobs[i].state == JOBDONE;
+		pthread_mutex_unlock(&jobmtx);
+
+		if (done)
+			reapjob(i, stderr);
+	}
+}
+
+/*
+ * Wait until job "i" is finished, but stop waiting on SIGINT.
+ *
+ * Return 0 if the job is finished, -1 if interrupted.
+ */
+static int
+waitjob(int i)
+{
+	struct timespec ts;
+	int done;
+
+	pthread_mutex_lock(&jobmtx);
+	while (bgjobs[i].state == JOBRUNNING && !interrupted) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += JOBWAIT * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
 		}
+		pthread_cond_timedwait(&jobcond, &jobmtx, &ts);
+	}
+	done = bgjobs[i].state == JOBDONE;
+	pthread_mutex_unlock(&jobmtx);
+
+	return done ? 0 : -1;
+}
+
+/*
+ * Make job "i" stop printing and kill its operation on the server, if any.
+ * Writes without a cursor run to completion.
+ */
+static void
+killjob(int i)
+{
+	char comment[sizeof(opcomment)];
+
+	pthread_mutex_lock(&jobmtx);
+	bgjobs[i].killed = 1;
+	pthread_mutex_unlock(&jobmtx);
+
+	pthread_mutex_lock(&opmtx);
+	memcpy(comment, bgjobs[i].comment, sizeof(comment));
+	pthread_mutex_unlock(&opmtx);
+
+	if (comment[0] != '\0')
+		killops(comment);
+}
+
+/*
+ * Parse job argument "line" of the form "n" or "%n".
+ *
+ * Return the slot of the job on success, -1 if there is no such job.
+ */
+static int
+parsejob(const char *line)
+{
+	const char *arg;
+	char *end;
+	size_t arglen;
+	long n;
+	int used;
+
+	arg = line;
+	arglen = nexttok(&arg);
+	if (arglen > 0 && *arg == '%') {
+		arg++;
+		arglen--;
+	}
+
+	errno = 0;
+	n = strtol(arg, &end, 10);
+	if (arglen == 0 || errno != 0 || end != arg + arglen || n < 1 ||
+	    n > MAXJOBS) {
+		warnx("no such job: %s", line);
+		return -1;
+	}
+
+	pthread_mutex_lock(&jobmtx);
+	used = bgjobs[n - 1].state != JOBFREE;
+	pthread_mutex_unlock(&jobmtx);
+
+	if (!used) {
+		warnx("no such job: %s", line);
+		return -1;
+	}
+
+	return n - 1;
+}
+
+/*
+ * List the background jobs and forget the finished ones.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+static int
+exec_jobs(const char *line)
+{
+	int i, state;
+
+	if (nexttok(&line) > 0) {
+		warnx("usage: jobs");
+		return -1;
+	}
+
+	for (i = 0; i < MAXJOBS; i++) {
+		pthread_mutex_lock(&jobmtx);
+		state = bgjobs[i].state;
+		pthread_mutex_unlock(&jobmtx);
+
+		if (state == JOBFREE)
+			continue;
+
+		printjob(stdout, i);
+		if (state == JOBDONE)
+			reapjob(i, NULL);
+	}
+
+	return 0;
+}
+
+/*
+ * Wait for the job in "line", or for all jobs if "line" is empty, and print
+ * each on stderr.
+ *
+ * Return 0 if the jobs succeeded, -1 if any failed or on SIGINT.
+ */
+static int
+exec_wait(const char *line)
+{
+	int i, rc, state;
 
-		s = strstr(p1, av[0]);
-		if (s == NULL) {
-			warnx("%s not found in %s", av[0], p1);
-			rc = -1;
-			goto cleanup;
-		}
+	if (nexttok(&line) > 0) {
+		if ((i = parsejob(line)) == -1)
+			return -1;
 
-		if ((size_t)snprintf(p2, sizeof(p2), "%.*s%s%s", (int)(s - p1), p1,
-		    av[1], &p1[(s - p1) + strlen(av[0])]) >= sizeof(p2)) {
-			warnx("exec_cd p2 too small for new path");
-			rc = -1;
-			goto cleanup;
+		if (waitjob(i) == -1) {
+			warnx("interrupted");
+			return -1;
 		}
 
-		/* assert p1 still contains cwd */
-		n = resolvepath(p1, sizeof(p1), p2, NULL);
-		if (n == (size_t)-1) {
-			warnx("exec_cd resolvepath error: %s", p2);
-			rc = -1;
-			goto cleanup;
-		}
+		return reapjob(i, stderr);
+	}
 
-		if (parse_path(&tmppath, p1) == -1) {
-			warnx("exec_cd parse_path error: %s", p1);
-			rc = -1;
-			goto cleanup;
-		}
+	rc = 0;
+	for (i = 0; i < MAXJOBS; i++) {
+		pthread_mutex_lock(&jobmtx);
+		state = bgjobs[i].state;
+		pthread_mutex_unlock(&jobmtx);
 
-		rc = exec_chcoll(client, tmppath);
-	} else if (strcmp("-", av[0]) == 0) {
-		/* cd - */
-		rc = exec_chcoll(client, prevpath);
-	} else {
-		if (parse_paths(&ps, path, av, ac) == -1) {
-			warnx("could not parse paths: %s", paths);
-			rc = -1;
-			goto cleanup;
+		if (state == JOBFREE)
+			continue;
+
+		if (waitjob(i) == -1) {
+			warnx("interrupted");
+			return -1;
 		}
 
-		rc = exec_chcoll(client, *ps);
+		if (reapjob(i, stderr) == -1)
+			rc = -1;
 	}
 
-cleanup:
-	free(ps);
-	tok_end(t);
-
 	return rc;
 }
 
 /*
- * List all databases, collections and/or object ids for each path in paths.
+ * Kill the job in "line".
  *
  * Return 0 on success, -1 on failure.
  */
 static int
-exec_ls(const char *paths)
+exec_kill(const char *line)
 {
-	path_t *psp, *ps = NULL;
-	mongoc_collection_t *ccoll;
-	int rc, i, n;
+	int i, running;
 
-	n = tok_paths(&ps, paths);
-	if (n == -1) {
-		warnx("could not parse paths: %s", paths);
+	if ((i = parsejob(line)) == -1)
 		return -1;
-	}
 
-	if (n == 0) {
-		/* default to current path */
-		psp = &path;
-		n = 1;
-	} else {
-		psp = ps;
+	pthread_mutex_lock(&jobmtx);
+	running = bgjobs[i].state == JOBRUNNING;
+	pthread_mutex_unlock(&jobmtx);
+
+	if (!running) {
+		warnx("job %d is already finished", i + 1);
+		return -1;
 	}
 
+	killjob(i);
+
+	return 0;
+}
+
+/*
+ * Wait for all background jobs before exiting. On SIGINT, kill the ones that
+ * are still running.
+ *
+ * Return 0 if all jobs succeeded, -1 otherwise.
+ */
+static int
+endjobs(void)
+{
+	int i, n, rc, state;
+
+	n = 0;
+	pthread_mutex_lock(&jobmtx);
+	for (i = 0; i < MAXJOBS; i++)
+		if (bgjobs[i].state == JOBRUNNING)
+			n++;
+	pthread_mutex_unlock(&jobmtx);
+
+	if (n > 0 && ttyin)
+		warnx("waiting for %d background jobs, interrupt to kill them",
+		    n);
+
+	interrupted = 0;
+
 	rc = 0;
+	for (i = 0; i < MAXJOBS; i++) {
+		pthread_mutex_lock(&jobmtx);
+		state = bgjobs[i].state;
+		pthread_mutex_unlock(&jobmtx);
 
-	for (i = 0; i < n; i++) {
-		if (strlen(psp[i].collname) > 0) {
-			ccoll = mongoc_client_get_collection(client,
-			    psp[i].dbname, psp[i].collname);
-			rc = exec_query(ccoll, "{}", 2, 1);
-			if (ccoll != NULL) {
-				mongoc_collection_destroy(ccoll);
-				ccoll = NULL;
-			}
-		} else if (strlen(psp[i].dbname) > 0) {
-			rc = exec_lscolls(client, psp[i].dbname);
-		} else {
-			rc = exec_lsdbs(client);
-		}
+		if (state == JOBFREE)
+			continue;
 
-		/* assert an error message was printed */
-		if (rc == -1)
-			goto cleanup;
-	}
+		if (waitjob(i) == -1)
+			killjob(i);
 
-cleanup:
-	free(ps);
+		if (reapjob(i, stderr) == -1)
+			rc = -1;
+	}
 
 	return rc;
 }
 
+/*
+ * Execute command with given arguments.
+ *
+ * Return 1 if request to exit, 0 on success, -1 on failure.
+ */
 static int
-exec_drop(const char *paths)
+dispatch_cmd(const char *cmd, const char *allcmds[], const char *line,
+    size_t linelen)
 {
-	path_t *psp, *ps = NULL;
-	mongoc_collection_t *coll;
-	mongoc_database_t *db;
-	bson_error_t error;
-	int rc, i, n;
+	size_t i;
 
-	n = tok_paths(&ps, paths);
-	if (n == -1) {
-		warnx("could not parse paths: %s", paths);
+	if (strcmp("exit", cmd) == 0) {
+		return 1;
+	}
+
+	if (strcmp("help", cmd) == 0) {
+		for (i = 0; allcmds[i] != NULL; i++)
+			printf("%s\n", allcmds[i]);
+
+		return 0;
+	}
+
+	if (strcmp("cd", cmd) == 0)
+		return exec_cd(line);
+
+	if (strcmp("ls", cmd) == 0)
+		return exec_ls(line);
+
+	if (strcmp("drop", cmd) == 0)
+		return exec_drop(line);
+
+	if (strcmp("more", cmd) == 0)
+		return exec_more(line);
+
+	if (strcmp("bulk", cmd) == 0)
+		return exec_bulk(line);
+
+	if (strcmp("jobs", cmd) == 0)
+		return exec_jobs(line);
+
+	if (strcmp("wait", cmd) == 0)
+		return exec_wait(line);
+
+	if (strcmp("kill", cmd) == 0)
+		return exec_kill(line);
+
+	/*
+	 * All the other commands need a database and collection to be
+	 * selected.
+         */
+	if (strlen(path.dbname) == 0) {
+		warnx("no database selected");
 		return -1;
 	}
 
-	if (n == 0) {
-		/* default to current path */
-		psp = &path;
-		n = 1;
-	} else {
-		psp = ps;
+	if (strlen(path.collname) == 0) {
+		warnx("no collection selected");
+		return -1;
 	}
 
-	rc = 0;
+	if (getccoll() == NULL)
+		return -1;
 
-	for (i = 0; i < n; i++) {
-		if (strlen(psp[i].collname) > 0) {	/* drop collection */
-			coll = mongoc_client_get_collection(client,
-			    psp[i].dbname, psp[i].collname);
-			if (!mongoc_collection_drop(coll, &error)) {
-				warnx("failed dropping /%s/%s: %d.%d %s",
-				    psp[i].dbname, psp[i].collname,
-				    error.domain, error.code, error.message);
+	/* a bulk write only holds writes to one collection */
+	if (bulk.op != NULL && (strcmp("insert", cmd) == 0 ||
+	    strcmp("update", cmd) == 0 || strcmp("upsert", cmd) == 0 ||
+	    strcmp("remove", cmd) == 0) &&
+	    (strcmp(bulk.ns.dbname, path.dbname) != 0 ||
+	    strcmp(bulk.ns.collname, path.collname) != 0)) {
+		warnx("bulk write begun on /%s/%s", bulk.ns.dbname,
+		    bulk.ns.collname);
+		return -1;
+	}
 
-				// ignore 5.26 ns not found
-				if (error.domain != 5 || error.code != 26)
-					rc = -1;
-			} else {
-				printf("dropped /%s/%s\n", psp[i].dbname,
-				    psp[i].collname);
-			}
-			if (coll != NULL) {
-				mongoc_collection_destroy(coll);
-				coll = NULL;
-			}
-		} else if (strlen(psp[i].dbname) > 0) {
-			db = mongoc_client_get_database(client, psp[i].dbname);
-			if (!mongoc_database_drop(db, &error)) {
-				warnx("failed dropping /%s: %d.%d %s",
-				    psp[i].dbname, error.domain, error.code,
-				    error.message);
-				rc = -1;
-			} else {
-				printf("dropped /%s\n", psp[i].dbname);
-			}
-			mongoc_database_destroy(db);
-			db = NULL;
-		} else {
-			warnx("can't drop all databases at once");
-			rc = -1;
-		}
+	/* commands that may create the current collection */
+	if (strcmp("bench", cmd) == 0 || strcmp("insert", cmd) == 0 ||
+	    strcmp("upsert", cmd) == 0)
+		touchns(path.dbname, path.collname);
 
-		if (rc != 0) {
-			rc = -1;
-			goto cleanup;
+	return dispatch_collcmd(ccoll, cmd, line, linelen);
+}
+
+/*
+ * Record a latency of "us" microseconds in the histogram named "name" in "l".
+ * The histogram is created on first use.
+ *
+ * Return 0 on success, -1 on failure with errno set.
+ */
+static int
+record(struct latencies *l, const char *name, uint64_t us)
+{
+	struct latency **v, *lat;
+	size_t i;
+
+	for (i = 0; i < l->n; i++)
+		if (strcmp(l->v[i]->name, name) == 0)
+			break;
+
+	if (i == l->n) {
+		if ((v = reallocarray(l->v, l->n + 1, sizeof(*v))) == NULL)
+			return -1;
+		l->v = v;
+
+		if ((lat = malloc(sizeof(*lat))) == NULL)
+			return -1;
+
+		if ((lat->name = strdup(name)) == NULL) {
+			free(lat);
+			return -1;
 		}
+
+		histogram_init(&lat->hist);
+		l->v[l->n++] = lat;
 	}
 
-cleanup:
-	free(ps);
+	histogram_add(&l->v[i]->hist, us);
+
+	return 0;
+}
+
+static void
+freelatencies(struct latencies *l)
+{
+	size_t i;
+
+	for (i = 0; i < l->n; i++) {
+		free(l->v[i]->name);
+		free(l->v[i]);
+	}
+	free(l->v);
+	l->v = NULL;
+	l->n = 0;
+}
+
+/*
+ * Print the number of samples and the latency distribution in milliseconds of
+ * each histogram in "l", preceded by a header with "title".
+ */
+static void
+printlatencies(FILE *fp, const struct latencies *l, const char *title)
+{
+	const struct histogram *h;
+	size_t i;
+
+	fprintf(fp, "%8s %9s %9s %9s %9s %9s  %s\n", "n", "mean", "p50", "p90",
+	    "p99", "max", title);
+
+	for (i = 0; i < l->n; i++) {
+		h = &l->v[i]->hist;
+		fprintf(fp, "%8llu %9.3f %9.3f %9.3f %9.3f %9.3f  %s\n",
+		    (unsigned long long)h->n, histogram_mean(h) / 1000.0,
+		    histogram_percentile(h, 50) / 1000.0,
+		    histogram_percentile(h, 90) / 1000.0,
+		    histogram_percentile(h, 99) / 1000.0, h->max / 1000.0,
+		    l->v[i]->name);
+	}
+}
+
+/*
+ * Print how long startup took and the latencies in milliseconds of all commands
+ * and query shapes since.
+ */
+static void
+printstats(FILE *fp)
+{
+	fprintf(fp, "startup %.3f ms\n\n", startup / 1000.0);
+
+	printlatencies(fp, &cmdlat, "command");
+
+	if (shapelat.n > 0) {
+		fprintf(fp, "\n");
+		printlatencies(fp, &shapelat, "query shape");
+	}
+}
+
+/*
+ * Record the latency of command "cmd" that started at timing.start, and of its
+ * query shape if "line" contains JSON.
+ */
+static void
+recordcmd(const char *cmd, const char *line, size_t linelen)
+{
+	char *name;
+	size_t i, namelen;
+	uint64_t us;
+
+	us = bson_get_monotonic_time() - timing.start;
+
+	if (record(&cmdlat, cmd, us) == -1)
+		warn("could not record latency");
+
+	if (strcmp("bench", cmd) == 0)
+		return;
+
+	for (i = 0; jsoncmds[i] != NULL; i++)
+		if (strcmp(cmd, jsoncmds[i]) == 0)
+			break;
+
+	if (jsoncmds[i] == NULL)
+		return;
+
+	if (query_shape_alloc(&shape, &shapesize, line, linelen) == -1)
+		return;
+
+	namelen = strlen(cmd) + 1 + strlen(shape) + 1;
+	if ((name = malloc(namelen)) == NULL) {
+		warn("could not record latency");
+		return;
+	}
+	snprintf(name, namelen, "%s %s", cmd, shape);
+
+	if (record(&shapelat, name, us) == -1)
+		warn("could not record latency");
+
+	free(name);
+}
+
+/*
+ * Determine whether "line" of *linelen bytes ends with a "&" that runs the
+ * command in the background. If so, strip it and the whitespace around it.
+ *
+ * Return 1 if the command runs in the background, 0 if not.
+ */
+static int
+background(const char *line, size_t *linelen)
+{
+	size_t n;
+
+	n = *linelen;
+	while (n > 0 && (line[n - 1] == ' ' || line[n - 1] == '\t'))
+		n--;
+
+	if (n == 0 || line[n - 1] != '&')
+		return 0;
+
+	n--;
+	while (n > 0 && (line[n - 1] == ' ' || line[n - 1] == '\t'))
+		n--;
 
-	return rc;
+	*linelen = n;
+
+	return 1;
 }
 
 /*
- * Execute command with given arguments.
+ * Execute command with given arguments and print the timings afterwards if
+ * timing is on.
  *
  * Return 1 if request to exit, 0 on success, -1 on failure.
  */
 static int
 exec_cmd(const char *cmd, const char *allcmds[], const char *line, size_t linelen)
 {
-	size_t i;
+	int rc, qrc;
 
-	if (strcmp("exit", cmd) == 0) {
-		return 1;
+	if (strcmp("jobs", cmd) != 0 && strcmp("wait", cmd) != 0)
+		notifyjobs();
+
+	/* any other command sees the queued inserts, see queueinsert */
+	qrc = 0;
+	if (strcmp("insert", cmd) != 0)
+		qrc = flushinserts();
+
+	if (background(line, &linelen)) {
+		if (startjob(cmd, line, linelen) == -1)
+			return -1;
+		return qrc;
 	}
 
-	if (strcmp("help", cmd) == 0) {
-		for (i = 0; allcmds[i] != NULL; i++)
-			printf("%s\n", allcmds[i]);
+	if (strcmp("timing", cmd) == 0) {
+		if (exec_timing(line) == -1)
+			return -1;
+		return qrc;
+	}
 
-		return 0;
+	if (strcmp("stats", cmd) == 0) {
+		printstats(stdout);
+		return qrc;
 	}
 
-	if (strcmp("cd", cmd) == 0)
-		return exec_cd(line);
+	interrupted = 0;
 
-	if (strcmp("ls", cmd) == 0)
-		return exec_ls(line);
+	memset(&timing, 0, sizeof(timing));
+	timing.start = bson_get_monotonic_time();
 
-	if (strcmp("drop", cmd) == 0)
-		return exec_drop(line);
+	rc = dispatch_cmd(cmd, allcmds, line, linelen);
 
-	/*
-	 * All the other commands need a database and collection to be
-	 * selected.
-         */
-	if (strlen(path.dbname) == 0) {
-		warnx("no database selected");
-		return -1;
-	}
+	if (rc != 1)
+		recordcmd(cmd, line, linelen);
 
-	if (strlen(path.collname) == 0) {
-		warnx("no collection selected");
-		return -1;
+	if (timingon && rc != 1) {
+		/* keep the order with the output of the command */
+		fflush(stdout);
+		printtiming();
 	}
 
-	if (strcmp("count", cmd) == 0) {
-		return exec_count(ccoll, line, linelen);
-	} else if (strcmp("update", cmd) == 0) {
-		return exec_update(ccoll, line, linelen, 0);
-	} else if (strcmp("upsert", cmd) == 0) {
-		return exec_update(ccoll, line, linelen, 1);
-	} else if (strcmp("insert", cmd) == 0) {
-		return exec_insert(ccoll, line, linelen);
-	} else if (strcmp("remove", cmd) == 0) {
-		return exec_remove(ccoll, line, linelen);
-	} else if (strcmp("find", cmd) == 0) {
-		return exec_query(ccoll, line, linelen, 0);
-	} else if (strcmp("aggregate", cmd) == 0) {
-		return exec_agquery(ccoll, line, linelen);
-	}
+	if (rc == 0 && qrc == -1)
+		rc = -1;
 
-	warnx("unknown command: \"%s\"", line);
-	return -1;
+	return rc;
 }
 
 /*
@@ -1350,18 +5257,22 @@ loaddotfile(char *line, size_t linelen)
 {
 	struct stat st;
 	struct passwd *pw;
+	const char *home;
 	FILE *fp;
 	size_t n;
 
-	if ((pw = getpwuid(getuid())) == NULL) {
-		warn("could not load ~/%s: getpwuid failed", DOTFILE);
-		return -1;
+	if ((home = getenv("HOME")) == NULL || *home == '\0') {
+		if ((pw = getpwuid(getuid())) == NULL) {
+			warn("could not load ~/%s: getpwuid failed", DOTFILE);
+			return -1;
+		}
+		home = pw->pw_dir;
 	}
 
-	n = snprintf(line, linelen, "%s/%s", pw->pw_dir, DOTFILE);
+	n = snprintf(line, linelen, "%s/%s", home, DOTFILE);
 	if (n >= linelen) {
 		warnx("could not load ~/%s: path to homedir too long: %s",
-		    DOTFILE, pw->pw_dir);
+		    DOTFILE, home);
 		return -1;
 	}
 
@@ -1402,8 +5313,9 @@ loaddotfile(char *line, size_t linelen)
 }
 
 /*
- * Handle special import mode, treat each input line as one MongoDB Extended
- * JSON document and force insert command.
+ * Handle special import mode, read a stream of MongoDB Extended JSON documents
+ * and force insert command. Documents may span multiple lines and may be
+ * wrapped in an array, i.e. the output of `mongoexport --jsonArray`.
  *
  * Returns the number of inserted objects on success, or -1 on error with errno
  * set.
@@ -1411,52 +5323,64 @@ loaddotfile(char *line, size_t linelen)
 static int
 do_import(mongoc_collection_t *collection)
 {
+	struct jsonstream js;
 	bson_error_t error;
 	bson_t *docs[BULKINSERTMAX];
-	char *line;
-	ssize_t r;
-	size_t n, j;
-	int i;
+	char buf[READCHUNK];
+	const char *obj;
+	size_t n, objlen, j;
+	int i, r;
 
 	for (j = 0; j < BULKINSERTMAX; j++)
 		docs[j] = bson_new();
 
-	line = NULL;
-	n = 0;
+	jsonstream_init(&js);
+
 	i = 0;
 	j = 0;
-	while ((r = getline(&line, &n, stdin)) != -1) {
-		if (r > 0 && line[r - 1] == '\n') {
-			line[r - 1] = '\0';
-			r--;
+	while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0) {
+		if (jsonstream_feed(&js, buf, n) == -1) {
+			i = -1;
+			goto exit;
 		}
 
-		if (r == 0)
-			continue;
-
-		if (bson_init_from_json(docs[j], line, r, &error) == false) {
-			warnx("%d.%d %s: %s", error.domain, error.code,
-			    error.message, line);
-			continue;
-		}
+		while ((r = jsonstream_next(&js, &obj, &objlen)) != 0) {
+			if (r == -1) {
+				warnx("skipping line that does not start with a "
+				    "JSON object");
+				continue;
+			}
 
-		j++;
+			if (bson_init_from_json(docs[j], obj, objlen, &error)
+			    == false) {
+				warnx("%d.%d %s: %.*s", error.domain,
+				    error.code, error.message, (int)objlen,
+				    obj);
+				continue;
+			}
 
-		if (j == BULKINSERTMAX) {
-			// show warning, but make sure to always reset j
-			if (mongoc_collection_insert_many(collection,
-			    (const bson_t **)docs, j, NULL, NULL, &error) ==
-			    false) {
-				warnx("insert error: %d.%d %s", error.domain,
-				    error.code, error.message);
+			j++;
+
+			if (j == BULKINSERTMAX) {
+				// show warning, but make sure to always reset j
+				if (mongoc_collection_insert_many(collection,
+				    (const bson_t **)docs, j, NULL, NULL,
+				    &error) == false) {
+					warnx("insert error: %d.%d %s",
+					    error.domain, error.code,
+					    error.message);
+					j = 0;
+					continue;
+				}
+				i += j;
 				j = 0;
-				continue;
 			}
-			i += j;
-			j = 0;
 		}
 	}
 
+	if (jsonstream_pending(&js))
+		warnx("skipping incomplete JSON document at end of input");
+
 	if (j > 0) {
 		if (mongoc_collection_insert_many(collection,
 		    (const bson_t **)docs, j, NULL, NULL, &error) == false) {
@@ -1476,7 +5400,7 @@ do_import(mongoc_collection_t *collection)
 	}
 
 exit:
-	free(line);
+	jsonstream_free(&js);
 	for (j = 0; j < BULKINSERTMAX; j++)
 		bson_destroy(docs[j]);
 
@@ -1493,29 +5417,218 @@ printversion(int d)
 static void
 printusage(int d)
 {
-	dprintf(d, "usage: %s [-p] [/database/collection]\n", progname);
-	dprintf(d, "       %s [-s] [/database/collection]\n", progname);
-	dprintf(d, "       %s -i /database/collection\n", progname);
+	dprintf(d, "usage: %s [-p] [-c file] [-e command] [-t file] "
+	    "[/database/collection]\n", progname);
+	dprintf(d, "       %s [-s] [-c file] [-e command] [-t file] "
+	    "[/database/collection]\n", progname);
+	dprintf(d, "       %s [-c file] [-t file] -i /database/collection\n",
+	    progname);
 	dprintf(d, "       %s -V\n", progname);
 	dprintf(d, "       %s -h\n", progname);
 }
 
+/*
+ * Set up editline and its history, load the user defaults from editrc(5) and
+ * bind tab completion. Only used when stdin is a terminal.
+ */
+static void
+initeditline(EditLine **e, History **h)
+{
+	HistEvent he;
+	int i;
+
+	if ((*e = el_init(progname, stdin, stdout, stderr)) == NULL)
+		errx(1, "can't initialize editline");
+
+	if ((*h = history_init()) == NULL)
+		errx(1, "can't initialize history");
+
+	if (history(*h, &he, H_SETSIZE, 100) == -1)
+		warnx("could not set history size: %d %s", he.num, he.str);
+
+	if (history(*h, &he, H_SETUNIQUE, 1) == -1)
+		warnx("could not set history unique flag: %d %s", he.num,
+		    he.str);
+
+	if (el_set(*e, EL_HIST, history, *h) == -1)
+		warnx("could not set history function");
+
+	if (el_set(*e, EL_PROMPT, prompt) == -1)
+		warnx("could not set prompt function");
+
+	if (el_set(*e, EL_EDITOR, "emacs") == -1)
+		warnx("could not set editor mode");
+
+	if (el_set(*e, EL_TERMINAL, NULL) == -1)
+		warnx("could not initialize terminal");
+
+	/* load user defaults */
+	if (el_source(*e, NULL) == -1)
+		if (backup_el_source(*e) == -1) // backup for broken editline on Debian 10
+			warnx("sourcing .editrc failed");
+
+	/* override tab binding */
+	if (el_set(*e, EL_ADDFN, "complete", "tab completion", complete) == -1)
+		warnx("could not set tab completion function");
+
+	if (el_set(*e, EL_BIND, "\t", "complete", NULL) == -1)
+		warnx("could not bind tab for tab completion");
+
+	if (el_get(*e, EL_EDITMODE, &i) == -1)
+		warnx("can't determine editline status");
+
+	if (i == 0)
+		warnx("editline disabled");
+}
+
+/*
+ * Read the next line into *line without the trailing newline using editline
+ * "e". Scripts use a linereader instead.
+ *
+ * Return the length of the line, -1 at the end of the input or -2 if ^C was
+ * pressed. Exit on read errors.
+ */
+static ssize_t
+readtty(EditLine *e, char **line, size_t *linesize)
+{
+	const wchar_t *wline;
+	size_t n;
+	int read;
+
+	for (;;) {
+		if ((wline = el_wgets(e, &read)) == NULL) {
+			if (read == -1 && errno == EINTR)
+				return -2;
+			if (read == -1)
+				err(1, NULL);
+			return -1;
+		}
+
+		n = wcstombs(NULL, wline, 0);
+		if (n == (size_t)-1) {
+			warnx("could not convert line to a multibyte string");
+			continue;
+		}
+
+		if (growbuf(line, linesize, n + 1) == -1)
+			err(1, "growbuf");
+
+		n = wcstombs(*line, wline, *linesize);
+
+		if (n == 0)
+			continue;
+
+		/*
+		 * Trim trailing newline if any (might error on exotic, non-C
+		 * and non-UTF8 locales).
+		 */
+		if ((*line)[n - 1] == '\n')
+			(*line)[--n] = '\0';
+
+		return n;
+	}
+}
+
+/*
+ * Run the complete command in "line", which may be abbreviated. "line" is
+ * modified. "e" is used to complete the command name and may be NULL.
+ *
+ * Return 1 if request to exit, 0 on success, -1 on failure.
+ */
+static int
+runline(EditLine *e, char *line)
+{
+	const char *cmd, *args;
+	size_t n;
+
+	/*
+	 * Parse command and let args point to the first token after
+	 * the command.
+	 */
+	n = nexttok((const char **)&line);
+
+	if (n == 0)
+		return 0;
+
+	cmd = line;
+	if (line[n] == '\0') {
+		args = "";
+	} else {
+		args = &line[n];
+		nexttok(&args);
+		line[n] = '\0';
+	}
+
+	/* "e" and "ex" abbreviated exit before explain was added */
+	if (n <= 2 && strncmp(cmd, "exit", n) == 0) {
+		cmd = "exit";
+	} else if (complete_word(e, cmd, n, &cmdindex, &cmd) == 0) {
+		warnx("unknown command: \"%s\"", cmd);
+		return -1;
+	}
+
+	/*
+	 * Assert each command prints a detailed error for the user if
+	 * needed.
+	 */
+	return exec_cmd(cmd, cmds, args, strlen(args));
+}
+
+/*
+ * Run each command in "cmdv", which are modified, until one requests to exit or
+ * stdout is closed.
+ *
+ * Return 0 if all commands succeeded, -1 otherwise.
+ */
+static int
+runargs(char **cmdv, size_t n)
+{
+	size_t i;
+	int rc, failed;
+
+	failed = 0;
+	for (i = 0; i < n; i++) {
+		rc = runline(NULL, cmdv[i]);
+
+		if (rc == -1)
+			failed = 1;
+
+		if (rc == 1 || outclosed || checkout() == -1)
+			break;
+	}
+
+	if (flushinserts() == -1)
+		failed = 1;
+
+	if (dropbulk() == -1)
+		failed = 1;
+
+	if (endjobs() == -1)
+		failed = 1;
+
+	return failed ? -1 : 0;
+}
+
 int
 main(int argc, char **argv)
 {
+	struct linereader lr;
 	bson_error_t error;
-	const wchar_t *line;
-	const char *cmd, *args;
 	char p[PATH_MAX];
-	char connurl[MAXMONGOURL];
-	char linecpy[MAXLINE], *lp;
-	size_t n;
-	int i, read, c;
+	char *line, *linecpy, *lp, *mlbuf, *tracefile, **cmdv;
+	size_t mllen, linecpysize, ncmdv;
+	ssize_t n;
+	int i, c, status;
+	int64_t t0;
 	EditLine *e;
 	History *h;
 	HistEvent he;
 	path_t newpath = {"", ""};
 
+	t0 = bson_get_monotonic_time();
+
+	outfp = stdout;
+
 	setlocale(LC_CTYPE, "");
 
 	assert((MB_CUR_MAX) > 0 && (MB_CUR_MAX) < 8);
@@ -1523,9 +5636,15 @@ main(int argc, char **argv)
 	if (strlcpy(progname, basename(argv[0]), MAXPROG) >= MAXPROG)
 		errx(1, "program name too long: %s", argv[0]);
 
+	if (pmindex_build(&cmdindex, cmds) == -1)
+		err(1, "pmindex_build");
+
 	if (isatty(STDIN_FILENO))
 		ttyin = 1;
 
+	/* detect a closed stdout with EPIPE, see checkout */
+	signal(SIGPIPE, SIG_IGN);
+
 	if (isatty(STDOUT_FILENO))
 		ttyout = 1;
 
@@ -1533,8 +5652,21 @@ main(int argc, char **argv)
 	if (ttyout)
 		hr = 1;
 
-	while ((c = getopt(argc, argv, "Vhips")) != -1) {
+	tracefile = NULL;
+	cmdv = NULL;
+	ncmdv = 0;
+
+	while ((c = getopt(argc, argv, "Vc:e:hipst:")) != -1) {
 		switch (c) {
+		case 'c':
+			cachefile = optarg;
+			break;
+		case 'e':
+			cmdv = reallocarray(cmdv, ncmdv + 1, sizeof(*cmdv));
+			if (cmdv == NULL)
+				err(1, "reallocarray");
+			cmdv[ncmdv++] = optarg;
+			break;
 		case 'p':
 			hr = 1;
 			break;
@@ -1544,6 +5676,9 @@ main(int argc, char **argv)
 		case 'i':
 			import = 1;
 			break;
+		case 't':
+			tracefile = optarg;
+			break;
 		case 'V':
 			printversion(STDOUT_FILENO);
 			exit(0);
@@ -1559,11 +5694,15 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc > 1) {
+	if (argc > 1 || (ncmdv > 0 && import)) {
 		printusage(STDERR_FILENO);
 		exit(1);
 	}
 
+	/* the commands come from the arguments, stdin is not used */
+	if (ncmdv > 0)
+		ttyin = 0;
+
 	if (PATH_MAX < 20)
 		errx(1, "can't determine PATH_MAX");
 
@@ -1573,11 +5712,15 @@ main(int argc, char **argv)
 			errx(1, "url in config too long");
 	}
 
-	/* setup mongo */
-	mongoc_init();
-	if ((client = mongoc_client_new(connurl)) == NULL)
-		errx(1, "can't connect to mongo using connection string \"%s\"",
-		    connurl);
+	/* the client is created by the first command that needs it */
+	if (tracefile != NULL && traceopen(tracefile) == -1)
+		exit(1);
+
+	nscache_init(&nscache, NSCACHETTL);
+	cacheload();
+
+	/* the database names are needed for the first tab in any case */
+	prefetch(NULL);
 
 	if (argc == 1) {
 		p[0] = '/';
@@ -1588,7 +5731,7 @@ main(int argc, char **argv)
 		if (parse_path(&newpath, p) == -1)
 			errx(1, "parse_path error: %s", argv[0]);
 
-		if (exec_chcoll(client, newpath) == -1)
+		if (exec_chcoll(newpath) == -1)
 			errx(1, "can't change to %s", argv[0]);
 	}
 
@@ -1597,15 +5740,21 @@ main(int argc, char **argv)
 	 * line.
 	 */
 	if (import) {
-		if (ccoll == NULL)
+		if (strlen(path.collname) == 0)
 			errx(1, "database/collection path required in import mode");
 
+		if (getccoll() == NULL)
+			exit(1);
+
 		i = do_import(ccoll);
 		if (i == -1)
 			err(1, NULL);
 
 		printf("inserted %d documents\n", i);
 
+		cachesave();
+		nscache_free(&nscache);
+
 		if (ccoll != NULL) {
 			mongoc_collection_destroy(ccoll);
 			ccoll = NULL;
@@ -1616,6 +5765,8 @@ main(int argc, char **argv)
 
 		mongoc_cleanup();
 
+		traceclose();
+
 		exit(0);
 	}
 
@@ -1632,114 +5783,144 @@ main(int argc, char **argv)
 		errx(1, "could not load project id document: %d.%d %s",
 		    error.domain, error.code, error.message);
 
-	/* init editline */
-	if ((e = el_init(progname, stdin, stdout, stderr)) == NULL)
-		errx(1, "can't initialize editline");
-
-	if ((h = history_init()) == NULL)
-		errx(1, "can't initialize history");
-
-	if (history(h, &he, H_SETSIZE, 100) == -1)
-		warnx("could not set history size: %d %s", he.num, he.str);
-
-	if (history(h, &he, H_SETUNIQUE, 1) == -1)
-		warnx("could not set history unique flag: %d %s", he.num,
-		    he.str);
+	mlbuf = NULL;
+	mllen = 0;
 
-	if (el_set(e, EL_HIST, history, h) == -1)
-		warnx("could not set history function");
+	linecpy = NULL;
+	linecpysize = 0;
 
-	if (el_set(e, EL_PROMPT, prompt) == -1)
-		warnx("could not set prompt function");
+	e = NULL;
+	h = NULL;
+	linereader_init(&lr, STDIN_FILENO);
 
-	if (el_set(e, EL_EDITOR, "emacs") == -1)
-		warnx("could not set editor mode");
+	status = 0;
+	if (ncmdv > 0) {
+		startup = bson_get_monotonic_time() - t0;
+		if (runargs(cmdv, ncmdv) == -1)
+			status = 1;
+		goto done;
+	}
 
-	if (el_set(e, EL_TERMINAL, NULL) == -1)
-		warnx("could not initialize terminal");
+	/*
+	 * Scripts do not need line editing, history or completion, their lines
+	 * are split in place in big blocks read from stdin.
+	 */
+	if (ttyin)
+		initeditline(&e, &h);
 
-	/* load user defaults */
-	if (el_source(e, NULL) == -1)
-		if (backup_el_source(e) == -1) // backup for broken editline on Debian 10
-			warnx("sourcing .editrc failed");
+	/* let ^C interrupt commands instead of exiting */
+	if (ttyin && intrsetup() == -1)
+		warnx("could not set SIGINT handler");
 
-	/* override tab binding */
-	if (el_set(e, EL_ADDFN, "complete", "tab completion", complete) == -1)
-		warnx("could not set tab completion function");
+	startup = bson_get_monotonic_time() - t0;
 
-	if (el_set(e, EL_BIND, "\t", "complete", NULL) == -1)
-		warnx("could not bind tab for tab completion");
+	for (;;) {
+		if (e != NULL) {
+			n = readtty(e, &linecpy, &linecpysize);
+			line = linecpy;
+		} else {
+			/* don't hold inserts back while the script is idle */
+			if (!linereader_ready(&lr))
+				flushinserts();
 
-	if (el_get(e, EL_EDITMODE, &i) == -1)
-		warnx("can't determine editline status");
+			if ((n = linereader_next(&lr, &line)) == -2)
+				err(1, "read");
+		}
 
-	if (i == 0)
-		warnx("editline disabled");
+		if (n == -1)
+			break;
 
-	while ((line = el_wgets(e, &read)) != NULL) {
-		linecpy[0] = '\0';
-		n = wcstombs(linecpy, line, sizeof(linecpy));
-		if (n == (size_t)-1 || n == sizeof(linecpy)) {
-			warnx("linecpy too short: %ld bytes needed, have %ld",
-			    wcstombs(NULL, line, 0) + 1, sizeof(linecpy));
+		/* discard the current command on ^C like a shell */
+		if (n == -2) {
+			interrupted = 0;
+			free(mlbuf);
+			mlbuf = NULL;
+			contline = 0;
+			printf("\n");
 			continue;
 		}
 
-		if (n == 0)
+		if (n == 0 && mlbuf == NULL)
 			continue;
 
-		/*
-		 * Trim trailing newline if any (might error on exotic, non-C
-		 * and non-UTF8 locales).
-		 */
-		if (linecpy[n - 1] == '\n') {
-			linecpy[n - 1] = '\0';
-			n--;
+		/* join continuation lines of a multi-line command */
+		if (mlbuf != NULL) {
+			if ((lp = realloc(mlbuf, mllen + 1 + n + 1)) == NULL)
+				err(1, "realloc multi-line buffer");
+			mlbuf = lp;
+			mlbuf[mllen++] = '\n';
+			memcpy(mlbuf + mllen, line, n + 1);
+			mllen += n;
+			lp = mlbuf;
+		} else {
+			lp = line;
 		}
 
-		if (n == 0)
+		if (needsmore(lp)) {
+			if (mlbuf == NULL) {
+				if ((mlbuf = strdup(line)) == NULL)
+					err(1, "strdup multi-line buffer");
+				mllen = n;
+			}
+			contline = 1;
 			continue;
+		}
+		contline = 0;
 
-		if (history(h, &he, H_ENTER, linecpy) == -1)
+		if (h != NULL && history(h, &he, H_ENTER, lp) == -1)
 			warnx("can't add line to history: %d %s", he.num,
 			    he.str);
 
-		/*
-		 * Parse command and let args point to the first token after
-		 * the command.
-		 */
-		lp = linecpy;
-		n = nexttok((const char **)&lp);
+		i = runline(e, lp);
 
-		if (n == 0)
-			continue;
+		free(mlbuf);
+		mlbuf = NULL;
 
-		cmd = lp;
-		if (lp[n] == '\0') {
-			args = "";
-		} else {
-			args = &lp[n];
-			nexttok(&args);
-			lp[n] = '\0';
-		}
+		/* don't hold on to the memory of exceptionally large commands */
+		shrinkbuf(&linecpy, &linecpysize);
+		shrinkbuf(&tmpdocs, &tmpdocssize);
+		shrinkbuf(&updatedoc, &updatedocsize);
+		shrinkbuf(&shape, &shapesize);
 
-		i = complete_word(e, cmd, n, cmds, &cmd);
-		if (i == 0) {
-			warnx("unknown command: \"%s\"", cmd);
-			continue;
-		}
+		if (i == 1)
+			break;
 
-		/*
-		 * Assert each command prints a detailed error for the user if
-		 * needed.
-		 */
-		if (exec_cmd(cmd, cmds, args, strlen(args)) == 1) {
+		/* stop if nobody reads the output anymore */
+		if (outclosed || checkout() == -1)
 			break;
-		}
 	}
 
-	if (read == -1)
-		err(1, NULL);
+	flushinserts();
+	dropbulk();
+	endjobs();
+
+done:
+	if (mlbuf != NULL) {
+		warnx("incomplete multi-line command: %s", mlbuf);
+		free(mlbuf);
+		mlbuf = NULL;
+	}
+
+	free(linecpy);
+	linecpy = NULL;
+
+	free(tmpdocs);
+	tmpdocs = NULL;
+
+	free(updatedoc);
+	updatedoc = NULL;
+
+	/* a script that turned timing on gets the totals, -e never does */
+	if (!ttyin && ncmdv == 0 && timingon && cmdlat.n > 0)
+		printstats(stderr);
+
+	freelatencies(&cmdlat);
+	freelatencies(&shapelat);
+
+	free(shape);
+	shape = NULL;
+
+	pmindex_free(&cmdindex);
 
 	bson_destroy(bsonprojectid);
 	bsonprojectid = NULL;
@@ -1747,21 +5928,42 @@ main(int argc, char **argv)
 	bson_destroy(bsonupsertopt);
 	bsonupsertopt = NULL;
 
+	pagerclose();
+
+	prefetchstop();
+	freeschemas();
+	cachesave();
+	nscache_free(&nscache);
+
 	if (ccoll != NULL) {
 		mongoc_collection_destroy(ccoll);
 		ccoll = NULL;
 	}
 
-	mongoc_client_destroy(client);
-	client = NULL;
+	if (client != NULL) {
+		mongoc_client_destroy(client);
+		client = NULL;
+	}
+
+	if (pool != NULL) {
+		mongoc_client_pool_destroy(pool);
+		pool = NULL;
+	}
+
+	if (mongoinited)
+		mongoc_cleanup();
 
-	mongoc_cleanup();
+	traceclose();
 
-	history_end(h);
-	el_end(e);
+	if (e != NULL) {
+		history_end(h);
+		el_end(e);
+	}
+	linereader_free(&lr);
+	free(cmdv);
 
 	if (ttyin)
 		printf("\n");
 
-	return 0;
+	return status;
 }
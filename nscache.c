@@ -0,0 +1,344 @@
+/**
+ * Copyright (c) 2026 Tim Kuijsten
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "nscache.h"
+
+#define MAGIC "mongovi nscache 2\n"
+#define MAXNAME 1024	/* longest name accepted from a cache file */
+#define MAXNAMES 1000000	/* most names per entry in a cache file */
+
+static void
+freenames(char **names)
+{
+	size_t i;
+
+	if (names == NULL)
+		return;
+
+	for (i = 0; names[i] != NULL; i++)
+		free(names[i]);
+	free(names);
+}
+
+static int
+cmpname(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Return a sorted copy of the NULL terminated list "names" and set *n to the
+ * number of names, or return NULL on failure.
+ */
+static char **
+copynames(char *const *names, size_t *n)
+{
+	char **cp;
+	size_t i;
+
+	for (*n = 0; names[*n] != NULL; (*n)++)
+		;
+
+	if ((cp = calloc(*n + 1, sizeof(*cp))) == NULL)
+		return NULL;
+
+	for (i = 0; i < *n; i++) {
+		if ((cp[i] = strdup(names[i])) == NULL) {
+			freenames(cp);
+			return NULL;
+		}
+	}
+
+	qsort(cp, *n, sizeof(*cp), cmpname);
+
+	return cp;
+}
+
+/*
+ * Return whether "s" starts with "prefix".
+ */
+static int
+startswith(const char *s, const char *prefix)
+{
+	return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+/*
+ * Remove entry "i" by moving the last entry in its place.
+ */
+static void
+removeentry(struct nscache *c, size_t i)
+{
+	struct nsentry *e;
+
+	e = &c->entries[i];
+	free(e->key);
+	free(e->prefix);
+	freenames(e->names);
+	c->entries[i] = c->entries[--c->nentries];
+}
+
+void
+nscache_init(struct nscache *c, time_t ttl)
+{
+	memset(c, 0, sizeof(*c));
+	c->ttl = ttl;
+}
+
+/*
+ * Return the names stored under "key" that include all names that start with
+ * "prefix", in strcmp(3) order, and set *n to the number of names, if "n" is
+ * not NULL. These are the names of the entry with the longest prefix that
+ * "prefix" starts with, so the list may contain other names as well. Return
+ * NULL if there is no such entry or if it expired at time "now". The names are
+ * valid until the cache is modified.
+ */
+char **
+nscache_get(const struct nscache *c, const char *key, const char *prefix,
+    time_t now, size_t *n)
+{
+	struct nsentry *e, *best;
+	size_t i;
+
+	best = NULL;
+	for (i = 0; i < c->nentries; i++) {
+		e = &c->entries[i];
+		if (strcmp(e->key, key) != 0 || !startswith(prefix, e->prefix))
+			continue;
+
+		/* also expire if the clock went back */
+		if (now < e->fetched || now - e->fetched >= c->ttl)
+			continue;
+
+		if (best == NULL || strlen(e->prefix) > strlen(best->prefix))
+			best = e;
+	}
+
+	if (best == NULL)
+		return NULL;
+
+	if (n != NULL)
+		*n = best->nnames;
+
+	return best->names;
+}
+
+/*
+ * Store a sorted copy of the NULL terminated list "names" under "key", fetched
+ * at time "now". "names" must contain all names under "key" that start with
+ * "prefix", "" means all names. Any names stored under "key" with a prefix
+ * that starts with "prefix" are replaced.
+ *
+ * Return 0 on success, -1 on failure with errno set.
+ */
+int
+nscache_put(struct nscache *c, const char *key, const char *prefix,
+    char *const *names, time_t now)
+{
+	struct nsentry *e, *entries;
+	char **cp, *k, *p;
+	size_t i, n;
+
+	if ((cp = copynames(names, &n)) == NULL)
+		return -1;
+
+	entries = realloc(c->entries, (c->nentries + 1) * sizeof(*entries));
+	if (entries == NULL) {
+		freenames(cp);
+		return -1;
+	}
+	c->entries = entries;
+
+	k = strdup(key);
+	p = strdup(prefix);
+	if (k == NULL || p == NULL) {
+		free(k);
+		free(p);
+		freenames(cp);
+		return -1;
+	}
+
+	/* drop the entries that the new one covers */
+	for (i = 0; i < c->nentries; ) {
+		e = &c->entries[i];
+		if (strcmp(e->key, key) == 0 && startswith(e->prefix, prefix))
+			removeentry(c, i);
+		else
+			i++;
+	}
+
+	e = &c->entries[c->nentries++];
+	e->key = k;
+	e->prefix = p;
+	e->names = cp;
+	e->nnames = n;
+	e->fetched = now;
+
+	return 0;
+}
+
+/*
+ * Remove the names stored under "key", or all names if "key" is NULL.
+ */
+void
+nscache_invalidate(struct nscache *c, const char *key)
+{
+	size_t i;
+
+	for (i = 0; i < c->nentries; ) {
+		if (key == NULL || strcmp(c->entries[i].key, key) == 0)
+			removeentry(c, i);
+		else
+			i++;
+	}
+}
+
+/*
+ * Read a string of "len" bytes followed by a newline from "fp".
+ *
+ * Return the string on success or NULL on failure.
+ */
+static char *
+readstr(FILE *fp, size_t len)
+{
+	char *s;
+
+	if (len > MAXNAME)
+		return NULL;
+
+	if ((s = malloc(len + 1)) == NULL)
+		return NULL;
+
+	if (fread(s, 1, len, fp) != len || getc(fp) != '\n' ||
+	    memchr(s, '\0', len) != NULL) {
+		free(s);
+		return NULL;
+	}
+	s[len] = '\0';
+
+	return s;
+}
+
+/*
+ * Add all entries written by nscache_save from "fp". Entries that are already
+ * in the cache are replaced. The cache is left empty if "fp" is malformed.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+int
+nscache_load(struct nscache *c, FILE *fp)
+{
+	char magic[sizeof(MAGIC)], **names, *key, *prefix;
+	long long fetched;
+	size_t i, n, len;
+	int r;
+
+	key = NULL;
+	prefix = NULL;
+	names = NULL;
+
+	if (fread(magic, 1, sizeof(MAGIC) - 1, fp) != sizeof(MAGIC) - 1 ||
+	    memcmp(magic, MAGIC, sizeof(MAGIC) - 1) != 0)
+		goto err;
+
+	/*
+	 * An entry is "fetched nnames keylen:key\n" and "len:prefix\n" followed
+	 * by "len:name\n" for each name.
+	 */
+	while ((r = fscanf(fp, "%lld %zu %zu:", &fetched, &n, &len)) == 3) {
+		if (n > MAXNAMES || (key = readstr(fp, len)) == NULL)
+			goto err;
+
+		if (fscanf(fp, "%zu:", &len) != 1 ||
+		    (prefix = readstr(fp, len)) == NULL)
+			goto err;
+
+		if ((names = calloc(n + 1, sizeof(*names))) == NULL)
+			goto err;
+
+		for (i = 0; i < n; i++)
+			if (fscanf(fp, "%zu:", &len) != 1 ||
+			    (names[i] = readstr(fp, len)) == NULL)
+				goto err;
+
+		if (nscache_put(c, key, prefix, names, fetched) == -1)
+			goto err;
+
+		free(key);
+		key = NULL;
+		free(prefix);
+		prefix = NULL;
+		freenames(names);
+		names = NULL;
+	}
+
+	if (r == EOF && !ferror(fp))
+		return 0;
+
+err:
+	free(key);
+	free(prefix);
+	freenames(names);
+	nscache_invalidate(c, NULL);
+
+	return -1;
+}
+
+/*
+ * Write all entries to "fp" in a format that can be read by nscache_load.
+ *
+ * Return 0 on success, -1 on failure.
+ */
+int
+nscache_save(const struct nscache *c, FILE *fp)
+{
+	const struct nsentry *e;
+	size_t i, j, n;
+
+	fputs(MAGIC, fp);
+
+	for (i = 0; i < c->nentries; i++) {
+		e = &c->entries[i];
+
+		for (n = 0; e->names[n] != NULL; n++)
+			;
+
+		fprintf(fp, "%lld %zu %zu:%s\n%zu:%s\n", (long long)e->fetched,
+		    n, strlen(e->key), e->key, strlen(e->prefix), e->prefix);
+
+		for (j = 0; j < n; j++)
+			fprintf(fp, "%zu:%s\n", strlen(e->names[j]),
+			    e->names[j]);
+	}
+
+	return ferror(fp) ? -1 : 0;
+}
+
+/*
+ * Release all memory of the cache. It can be reused after nscache_init.
+ */
+void
+nscache_free(struct nscache *c)
+{
+	nscache_invalidate(c, NULL);
+	free(c->entries);
+	c->entries = NULL;
+}
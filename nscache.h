@@ -0,0 +1,57 @@
+/**
+ * Copyright (c) 2026 Tim Kuijsten
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef NSCACHE_H
+#define NSCACHE_H
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * The names of all databases, or of all collections in one database, that
+ * start with a prefix.
+ */
+struct nsentry {
+	char *key;	/* "" for databases, otherwise the database name */
+	char *prefix;	/* "" for all names */
+	char **names;	/* sorted and NULL terminated */
+	size_t nnames;
+	time_t fetched;
+};
+
+/*
+ * Cache of database and collection names so that tab completion does not need
+ * a round trip to the server on every key press. Entries expire after "ttl"
+ * seconds.
+ */
+struct nscache {
+	struct nsentry *entries;
+	size_t nentries;
+	time_t ttl;
+};
+
+void nscache_init(struct nscache *c, time_t ttl);
+char **nscache_get(const struct nscache *c, const char *key,
+    const char *prefix, time_t now, size_t *n);
+int nscache_put(struct nscache *c, const char *key, const char *prefix,
+    char *const *names, time_t now);
+void nscache_invalidate(struct nscache *c, const char *key);
+int nscache_load(struct nscache *c, FILE *fp);
+int nscache_save(const struct nscache *c, FILE *fp);
+void nscache_free(struct nscache *c);
+
+#endif
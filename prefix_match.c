@@ -18,6 +18,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "prefix_match.h"
+
 /*
  * Match all strings in "src" that start with "prefix".
  *
@@ -28,37 +30,58 @@
  * into "src" that match "prefix". On success "matches" must be free(3)d by the
  * caller.
  *
+ * For repeated queries on a big list, see pmindex_build.
+ *
  * Return 0 on success, -1 on reallocarray error.
 */
 int
 prefix_match(const char ***matches, const char **src, const char *prefix)
 {
-	int i, listsize, prefsize;
+	size_t i, n, prefsize;
 
 	prefsize = strlen(prefix);
 
-	listsize = 1;
-	if ((*matches = reallocarray(NULL, listsize, sizeof(char **))) == NULL)
+	/* count first so that the list is allocated only once */
+	n = 0;
+	for (i = 0; src != NULL && src[i] != NULL; i++)
+		if (strncmp(prefix, src[i], prefsize) == 0)
+			n++;
+
+	if ((*matches = reallocarray(NULL, n + 1, sizeof(char **))) == NULL)
 		return -1;
-	(*matches)[listsize - 1] = NULL;
 
-	if (src == NULL)
-		return 0;
+	n = 0;
+	for (i = 0; src != NULL && src[i] != NULL; i++)
+		if (strncmp(prefix, src[i], prefsize) == 0)
+			(*matches)[n++] = src[i];
+	(*matches)[n] = NULL;
 
-	for (i = 0; src[i] != NULL; i++) {
-		if (strncmp(prefix, src[i], prefsize) != 0)
-			continue;
+	return 0;
+}
 
-		listsize++;
-		if ((*matches = reallocarray(*matches, listsize, sizeof(char **))) == NULL) {
-			free(*matches);
+/*
+ * Return the number of bytes of the longest prefix of "s" that is at most
+ * "max" bytes and consists of whole characters, or -1 if "s" contains an
+ * invalid character before that.
+ */
+static int
+mbprefix(const char *s, size_t max)
+{
+	int j, n;
+
+	mblen(NULL, MB_CUR_MAX);
+
+	j = 0;
+	for (;;) {
+		n = mblen(&s[j], MB_CUR_MAX);
+		if (n == -1)
 			return -1;
-		}
-		(*matches)[listsize - 2] = (char *)src[i];
-		(*matches)[listsize - 1] = NULL;
-	}
 
-	return 0;
+		if (n == 0 || (size_t)j + n > max)
+			return j;
+
+		j += n;
+	}
 }
 
 /*
@@ -73,32 +96,123 @@ prefix_match(const char ***matches, const char **src, const char *prefix)
 int
 common_prefix(const char **av)
 {
-	int i, j, k, n;
+	size_t i, k, max;
 
 	if (av == NULL || av[0] == NULL)
 		return 0;
 
-	mblen(NULL, MB_CUR_MAX);
-	n = mblen(&av[0][0], MB_CUR_MAX);
-	if (n == -1)
+	/* compare bytes first, only the shared bytes are decoded */
+	max = strlen(av[0]);
+	for (i = 1; av[i] != NULL && max > 0; i++) {
+		for (k = 0; k < max && av[i][k] == av[0][k]; k++)
+			;
+		max = k;
+	}
+
+	return mbprefix(av[0], max);
+}
+
+static int
+cmpstr(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/*
+ * Build an index of the strings in "src" that answers prefix queries in
+ * O(log n) string comparisons, see pmindex_range. The strings themselves are
+ * not copied and must outlive the index.
+ *
+ * "src" must be an argv style NULL terminated array with pointers to null
+ * terminated strings.
+ *
+ * Return 0 on success, -1 on failure with errno set. Release with pmindex_free.
+ */
+int
+pmindex_build(struct pmindex *idx, const char **src)
+{
+	size_t n;
+
+	for (n = 0; src != NULL && src[n] != NULL; n++)
+		;
+
+	if ((idx->v = reallocarray(NULL, n + 1, sizeof(*idx->v))) == NULL)
 		return -1;
 
-	j = 0;
-	while (n != 0) {
-		/* compare each av with av[0] */
-		for (i = 1; av[i] != NULL; i++) {
-			for (k = j; k < j + n; k++) {
-				if (av[i][k] != av[0][k])
-					return j; /* j is a count, not an index */
-			}
-		}
+	if (n > 0)
+		memcpy(idx->v, src, n * sizeof(*idx->v));
+	idx->v[n] = NULL;
+	idx->n = n;
 
-		j += n;
+	qsort(idx->v, n, sizeof(*idx->v), cmpstr);
 
-		n = mblen(&av[0][j], MB_CUR_MAX);
-		if (n == -1)
-			return -1;
+	return 0;
+}
+
+/*
+ * Return the number of strings in "idx" that start with "prefix" and set
+ * *first to the position of the first one. The matches are idx->v[*first]
+ * up to but not including idx->v[*first + n], in strcmp(3) order.
+ */
+size_t
+pmindex_range(const struct pmindex *idx, const char *prefix, size_t *first)
+{
+	size_t lo, hi, mid, end, prefsize;
+
+	prefsize = strlen(prefix);
+
+	/* the first string that is not less than prefix */
+	lo = 0;
+	hi = idx->n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(idx->v[mid], prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*first = lo;
+
+	/* the first string after that which does not start with prefix */
+	hi = idx->n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strncmp(idx->v[mid], prefix, prefsize) == 0)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	end = lo;
+
+	return end - *first;
+}
+
+/*
+ * Like common_prefix for the "n" strings at position "first" in "idx", which
+ * is usually a range returned by pmindex_range. Since the strings are sorted
+ * only the first and the last are compared.
+ */
+int
+pmindex_lcp(const struct pmindex *idx, size_t first, size_t n)
+{
+	const char *a, *b;
+	size_t k;
+
+	if (n == 0)
+		return 0;
 
-	return j;
+	a = idx->v[first];
+	b = idx->v[first + n - 1];
+	for (k = 0; a[k] != '\0' && a[k] == b[k]; k++)
+		;
+
+	return mbprefix(a, k);
+}
+
+void
+pmindex_free(struct pmindex *idx)
+{
+	free(idx->v);
+	idx->v = NULL;
+	idx->n = 0;
 }
@@ -17,7 +17,20 @@
 #ifndef PREFIX_MATCH_H
 #define PREFIX_MATCH_H
 
+#include <stddef.h>
+
+/* sorted list of strings for fast prefix queries, see pmindex_build */
+struct pmindex {
+	const char **v;		/* NULL terminated */
+	size_t n;
+};
+
 int prefix_match(const char ***dst, const char **src, const char *prefix);
 int common_prefix(const char **av);
+int pmindex_build(struct pmindex *idx, const char **src);
+size_t pmindex_range(const struct pmindex *idx, const char *prefix,
+    size_t *first);
+int pmindex_lcp(const struct pmindex *idx, size_t first, size_t n);
+void pmindex_free(struct pmindex *idx);
 
 #endif
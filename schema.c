@@ -0,0 +1,287 @@
+/**
+ * Copyright (c) 2026 Tim Kuijsten
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "schema.h"
+
+/*
+ * Return the index of "path" in the fields of "s" and set *found, or return
+ * the index where it should be inserted.
+ */
+static size_t
+search(const struct schema *s, const char *path, int *found)
+{
+	size_t lo, hi, mid;
+	int r;
+
+	*found = 0;
+
+	lo = 0;
+	hi = s->nfields;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		r = strcmp(s->fields[mid].path, path);
+		if (r == 0) {
+			*found = 1;
+			return mid;
+		}
+
+		if (r < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Return the field "path", add it if it does not exist yet.
+ *
+ * Return NULL if there are SCHEMAMAXFIELDS fields or on failure with errno
+ * set.
+ */
+static struct schemafield *
+getfield(struct schema *s, const char *path)
+{
+	struct schemafield *f;
+	size_t i, size;
+	int found;
+
+	i = search(s, path, &found);
+	if (found)
+		return &s->fields[i];
+
+	if (s->nfields >= SCHEMAMAXFIELDS)
+		return NULL;
+
+	if (s->nfields == s->size) {
+		size = s->size == 0 ? 64 : s->size * 2;
+		if ((f = realloc(s->fields, size * sizeof(*f))) == NULL)
+			return NULL;
+		s->fields = f;
+		s->size = size;
+	}
+
+	f = &s->fields[i];
+	memmove(f + 1, f, (s->nfields - i) * sizeof(*f));
+
+	memset(f, 0, sizeof(*f));
+	if ((f->path = strdup(path)) == NULL) {
+		memmove(f, f + 1, (s->nfields - i) * sizeof(*f));
+		return NULL;
+	}
+	s->nfields++;
+
+	return f;
+}
+
+void
+schema_init(struct schema *s)
+{
+	memset(s, 0, sizeof(*s));
+}
+
+/*
+ * Start a new document. All fields added with schema_add until the next call
+ * are counted once.
+ */
+void
+schema_adddoc(struct schema *s)
+{
+	s->ndocs++;
+}
+
+/*
+ * Record that the current document has field "path" of type "type", which
+ * must be less than 32.
+ *
+ * Return 0 on success, -1 on failure with errno set.
+ */
+int
+schema_add(struct schema *s, const char *path, unsigned int type)
+{
+	struct schemafield *f;
+
+	if ((f = getfield(s, path)) == NULL)
+		return s->nfields >= SCHEMAMAXFIELDS ? 0 : -1;
+
+	if (type < 32)
+		f->types |= (uint32_t)1 << type;
+
+	if (f->lastdoc != s->ndocs) {
+		f->lastdoc = s->ndocs;
+		f->count++;
+	}
+
+	return 0;
+}
+
+/*
+ * Add all fields and documents of "src" to "dst".
+ *
+ * Return 0 on success, -1 on failure with errno set.
+ */
+int
+schema_merge(struct schema *dst, const struct schema *src)
+{
+	struct schemafield *f;
+	size_t i;
+
+	for (i = 0; i < src->nfields; i++) {
+		if ((f = getfield(dst, src->fields[i].path)) == NULL) {
+			if (dst->nfields >= SCHEMAMAXFIELDS)
+				continue;
+			return -1;
+		}
+
+		f->types |= src->fields[i].types;
+		f->count += src->fields[i].count;
+	}
+
+	dst->ndocs += src->ndocs;
+
+	/* make sure the next document is counted */
+	for (i = 0; i < dst->nfields; i++)
+		dst->fields[i].lastdoc = 0;
+
+	return 0;
+}
+
+/*
+ * Halve the number of documents and the count of each field, so that old
+ * samples weigh less than new ones. Fields with a count of zero are removed.
+ */
+void
+schema_decay(struct schema *s)
+{
+	size_t i, j;
+
+	s->ndocs /= 2;
+
+	for (i = 0, j = 0; i < s->nfields; i++) {
+		s->fields[i].count /= 2;
+		if (s->fields[i].count == 0) {
+			free(s->fields[i].path);
+			continue;
+		}
+		s->fields[j++] = s->fields[i];
+	}
+	s->nfields = j;
+
+	for (i = 0; i < s->nfields; i++)
+		s->fields[i].lastdoc = 0;
+}
+
+/*
+ * Return the field "path" or NULL if it does not exist.
+ */
+const struct schemafield *
+schema_field(const struct schema *s, const char *path)
+{
+	size_t i;
+	int found;
+
+	i = search(s, path, &found);
+	if (!found)
+		return NULL;
+
+	return &s->fields[i];
+}
+
+/*
+ * Return the distinct completions of "prefix", or NULL on failure with errno
+ * set. Each completion is a field that starts with "prefix", cut off before the
+ * first dot after "prefix". So given the fields "a", "a.b", "a.b.c" and "ab",
+ * "a" completes to "a" and "ab" and "a." completes to "a.b".
+ *
+ * The result is NULL terminated and must be released with schema_freev.
+ */
+char **
+schema_complete(const struct schema *s, const char *prefix)
+{
+	const char *path, *dot;
+	char **v, **p;
+	size_t i, j, n, len, plen;
+	int found;
+
+	plen = strlen(prefix);
+
+	if ((v = calloc(1, sizeof(*v))) == NULL)
+		return NULL;
+	n = 0;
+
+	for (i = search(s, prefix, &found); i < s->nfields; i++) {
+		path = s->fields[i].path;
+		if (strncmp(path, prefix, plen) != 0)
+			break;
+
+		dot = strchr(path + plen, '.');
+		len = dot == NULL ? strlen(path) : (size_t)(dot - path);
+
+		/* paths like "a-b" sort between "a" and "a.b" */
+		for (j = 0; j < n; j++)
+			if (strlen(v[j]) == len && strncmp(v[j], path, len) == 0)
+				break;
+		if (j < n)
+			continue;
+
+		if ((p = realloc(v, (n + 2) * sizeof(*v))) == NULL)
+			goto err;
+		v = p;
+
+		if ((v[n] = strndup(path, len)) == NULL)
+			goto err;
+		v[++n] = NULL;
+	}
+
+	return v;
+
+err:
+	v[n] = NULL;
+	schema_freev(v);
+	return NULL;
+}
+
+void
+schema_freev(char **v)
+{
+	size_t i;
+
+	if (v == NULL)
+		return;
+
+	for (i = 0; v[i] != NULL; i++)
+		free(v[i]);
+	free(v);
+}
+
+void
+schema_free(struct schema *s)
+{
+	size_t i;
+
+	for (i = 0; i < s->nfields; i++)
+		free(s->fields[i].path);
+	free(s->fields);
+
+	schema_init(s);
+}
@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) 2026 Tim Kuijsten
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SCHEMAMAXFIELDS 10000	/* new fields beyond this are ignored */
+
+/* a field path like "a.b.c" that was seen in one or more documents */
+struct schemafield {
+	char *path;
+	uint32_t types;		/* bit n is set if type n was seen */
+	uint64_t count;		/* number of documents with this field */
+	uint64_t lastdoc;	/* to count each document only once */
+};
+
+/*
+ * Index of the field paths in a sample of documents, sorted by path. Nested
+ * fields are included using dot notation.
+ */
+struct schema {
+	struct schemafield *fields;
+	size_t nfields;
+	size_t size;
+	uint64_t ndocs;		/* number of documents sampled */
+};
+
+void schema_init(struct schema *s);
+void schema_adddoc(struct schema *s);
+int schema_add(struct schema *s, const char *path, unsigned int type);
+int schema_merge(struct schema *dst, const struct schema *src);
+void schema_decay(struct schema *s);
+const struct schemafield *schema_field(const struct schema *s,
+    const char *path);
+char **schema_complete(const struct schema *s, const char *prefix);
+void schema_freev(char **v);
+void schema_free(struct schema *s);
+
+#endif
@@ -0,0 +1,138 @@
+#include "../histogram.c"
+
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef VERBOSE
+static int verbose = 1;
+#else
+static int verbose = 0;
+#endif
+
+/*
+ * Check that percentile "p" of "h" is between "lo" and "hi" inclusive.
+ *
+ * Return 0 if test passes, 1 if test fails.
+ */
+static int
+test_percentile(const struct histogram *h, double p, uint64_t lo, uint64_t hi,
+    const char *msg)
+{
+	uint64_t v;
+
+	v = histogram_percentile(h, p);
+	if (v < lo || v > hi) {
+		warnx("FAIL %s p%g: %llu, expected %llu..%llu", msg, p,
+		    (unsigned long long)v, (unsigned long long)lo,
+		    (unsigned long long)hi);
+		return 1;
+	}
+
+	if (verbose)
+		printf("PASS %s p%g: %llu\n", msg, p, (unsigned long long)v);
+
+	return 0;
+}
+
+/*
+ * Check that every value maps to a bucket that contains it and is at most
+ * 1/32 of the value wide.
+ */
+static int
+test_buckets(void)
+{
+	uint64_t v, lo, hi;
+	int b, failed, i;
+
+	failed = 0;
+	for (i = 0; i < 64 * 64; i++) {
+		/* walk every power of two and its neighbours */
+		v = ((uint64_t)1 << (i / 64)) + (i % 64) - 32;
+		if (i / 64 == 0 && i % 64 < 32)
+			v = i % 64;
+
+		b = bucket(v);
+		hi = bucketmax(b);
+		lo = b > 0 ? bucketmax(b - 1) + 1 : 0;
+
+		if (b < 0 || b >= HISTBUCKETS || v < lo || v > hi ||
+		    (v >= HISTSUB && hi - lo > v / 32)) {
+			warnx("FAIL bucket %llu: %d %llu..%llu",
+			    (unsigned long long)v, b, (unsigned long long)lo,
+			    (unsigned long long)hi);
+			failed++;
+		}
+	}
+
+	if (bucket(UINT64_MAX) != HISTBUCKETS - 1 ||
+	    bucketmax(HISTBUCKETS - 1) != UINT64_MAX) {
+		warnx("FAIL last bucket: %d", bucket(UINT64_MAX));
+		failed++;
+	}
+
+	return failed;
+}
+
+int
+main(void)
+{
+	struct histogram h, h2;
+	uint64_t i;
+	int failed;
+
+	failed = 0;
+
+	failed += test_buckets();
+
+	histogram_init(&h);
+	failed += test_percentile(&h, 50, 0, 0, "empty");
+
+	histogram_add(&h, 42);
+	failed += test_percentile(&h, 0, 42, 42, "single");
+	failed += test_percentile(&h, 50, 42, 42, "single");
+	failed += test_percentile(&h, 100, 42, 42, "single");
+
+	/* small values are exact */
+	histogram_init(&h);
+	for (i = 1; i <= 60; i++)
+		histogram_add(&h, i);
+	failed += test_percentile(&h, 50, 30, 30, "exact");
+	failed += test_percentile(&h, 90, 54, 54, "exact");
+
+	/* large values are within the bucket width */
+	histogram_init(&h);
+	for (i = 1; i <= 100000; i++)
+		histogram_add(&h, i);
+	failed += test_percentile(&h, 50, 50000, 50000 + 50000 / 32, "uniform");
+	failed += test_percentile(&h, 99, 99000, 99000 + 99000 / 32,
+	    "uniform");
+	failed += test_percentile(&h, 99.9, 99900, 100000, "uniform");
+	failed += test_percentile(&h, 100, 100000, 100000, "uniform");
+
+	if (h.n != 100000 || h.min != 1 || h.max != 100000 ||
+	    histogram_mean(&h) != 50000) {
+		warnx("FAIL uniform: n %llu min %llu max %llu mean %llu",
+		    (unsigned long long)h.n, (unsigned long long)h.min,
+		    (unsigned long long)h.max,
+		    (unsigned long long)histogram_mean(&h));
+		failed++;
+	}
+
+	/* merging two halves equals recording everything at once */
+	histogram_init(&h);
+	histogram_init(&h2);
+	for (i = 1; i <= 1000; i++)
+		histogram_add(i % 2 ? &h : &h2, i * 1000);
+	histogram_merge(&h, &h2);
+	failed += test_percentile(&h, 50, 500000, 500000 + 500000 / 32,
+	    "merge");
+	if (h.n != 1000 || h.min != 1000 || h.max != 1000000) {
+		warnx("FAIL merge: n %llu min %llu max %llu",
+		    (unsigned long long)h.n, (unsigned long long)h.min,
+		    (unsigned long long)h.max);
+		failed++;
+	}
+
+	return failed;
+}
@@ -1,6 +1,9 @@
 #include "../jsonify.c"
 
+#include <pthread.h>
+
 #define MAXSTR 1024
+#define NTHREADS 4
 
 #ifdef VERBOSE
 static int verbose = 1;
@@ -43,6 +46,208 @@ test_relaxed_to_strict(const char *input, size_t inputlen, int maxobj,
 	return -1;
 }
 
+/*
+ * Convert a document with "n" array elements, more than the old fixed token
+ * and stack limits, starting with a one byte output buffer.
+ *
+ * return 0 if test passes, 1 if test fails, -1 on internal error
+ */
+static int
+test_alloc(size_t n)
+{
+	char *src, *dst, *exp;
+	size_t i, srclen, explen, dstsize;
+	int r, failed;
+
+	if ((src = malloc(8 + 3 * n)) == NULL)
+		abort();
+	if ((exp = malloc(8 + 2 * n)) == NULL)
+		abort();
+
+	srclen = sprintf(src, "{ a: [");
+	explen = sprintf(exp, "{\"a\":[");
+	for (i = 0; i < n; i++) {
+		srclen += sprintf(src + srclen, i ? ", 1" : "1");
+		explen += sprintf(exp + explen, i ? ",1" : "1");
+	}
+	srclen += sprintf(src + srclen, "]}");
+	explen += sprintf(exp + explen, "]}");
+
+	dstsize = 1;
+	if ((dst = malloc(dstsize)) == NULL)
+		abort();
+
+	failed = 0;
+
+	r = relaxed_to_strict_alloc(&dst, &dstsize, src, srclen, 1);
+	if (r != (int)srclen + 1 || strcmp(dst, exp) != 0) {
+		fprintf(stderr, "FAIL: relaxed_to_strict_alloc %zu = exit: %d, "
+		    "expected: %zu\n", n, r, srclen + 1);
+		failed = 1;
+	} else if (verbose) {
+		printf("PASS: relaxed_to_strict_alloc %zu\n", n);
+	}
+
+	r = human_readable_alloc(&dst, &dstsize, exp, explen);
+	if (r != (int)explen + 1 || strncmp(dst, "{\n  a: [1", 9) != 0) {
+		fprintf(stderr, "FAIL: human_readable_alloc %zu = exit: %d, "
+		    "expected: %zu\n", n, r, explen + 1);
+		failed = 1;
+	} else if (verbose) {
+		printf("PASS: human_readable_alloc %zu\n", n);
+	}
+
+	/* the fixed size variant must still refuse to overflow */
+	if (relaxed_to_strict(dst, 4, src, srclen, 1) != -1) {
+		fprintf(stderr, "FAIL: relaxed_to_strict overflow %zu\n", n);
+		failed = 1;
+	}
+
+	free(src);
+	free(exp);
+	free(dst);
+
+	return failed;
+}
+
+/*
+ * Run test_alloc with 50000 plus *arg array elements, store the result in *arg
+ * and release the buffers of this thread.
+ */
+static void *
+allocrun(void *arg)
+{
+	int *failed = arg;
+
+	*failed = test_alloc(50000 + *failed);
+	jsonify_free();
+
+	return NULL;
+}
+
+/*
+ * Convert large documents in several threads at once, which must not share
+ * buffers.
+ *
+ * return 0 if test passes, 1 if test fails, -1 on internal error
+ */
+static int
+test_threads(void)
+{
+	pthread_t thr[NTHREADS];
+	int failed[NTHREADS];
+	int i, n, rc;
+
+	for (i = 0; i < NTHREADS; i++) {
+		failed[i] = i;
+		if ((rc = pthread_create(&thr[i], NULL, allocrun, &failed[i]))
+		    != 0) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+			return -1;
+		}
+	}
+
+	n = 0;
+	for (i = 0; i < NTHREADS; i++) {
+		pthread_join(thr[i], NULL);
+		n += failed[i];
+	}
+
+	return n > 0;
+}
+
+/*
+ * Feed "input" in chunks of "chunk" bytes and join each object found with a
+ * "|". "exp_pending" is the expected result of jsonstream_pending at the end.
+ *
+ * return 0 if test passes, 1 if test fails, -1 on internal error
+ */
+static int
+test_jsonstream(const char *input, size_t chunk, const char *exp,
+    int exp_pending)
+{
+	struct jsonstream js;
+	char dst[MAXSTR];
+	const char *obj;
+	size_t i, n, objlen, dstlen;
+	int r, pending;
+
+	jsonstream_init(&js);
+
+	dst[0] = '\0';
+	dstlen = 0;
+	for (i = 0; i < strlen(input); i += n) {
+		n = strlen(input) - i;
+		if (n > chunk)
+			n = chunk;
+
+		if (jsonstream_feed(&js, input + i, n) == -1)
+			abort();
+
+		while ((r = jsonstream_next(&js, &obj, &objlen)) != 0) {
+			if (r == -1) {
+				if (dstlen + 2 >= sizeof(dst))
+					abort();
+				dst[dstlen++] = '!';
+				dst[dstlen] = '\0';
+				continue;
+			}
+
+			if (dstlen + objlen + 2 >= sizeof(dst))
+				abort();
+
+			if (dstlen > 0)
+				dst[dstlen++] = '|';
+			memcpy(dst + dstlen, obj, objlen);
+			dstlen += objlen;
+			dst[dstlen] = '\0';
+		}
+	}
+
+	pending = jsonstream_pending(&js);
+	jsonstream_free(&js);
+
+	if (strcmp(dst, exp) != 0 || pending != exp_pending) {
+		fprintf(stderr, "FAIL: %s %zu = \"%s\" %d instead of \"%s\" %d\n",
+		    input, chunk, dst, pending, exp, exp_pending);
+		return 1;
+	}
+
+	if (verbose)
+		printf("PASS: %s %zu = \"%s\"\n", input, chunk, dst);
+
+	return 0;
+}
+
+/*
+ * return 0 if test passes, 1 if test fails
+ */
+static int
+test_query_shape(const char *input, const char *exp)
+{
+	char *dst;
+	size_t dstsize;
+	int r;
+
+	dst = NULL;
+	dstsize = 0;
+	r = query_shape_alloc(&dst, &dstsize, input, strlen(input));
+
+	if (r == -1 || strcmp(dst, exp) != 0) {
+		fprintf(stderr, "FAIL: %s = %d \"%s\" instead of \"%s\"\n",
+		    input, r, r == -1 ? "" : dst, exp);
+		free(dst);
+		return 1;
+	}
+
+	if (verbose)
+		printf("PASS: %s = \"%s\"\n", input, dst);
+
+	free(dst);
+
+	return 0;
+}
+
 int
 main(void)
 {
@@ -100,6 +305,69 @@ main(void)
 	exp = "{\"＄in\":\"b\"}";
 	failed += test_relaxed_to_strict(doc, strlen(doc), -1, exp, 15, "");
 
+	if (verbose)
+		printf("test alloc:\n");
+
+	failed += test_alloc(1);
+	failed += test_alloc(200000);
+	failed += test_threads();
+
+	if (verbose)
+		printf("test jsonstream:\n");
+
+	doc = "{ a: 1 }\n{ b: 2 }\n";
+	exp = "{ a: 1 }|{ b: 2 }";
+	failed += test_jsonstream(doc, 1, exp, 0);
+	failed += test_jsonstream(doc, 3, exp, 0);
+	failed += test_jsonstream(doc, 100, exp, 0);
+
+	doc = "[\n  { a: 1 },\n  { b: [1, 2] }\n]\n";
+	exp = "{ a: 1 }|{ b: [1, 2] }";
+	failed += test_jsonstream(doc, 1, exp, 0);
+	failed += test_jsonstream(doc, 100, exp, 0);
+
+	doc = "{\n  a: \"}\\\"{\",\n  b: { c: d }\n}";
+	exp = "{\n  a: \"}\\\"{\",\n  b: { c: d }\n}";
+	failed += test_jsonstream(doc, 1, exp, 0);
+	failed += test_jsonstream(doc, 7, exp, 0);
+
+	doc = "{ a: { b: 1 }";
+	exp = "";
+	failed += test_jsonstream(doc, 4, exp, 1);
+
+	doc = "[{ a: 1 }, { b";
+	exp = "{ a: 1 }";
+	failed += test_jsonstream(doc, 2, exp, 1);
+
+	doc = "x y\n{ a: 1 }";
+	exp = "!|{ a: 1 }";
+	failed += test_jsonstream(doc, 2, exp, 0);
+
+	doc = "{ a: b\"{ }\n{ c: [d\"] }";
+	exp = "{ a: b\"{ }|{ c: [d\"] }";
+	failed += test_jsonstream(doc, 1, exp, 0);
+	failed += test_jsonstream(doc, 100, exp, 0);
+
+	if (verbose)
+		printf("test query_shape:\n");
+
+	failed += test_query_shape("{ a: 1 }", "{a}");
+	failed += test_query_shape("{ a: 'x', b: { $gt: 5, $lt: 9 } }",
+	    "{a,b:{$gt,$lt}}");
+	failed += test_query_shape("{ a: { $in: [1, 2, 3] } }", "{a:{$in:[]}}");
+	failed += test_query_shape("{ $or: [{ a: 1 }, { b: { c: 2 } }] }",
+	    "{$or:[{a},{b:{c}}]}");
+	failed += test_query_shape("{ a: [1, { b: 2 }, [3], 4] }",
+	    "{a:[{b},[]]}");
+	failed += test_query_shape("{ \"a b\": \"}\" }", "{a b}");
+	failed += test_query_shape("{ a: 1 } { $set: { b: 2 } }",
+	    "{a} {$set:{b}}");
+	failed += test_query_shape("[{ $match: { a: 1 } }, { $limit: 5 }]",
+	    "[{$match:{a}},{$limit}]");
+	failed += test_query_shape("57c6fb00495b576b10996f64", "?");
+	failed += test_query_shape("{}", "{}");
+	failed += test_query_shape("", "");
+
 	/*
 	doc = "{ 한: '＄' }";
 	exp = "{ \"한\": \"＄\" }";
@@ -0,0 +1,216 @@
+#include "../linereader.c"
+
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef VERBOSE
+static int verbose = 1;
+#else
+static int verbose = 0;
+#endif
+
+/*
+ * Check that reading "src" of "srclen" bytes yields the lines in "exp", an
+ * argv style NULL terminated array.
+ *
+ * Return 0 if test passes, 1 if test fails.
+ */
+static int
+test_lines(const char *src, size_t srclen, const char **exp, const char *msg)
+{
+	struct linereader lr;
+	FILE *fp;
+	char *line;
+	ssize_t n;
+	size_t i;
+	int failed;
+
+	if ((fp = tmpfile()) == NULL)
+		err(1, "tmpfile");
+
+	if (fwrite(src, 1, srclen, fp) != srclen || fflush(fp) == EOF)
+		err(1, "fwrite");
+	rewind(fp);
+
+	failed = 0;
+	linereader_init(&lr, fileno(fp));
+	for (i = 0; (n = linereader_next(&lr, &line)) >= 0; i++) {
+		if (exp[i] == NULL || strlen(exp[i]) != (size_t)n ||
+		    strcmp(line, exp[i]) != 0) {
+			warnx("FAIL %s line %zu: %zd \"%.20s\", expected "
+			    "\"%.20s\"", msg, i, n, line,
+			    exp[i] ? exp[i] : "(null)");
+			failed = 1;
+			break;
+		}
+	}
+
+	if (!failed && (n != -1 || exp[i] != NULL)) {
+		warnx("FAIL %s: %zd after %zu lines", msg, n, i);
+		failed = 1;
+	}
+
+	/* the end of the input is sticky */
+	if (!failed && linereader_next(&lr, &line) != -1) {
+		warnx("FAIL %s: read after end", msg);
+		failed = 1;
+	}
+
+	linereader_free(&lr);
+	fclose(fp);
+
+	if (!failed && verbose)
+		printf("PASS %s\n", msg);
+
+	return failed;
+}
+
+/*
+ * Lines of increasing length that straddle the block boundaries.
+ */
+static int
+test_blocks(void)
+{
+	const char **exp;
+	char *src, *s;
+	size_t i, n, srclen;
+	int failed;
+
+	n = 2000;
+	if ((exp = calloc(n + 1, sizeof(*exp))) == NULL)
+		err(1, "calloc");
+
+	srclen = 0;
+	for (i = 0; i < n; i++)
+		srclen += i * 7 % 1000 + 1;
+
+	if ((src = malloc(srclen)) == NULL)
+		err(1, "malloc");
+
+	s = src;
+	for (i = 0; i < n; i++) {
+		memset(s, 'a' + i % 26, i * 7 % 1000);
+		s[i * 7 % 1000] = '\0';
+		if ((exp[i] = strdup(s)) == NULL)
+			err(1, "strdup");
+		s[i * 7 % 1000] = '\n';
+		s += i * 7 % 1000 + 1;
+	}
+
+	failed = test_lines(src, srclen, exp, "blocks");
+
+	for (i = 0; i < n; i++)
+		free((char *)exp[i]);
+	free(exp);
+	free(src);
+
+	return failed;
+}
+
+/*
+ * A line that is longer than a few blocks.
+ */
+static int
+test_long(void)
+{
+	const char *exp[] = { "x", NULL, "y", NULL };
+	char *src, *line;
+	size_t len;
+	int failed;
+
+	len = 5 * LRBLOCK + 3;
+	if ((src = malloc(len + 5)) == NULL || (line = malloc(len + 1)) == NULL)
+		err(1, "malloc");
+
+	memset(line, 'b', len);
+	line[len] = '\0';
+	exp[1] = line;
+
+	memcpy(src, "x\n", 2);
+	memcpy(src + 2, line, len);
+	memcpy(src + 2 + len, "\ny\n", 3);
+
+	failed = test_lines(src, len + 5, exp, "long");
+
+	free(line);
+	free(src);
+
+	return failed;
+}
+
+/*
+ * Only complete lines and the end of the input are ready without reading.
+ */
+static int
+test_ready(void)
+{
+	struct linereader lr;
+	char *line;
+	int fds[2], failed;
+
+	if (pipe(fds) == -1)
+		err(1, "pipe");
+
+	failed = 0;
+	linereader_init(&lr, fds[0]);
+
+	if (linereader_ready(&lr)) {
+		warnx("FAIL ready: before reading");
+		failed++;
+	}
+
+	if (write(fds[1], "a\nb\nc", 5) != 5)
+		err(1, "write");
+
+	if (linereader_next(&lr, &line) != 1 || !linereader_ready(&lr)) {
+		warnx("FAIL ready: next line is buffered");
+		failed++;
+	}
+
+	if (linereader_next(&lr, &line) != 1 || linereader_ready(&lr)) {
+		warnx("FAIL ready: incomplete line");
+		failed++;
+	}
+
+	close(fds[1]);
+
+	if (linereader_next(&lr, &line) != 1 || strcmp(line, "c") != 0 ||
+	    !linereader_ready(&lr) || linereader_next(&lr, &line) != -1) {
+		warnx("FAIL ready: end of input");
+		failed++;
+	}
+
+	linereader_free(&lr);
+	close(fds[0]);
+
+	if (!failed && verbose)
+		printf("PASS ready\n");
+
+	return failed;
+}
+
+int
+main(void)
+{
+	const char *exp1[] = { "find", "count {}", NULL };
+	const char *exp2[] = { "", "", "ls", "", NULL };
+	const char *exp3[] = { "no newline", NULL };
+	const char *exp4[] = { NULL };
+	const char *exp5[] = { "a\r", "b", NULL };
+	int failed;
+
+	failed = 0;
+
+	failed += test_lines("find\ncount {}\n", 14, exp1, "lines");
+	failed += test_lines("\n\nls\n\n", 6, exp2, "empty lines");
+	failed += test_lines("no newline", 10, exp3, "no newline");
+	failed += test_lines("", 0, exp4, "empty");
+	failed += test_lines("a\r\nb", 4, exp5, "carriage return");
+
+	failed += test_blocks();
+	failed += test_long();
+	failed += test_ready();
+
+	return failed;
+}
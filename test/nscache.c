@@ -0,0 +1,226 @@
+#include "../nscache.c"
+
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef VERBOSE
+static int verbose = 1;
+#else
+static int verbose = 0;
+#endif
+
+/*
+ * Check that the names under "key" for "prefix" at time "now" equal "exp",
+ * which is a space separated list or NULL if no names are expected.
+ *
+ * Return 0 if test passes, 1 if test fails.
+ */
+static int
+test_getprefix(const struct nscache *c, const char *key, const char *prefix,
+    time_t now, const char *exp, const char *msg)
+{
+	char buf[1024], **names;
+	size_t i;
+
+	buf[0] = '\0';
+	if ((names = nscache_get(c, key, prefix, now, NULL)) != NULL) {
+		for (i = 0; names[i] != NULL; i++) {
+			if (i > 0)
+				strcat(buf, " ");
+			strcat(buf, names[i]);
+		}
+	}
+
+	if ((exp == NULL) != (names == NULL) ||
+	    (exp != NULL && strcmp(buf, exp) != 0)) {
+		warnx("FAIL %s: \"%s\", expected \"%s\"", msg,
+		    names == NULL ? "(null)" : buf,
+		    exp == NULL ? "(null)" : exp);
+		return 1;
+	}
+
+	if (verbose)
+		printf("PASS %s\n", msg);
+
+	return 0;
+}
+
+static int
+test_get(const struct nscache *c, const char *key, time_t now, const char *exp,
+    const char *msg)
+{
+	return test_getprefix(c, key, "", now, exp, msg);
+}
+
+/*
+ * Check that loading "src" into a cache fails and leaves it empty.
+ *
+ * Return 0 if test passes, 1 if test fails.
+ */
+static int
+test_badload(const char *src, const char *msg)
+{
+	struct nscache c;
+	char *names[] = { "x", NULL };
+	FILE *fp;
+	int r;
+
+	if ((fp = tmpfile()) == NULL)
+		err(1, "tmpfile");
+
+	fputs(src, fp);
+	rewind(fp);
+
+	nscache_init(&c, 10);
+	if (nscache_put(&c, "keep", "", names, 0) == -1)
+		err(1, "nscache_put");
+
+	r = nscache_load(&c, fp);
+	fclose(fp);
+
+	if (r != -1 || c.nentries != 0) {
+		warnx("FAIL %s: %d %zu", msg, r, c.nentries);
+		nscache_free(&c);
+		return 1;
+	}
+	nscache_free(&c);
+
+	if (verbose)
+		printf("PASS %s\n", msg);
+
+	return 0;
+}
+
+int
+main(void)
+{
+	struct nscache c, c2;
+	char *dbs[] = { "db1", "admin", "db0", NULL };
+	char *colls[] = { "a b", "c\nd", "e", NULL };
+	char *none[] = { NULL };
+	char *ord[] = { "orders", "ordinal", NULL };
+	char *all[] = { "orders", "a", NULL };
+	FILE *fp;
+	int failed;
+
+	failed = 0;
+
+	nscache_init(&c, 10);
+	failed += test_get(&c, "", 100, NULL, "empty");
+
+	if (nscache_put(&c, "", "", dbs, 100) == -1 ||
+	    nscache_put(&c, "db0", "", colls, 105) == -1 ||
+	    nscache_put(&c, "db1", "", none, 100) == -1)
+		err(1, "nscache_put");
+
+	failed += test_get(&c, "", 100, "admin db0 db1", "put sorted");
+	failed += test_get(&c, "db0", 114, "a b c\nd e", "put");
+	failed += test_get(&c, "db1", 100, "", "put empty");
+	failed += test_get(&c, "db2", 100, NULL, "put other");
+
+	/* expire after the ttl or if the clock goes back */
+	failed += test_get(&c, "", 110, NULL, "ttl");
+	failed += test_get(&c, "db0", 115, NULL, "ttl");
+	failed += test_get(&c, "", 99, NULL, "clock back");
+
+	/* replace */
+	if (nscache_put(&c, "", "", colls, 110) == -1)
+		err(1, "nscache_put");
+	failed += test_get(&c, "", 110, "a b c\nd e", "replace");
+	if (c.nentries != 3) {
+		warnx("FAIL replace: %zu entries", c.nentries);
+		failed++;
+	}
+
+	/* save and load */
+	if ((fp = tmpfile()) == NULL)
+		err(1, "tmpfile");
+	if (nscache_save(&c, fp) == -1)
+		err(1, "nscache_save");
+	rewind(fp);
+
+	nscache_init(&c2, 10);
+	if (nscache_load(&c2, fp) == -1) {
+		warnx("FAIL load");
+		failed++;
+	}
+	fclose(fp);
+
+	failed += test_get(&c2, "", 110, "a b c\nd e", "load");
+	failed += test_get(&c2, "db0", 105, "a b c\nd e", "load");
+	failed += test_get(&c2, "db1", 100, "", "load empty");
+	nscache_free(&c2);
+
+	/* invalidate */
+	nscache_invalidate(&c, "db0");
+	failed += test_get(&c, "db0", 105, NULL, "invalidate");
+	failed += test_get(&c, "", 110, "a b c\nd e", "invalidate other");
+	nscache_invalidate(&c, NULL);
+	if (c.nentries != 0) {
+		warnx("FAIL invalidate all: %zu entries", c.nentries);
+		failed++;
+	}
+	nscache_free(&c);
+
+	/* a list of the names with a prefix covers longer prefixes */
+	nscache_init(&c, 10);
+	if (nscache_put(&c, "db2", "ord", ord, 100) == -1)
+		err(1, "nscache_put");
+	failed += test_getprefix(&c, "db2", "ord", 100, "orders ordinal",
+	    "prefix");
+	failed += test_getprefix(&c, "db2", "orde", 100, "orders ordinal",
+	    "prefix longer");
+	failed += test_getprefix(&c, "db2", "o", 100, NULL, "prefix shorter");
+	failed += test_get(&c, "db2", 100, NULL, "prefix all");
+	failed += test_getprefix(&c, "db3", "ord", 100, NULL, "prefix other");
+
+	/* the longest prefix wins and a shorter one replaces longer ones */
+	if (nscache_put(&c, "db2", "orde", ord, 100) == -1 ||
+	    nscache_put(&c, "db2", "x", none, 100) == -1)
+		err(1, "nscache_put");
+	failed += test_getprefix(&c, "db2", "xy", 100, "", "prefix longest");
+	if (nscache_put(&c, "db2", "", all, 101) == -1)
+		err(1, "nscache_put");
+	failed += test_getprefix(&c, "db2", "ord", 101, "a orders",
+	    "prefix replace");
+	if (c.nentries != 1) {
+		warnx("FAIL prefix replace: %zu entries", c.nentries);
+		failed++;
+	}
+
+	/* save and load prefixes */
+	if (nscache_put(&c, "db3", "o", ord, 100) == -1)
+		err(1, "nscache_put");
+	if ((fp = tmpfile()) == NULL)
+		err(1, "tmpfile");
+	if (nscache_save(&c, fp) == -1)
+		err(1, "nscache_save");
+	rewind(fp);
+
+	nscache_init(&c2, 10);
+	if (nscache_load(&c2, fp) == -1) {
+		warnx("FAIL load prefix");
+		failed++;
+	}
+	fclose(fp);
+
+	failed += test_getprefix(&c2, "db3", "or", 100, "orders ordinal",
+	    "load prefix");
+	failed += test_get(&c2, "db3", 100, NULL, "load prefix all");
+	failed += test_get(&c2, "db2", 101, "a orders", "load all");
+	nscache_free(&c2);
+	nscache_free(&c);
+
+	failed += test_badload("", "no magic");
+	failed += test_badload("mongovi nscache 1\n", "wrong magic");
+	failed += test_badload(MAGIC "100 1 3:db0\n", "truncated");
+	failed += test_badload(MAGIC "100 1 3:db0\n0:\n5:a\n", "short name");
+	failed += test_badload(MAGIC "100 1 4:db0\n0:\n1:a\n", "long key");
+	failed += test_badload(MAGIC "100 0 3:db0\n0:\nx", "garbage");
+	failed += test_badload(MAGIC "100 0 3:db0\n", "no prefix");
+	failed += test_badload(MAGIC "100 0 3:db0\n2:a\n", "short prefix");
+	failed += test_badload(MAGIC "100 0 5000:x\n", "key too long");
+
+	return failed;
+}
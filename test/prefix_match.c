@@ -61,11 +61,13 @@ test_prefix_match(const char **src, const char *prefix, const char **exp,
 		return 1;
 	}
 	if (arrcmp(dst, exp) == 0) {
+		free(dst);
 		if (verbose)
 			printf("PASS: %s\n", prefix);
 
 		return 0;
 	} else {
+		free(dst);
 		warnx("FAIL: %s\n", prefix);
 		return 1;
 	}
@@ -96,9 +98,42 @@ test_common_prefix(const char **src, const char *prefix, const int exp_exit)
 	return -1;
 }
 
+/*
+ * Check that "prefix" matches "exp" in "idx" and that the common prefix of the
+ * matches is "explcp" bytes.
+ *
+ * return 0 if test passes, 1 if test fails
+ */
+static int
+test_pmindex(const struct pmindex *idx, const char *prefix, const char **exp,
+    int explcp)
+{
+	size_t first, i, n;
+	int lcp;
+
+	n = pmindex_range(idx, prefix, &first);
+	lcp = pmindex_lcp(idx, first, n);
+
+	for (i = 0; i < n && exp[i] != NULL; i++)
+		if (strcmp(idx->v[first + i], exp[i]) != 0)
+			break;
+
+	if (i != n || exp[i] != NULL || lcp != explcp) {
+		warnx("FAIL: pmindex %s = %zu matches, lcp %d, expected %d",
+		    prefix, n, lcp, explcp);
+		return 1;
+	}
+
+	if (verbose)
+		printf("PASS: pmindex %s\n", prefix);
+
+	return 0;
+}
+
 int
 main(void)
 {
+	struct pmindex idx;
 	int failed = 0;
 	const char *src[] = {
 		"a",
@@ -184,5 +219,54 @@ main(void)
 
 	failed += test_common_prefix(src5, "x", 1);
 
+	/* only whole characters are shared */
+	const char *src6[] = {
+		"x\xef\xbc\x84",
+		"x\xef\xbc",
+		NULL
+	};
+
+	failed += test_common_prefix(src6, "x", 1);
+
+	if (verbose)
+		printf("\ntest pmindex:\n");
+
+	const char *src7[] = {
+		"c",
+		"b2a",
+		"a",
+		"b2",
+		"b1",
+		NULL
+	};
+
+	if (pmindex_build(&idx, src7) == -1)
+		err(1, "pmindex_build");
+
+	failed += test_pmindex(&idx, "", exp6, 0);
+	failed += test_pmindex(&idx, "x", exp1, 0);
+	failed += test_pmindex(&idx, "0", exp1, 0);
+	failed += test_pmindex(&idx, "a", exp2, 1);
+	failed += test_pmindex(&idx, "b", exp3, 1);
+	failed += test_pmindex(&idx, "b2", exp4, 2);
+	failed += test_pmindex(&idx, "b2a", exp5, 3);
+	failed += test_pmindex(&idx, "b2b", exp1, 0);
+	pmindex_free(&idx);
+
+	if (pmindex_build(&idx, src5) == -1)
+		err(1, "pmindex_build");
+
+	failed += test_pmindex(&idx, "x", src5, 1);
+	const char *exp7[] = {"x\xef\xbc\x85", NULL};
+
+	failed += test_pmindex(&idx, "x\xef\xbc\x85", exp7, 4);
+	pmindex_free(&idx);
+
+	if (pmindex_build(&idx, NULL) == -1)
+		err(1, "pmindex_build");
+
+	failed += test_pmindex(&idx, "", exp1, 0);
+	pmindex_free(&idx);
+
 	return failed;
 }
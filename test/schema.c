@@ -0,0 +1,164 @@
+#include "../schema.c"
+
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef VERBOSE
+static int verbose = 1;
+#else
+static int verbose = 0;
+#endif
+
+/*
+ * Check that "prefix" completes to "exp", a space separated list.
+ *
+ * Return 0 if test passes, 1 if test fails.
+ */
+static int
+test_complete(const struct schema *s, const char *prefix, const char *exp)
+{
+	char buf[1024], **v;
+	size_t i;
+
+	if ((v = schema_complete(s, prefix)) == NULL)
+		err(1, "schema_complete");
+
+	buf[0] = '\0';
+	for (i = 0; v[i] != NULL; i++) {
+		if (i > 0)
+			strcat(buf, " ");
+		strcat(buf, v[i]);
+	}
+	schema_freev(v);
+
+	if (strcmp(buf, exp) != 0) {
+		warnx("FAIL complete \"%s\": \"%s\", expected \"%s\"", prefix,
+		    buf, exp);
+		return 1;
+	}
+
+	if (verbose)
+		printf("PASS complete \"%s\": \"%s\"\n", prefix, buf);
+
+	return 0;
+}
+
+/*
+ * Check the count and types of field "path".
+ *
+ * Return 0 if test passes, 1 if test fails.
+ */
+static int
+test_field(const struct schema *s, const char *path, uint64_t count,
+    uint32_t types)
+{
+	const struct schemafield *f;
+
+	f = schema_field(s, path);
+	if (count == 0 && f == NULL)
+		return 0;
+
+	if (f == NULL || f->count != count || f->types != types) {
+		warnx("FAIL field %s: %llu %x, expected %llu %x", path,
+		    f == NULL ? 0 : (unsigned long long)f->count,
+		    f == NULL ? 0 : f->types, (unsigned long long)count,
+		    types);
+		return 1;
+	}
+
+	if (verbose)
+		printf("PASS field %s\n", path);
+
+	return 0;
+}
+
+int
+main(void)
+{
+	struct schema s, s2;
+	char path[32];
+	int failed, i;
+
+	failed = 0;
+
+	schema_init(&s);
+	failed += test_complete(&s, "", "");
+
+	/* { a: { b: 1, c: "x" }, ab: 1 } */
+	schema_adddoc(&s);
+	schema_add(&s, "a", 3);
+	schema_add(&s, "a.b", 16);
+	schema_add(&s, "a.c", 2);
+	schema_add(&s, "ab", 16);
+
+	/* { a: [{ b: 1.5 }, { b: 2 }], a-x: null } */
+	schema_adddoc(&s);
+	schema_add(&s, "a", 4);
+	schema_add(&s, "a.b", 1);
+	schema_add(&s, "a.b", 16);
+	schema_add(&s, "a-x", 10);
+
+	failed += test_field(&s, "a", 2, 1 << 3 | 1 << 4);
+	failed += test_field(&s, "a.b", 2, 1 << 1 | 1 << 16);
+	failed += test_field(&s, "a.c", 1, 1 << 2);
+	failed += test_field(&s, "a-x", 1, 1 << 10);
+	failed += test_field(&s, "b", 0, 0);
+
+	failed += test_complete(&s, "", "a a-x ab");
+	failed += test_complete(&s, "a", "a a-x ab");
+	failed += test_complete(&s, "a.", "a.b a.c");
+	failed += test_complete(&s, "a.b", "a.b");
+	failed += test_complete(&s, "b", "");
+
+	/* merge a sample of one more document */
+	schema_init(&s2);
+	schema_adddoc(&s2);
+	schema_add(&s2, "a", 3);
+	schema_add(&s2, "a.b.c", 18);
+	if (schema_merge(&s, &s2) == -1)
+		err(1, "schema_merge");
+	schema_free(&s2);
+
+	if (s.ndocs != 3) {
+		warnx("FAIL merge: %llu documents", (unsigned long long)s.ndocs);
+		failed++;
+	}
+	failed += test_field(&s, "a", 3, 1 << 3 | 1 << 4);
+	failed += test_field(&s, "a.b.c", 1, 1 << 18);
+	failed += test_complete(&s, "a.b", "a.b");
+	failed += test_complete(&s, "a.b.", "a.b.c");
+
+	/* fields that are seen once fade away */
+	schema_decay(&s);
+	if (s.ndocs != 1) {
+		warnx("FAIL decay: %llu documents", (unsigned long long)s.ndocs);
+		failed++;
+	}
+	failed += test_field(&s, "a", 1, 1 << 3 | 1 << 4);
+	failed += test_field(&s, "a.b", 1, 1 << 1 | 1 << 16);
+	failed += test_field(&s, "a.c", 0, 0);
+	failed += test_complete(&s, "", "a");
+
+	/* the adddoc after a decay counts again */
+	schema_adddoc(&s);
+	schema_add(&s, "a", 3);
+	failed += test_field(&s, "a", 2, 1 << 3 | 1 << 4);
+	schema_free(&s);
+
+	/* the number of fields is bounded */
+	schema_init(&s);
+	schema_adddoc(&s);
+	for (i = 0; i < SCHEMAMAXFIELDS + 10; i++) {
+		snprintf(path, sizeof(path), "f%d", i);
+		if (schema_add(&s, path, 2) == -1)
+			err(1, "schema_add");
+	}
+	if (s.nfields != SCHEMAMAXFIELDS) {
+		warnx("FAIL max fields: %zu", s.nfields);
+		failed++;
+	}
+	schema_free(&s);
+
+	return failed;
+}